@@ -0,0 +1,718 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "codegen.h"
+#include "compiler.h"
+#include "environment.h"
+#include "error.h"
+#include "lex_parallel.h"
+#include "node_intern.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "program_generator.h"
+#include "timing.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#endif
+
+struct BenchResult {
+    std::string name;
+    size_t size;
+    size_t bytes;
+    size_t repetitions;
+    double min_ms;
+    double median_ms;
+    double mean_ms;
+};
+
+struct BenchOptions {
+    size_t repetitions;
+    double scale;
+    const char *filter;
+    const char *json_path;
+    /// Directory of inputs saved by func_perf_fuzz, each compiled as its own benchmark.
+    const char *regressions_path;
+
+    BenchOptions():
+        repetitions(5),
+        scale(1.0),
+        filter(nullptr),
+        json_path(nullptr),
+        regressions_path(nullptr)
+    {}
+};
+
+static BenchOptions bench_options;
+static std::vector<BenchResult> bench_results;
+
+static size_t scaled(size_t count) {
+    size_t out = static_cast<size_t>(count * bench_options.scale);
+    return out ? out : 1;
+}
+
+/// Time `run` after an untimed `setup`; both are repeated for every repetition.
+static void benchRun(const std::string &name, size_t size, size_t bytes,
+                     const std::function<void()> &setup,
+                     const std::function<void()> &run) {
+    if (bench_options.filter && name.find(bench_options.filter) == std::string::npos)
+        return;
+    std::vector<double> samples;
+    for (size_t i = 0; i < bench_options.repetitions; i++) {
+        if (setup)
+            setup();
+        long long begin = timingNow();
+        run();
+        samples.push_back((timingNow() - begin) / 1e6);
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double sample : samples)
+        sum += sample;
+
+    BenchResult result;
+    result.name = name;
+    result.size = size;
+    result.bytes = bytes;
+    result.repetitions = samples.size();
+    result.min_ms = samples.front();
+    result.median_ms = samples[samples.size() / 2];
+    result.mean_ms = sum / samples.size();
+    bench_results.push_back(result);
+
+    std::cout << std::left << std::setw(36) << name
+              << std::right << std::setw(10) << size
+              << std::setw(12) << std::fixed << std::setprecision(3) << result.min_ms << " ms"
+              << std::setw(12) << result.median_ms << " ms";
+    if (bytes)
+        std::cout << std::setw(10) << std::setprecision(1) << bytes / (result.median_ms * 1e3) << " MB/s";
+    std::cout << std::endl;
+}
+
+static Error parseBuffer(std::string &source, ParsingContext *context, Node *program) {
+    Error err = ok;
+    program->type = NodeType::PROGRAM;
+    char *contents_it = &source[0];
+    for(;;){
+        Node *expression = nodeAllocate();
+        nodeAddChild(program, expression);
+        err = parseExpr(context, contents_it, &contents_it, expression);
+        if (err.type != ErrorType::NONE)
+            return err;
+        if (!(*contents_it))
+            break;
+    }
+    return ok;
+}
+
+//================================================================ MICRO BENCHMARKS
+
+static void benchLex(const std::string &name, const GeneratorOptions &shape) {
+    std::string source = generateProgram(shape);
+    size_t tokens = 0;
+    benchRun(name, source.size(), source.size(), nullptr, [&]() {
+        Token token;
+        token.begin = &source[0];
+        token.end = token.begin;
+        tokens = 0;
+        while (lex(token.end, &token).type == ErrorType::NONE && token.end != token.begin)
+            tokens++;
+    });
+}
+
+static void benchLexParallel(const std::string &name, const GeneratorOptions &shape, size_t threads) {
+    std::string source = generateProgram(shape);
+    TokenStream stream;
+    benchRun(name, source.size(), source.size(), nullptr, [&]() {
+        Error err = lexParallel(&source[0], source.size(), threads, &stream);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+    if (bench_options.filter && name.find(bench_options.filter) == std::string::npos)
+        return;
+    // The stream must read back exactly what sequential lexing produces.
+    Token token;
+    token.begin = &source[0];
+    token.end = token.begin;
+    Token streamed = token;
+    size_t index = 0;
+    for (;;) {
+        bool lexed = lex(token.end, &token).type == ErrorType::NONE && token.end != token.begin;
+        tokenStreamNext(&stream, streamed.end, &streamed);
+        if (!lexed && streamed.begin == streamed.end)
+            break;
+        if (!lexed || streamed.begin != token.begin || streamed.end != token.end) {
+            std::cout << "lexParallel(): token " << index << " differs from sequential lexing\n";
+            break;
+        }
+        index++;
+    }
+    tokenStreamClear(&stream);
+}
+
+static void benchParseExpr(const std::string &name, const GeneratorOptions &shape) {
+    std::string source = generateProgram(shape);
+    ParsingContext *context = nullptr;
+    Node *program = nullptr;
+    benchRun(name, source.size(), source.size(), [&]() {
+        deleteNode(program);
+        context = parseContextDefaultCreate();
+        program = nodeAllocate();
+    }, [&]() {
+        Error err = parseBuffer(source, context, program);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+    deleteNode(program);
+}
+
+/// parseProgramBuffer(), which with `defer_bodies` parses only the bodies of called functions.
+static void benchParseProgram(const std::string &name, const GeneratorOptions &shape, bool defer_bodies) {
+    std::string source = generateProgram(shape);
+    ParsingContext *context = parseContextDefaultCreate();
+    Node *program = nullptr;
+    benchRun(name, source.size(), source.size(), [&]() {
+        parseContextReset(context);
+        deleteNode(program);
+        context->defer_bodies = defer_bodies;
+        program = nodeAllocate();
+    }, [&]() {
+        Error err = parseProgramBuffer(&source[0], context, program);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+    parseContextReset(context);
+    deleteNode(program);
+    parseContextDelete(context);
+}
+
+static void benchEnvironment(size_t count) {
+    std::vector<Node *> ids;
+    for (size_t i = 0; i < count; i++)
+        ids.push_back(nodeSymbol(("v" + std::to_string(i)).c_str()));
+    Node *value = nodeInteger(0);
+    Environment *env = nullptr;
+
+    benchRun("environmentSet", count, 0, [&]() {
+        env = environmentCreate(nullptr);
+    }, [&]() {
+        for (Node *id : ids)
+            environmentSet(env, id, value);
+    });
+
+    Node *result = nodeAllocate();
+    benchRun("environmentGet", count, 0, nullptr, [&]() {
+        for (Node *id : ids)
+            environmentGet(*env, id, result);
+    });
+}
+
+static void benchNodeAddChild(size_t count) {
+    Node *parent = nullptr;
+    benchRun("nodeAddChild", count, 0, [&]() {
+        deleteNode(parent);
+        parent = nodeAllocate();
+    }, [&]() {
+        for (size_t i = 0; i < count; i++)
+            nodeAddChild(parent, nodeAllocate());
+    });
+    deleteNode(parent);
+}
+
+static void benchCodegen(const std::string &name, const GeneratorOptions &shape) {
+    std::string source = generateProgram(shape);
+    ParsingContext *context = parseContextDefaultCreate();
+    Node *program = nodeAllocate();
+    Error err = parseBuffer(source, context, program);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        return;
+    }
+    benchRun(name, source.size(), 0, nullptr, [&]() {
+        Error err = codegen_program(CodegenOutputFormat::DEFAULT, context, program);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+    deleteNode(program);
+}
+
+static void benchIntern(const std::string &name, const GeneratorOptions &shape) {
+    std::string source = generateProgram(shape);
+    ParsingContext *context = parseContextDefaultCreate();
+    Node *program = nodeAllocate();
+    Error err = parseBuffer(source, context, program);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        return;
+    }
+    Node *copy = nodeAllocate();
+    nodeCopy(program, copy);
+    benchRun("nodeCompare/" + name, source.size(), 0, nullptr, [&]() {
+        if (!nodeCompare(program, copy))
+            std::cout << "nodeCompare(): copy of program compared unequal\n";
+    });
+
+    NodeInterner *interner = nullptr;
+    Node *interned = nullptr;
+    benchRun("nodeIntern/" + name, source.size(), 0, [&]() {
+        nodeInternerDelete(interner);
+        interner = nodeInternerCreate();
+    }, [&]() {
+        interned = nodeIntern(interner, program);
+    });
+    if (!interner) {
+        // Filtered out.
+        deleteNode(copy);
+        deleteNode(program);
+        return;
+    }
+    NodeInternerStats stats = nodeInternerStats(interner);
+    std::cout << "    " << stats.unique_nodes << " unique of " << stats.lookups << " nodes\n";
+
+    if (!nodeCompare(program, interned))
+        std::cout << "nodeCompare(): interned program compared unequal to the original\n";
+    Node *interned_again = nodeIntern(interner, copy);
+    benchRun("nodeCompare/" + name + "_interned", source.size(), 0, nullptr, [&]() {
+        if (!nodeCompare(interned, interned_again))
+            std::cout << "nodeCompare(): interned program compared unequal\n";
+    });
+    nodeInternerDelete(interner);
+    deleteNode(copy);
+    deleteNode(program);
+}
+
+//================================================================ STRESS
+
+/// Deeply nested calls through every tree walk: parse, copy, codegen, free.
+static void benchNesting(size_t depth) {
+    GeneratorOptions shape;
+    shape.globals = 0;
+    shape.functions = 1;
+    shape.parameters = 2;
+    shape.calls = 0;
+    shape.reassignments = 0;
+    shape.nesting_depth = depth;
+    std::string source = generateProgram(shape);
+
+    ParsingContext *context = nullptr;
+    Node *program = nullptr;
+    benchRun("stress/parse_nested", depth, source.size(), [&]() {
+        deleteNode(program);
+        context = parseContextDefaultCreate();
+        program = nodeAllocate();
+    }, [&]() {
+        Error err = parseBuffer(source, context, program);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+
+    Node *copy = nullptr;
+    benchRun("stress/nodeCopy_nested", depth, 0, [&]() {
+        deleteNode(copy);
+        copy = nodeAllocate();
+    }, [&]() {
+        nodeCopy(program, copy);
+    });
+
+    benchRun("stress/codegen_nested", depth, 0, nullptr, [&]() {
+        Error err = codegen_program(CodegenOutputFormat::DEFAULT, context, program);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+
+    benchRun("stress/deleteNode_nested", depth, 0, [&]() {
+        deleteNode(copy);
+        copy = nodeAllocate();
+        nodeCopy(program, copy);
+    }, [&]() {
+        deleteNode(copy);
+        copy = nullptr;
+    });
+    deleteNode(program);
+}
+
+//================================================================ MACRO BENCHMARKS
+
+static void benchCompile(const std::string &name, const GeneratorOptions &shape) {
+    std::string source = generateProgram(shape);
+    std::string path = "bench_" + name + ".txt";
+    std::replace(path.begin(), path.end(), '/', '_');
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << source;
+    }
+    benchRun(name, source.size(), source.size(), nullptr, [&]() {
+        ParsingContext *context = parseContextDefaultCreate();
+        Node *program = nodeAllocate();
+        Error err = parseProgram(&path[0], context, program);
+        if (err.type == ErrorType::NONE)
+            err = codegen_program(CodegenOutputFormat::DEFAULT, context, program);
+        if (err.type != ErrorType::NONE)
+            printError(err);
+        deleteNode(program);
+    });
+    std::remove(path.c_str());
+}
+
+static Error benchStreamExpression(Node *expression, void *data) {
+    return codegen_stream_expression(static_cast<CodegenStream *>(data), expression);
+}
+
+/// The streaming compile, on one thread or overlapped on three with pipelineCompile().
+static void benchCompileStream(const std::string &name, const GeneratorOptions &shape, bool pipelined) {
+    std::string source = generateProgram(shape);
+    std::string path = "bench_" + name + ".txt";
+    std::replace(path.begin(), path.end(), '/', '_');
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << source;
+    }
+    benchRun(name, source.size(), source.size(), nullptr, [&]() {
+        Error err = ok;
+        if (pipelined) {
+            err = pipelineCompile(&path[0], CodegenOutputFormat::DEFAULT, nullptr);
+        } else {
+            ParsingContext *context = parseContextDefaultCreate();
+            CodegenStream stream;
+            err = codegen_stream_begin(&stream, CodegenOutputFormat::DEFAULT, context);
+            if (err.type == ErrorType::NONE)
+                err = parseProgramStream(&path[0], context, benchStreamExpression, &stream);
+            if (err.type == ErrorType::NONE)
+                err = codegen_stream_end(&stream);
+            for (Binding *it = context->functions->bind; it; it = it->next)
+                deleteNode(it->value);
+            parseContextReset(context);
+            parseContextDelete(context);
+        }
+        if (err.type != ErrorType::NONE)
+            printError(err);
+    });
+    std::remove(path.c_str());
+}
+
+/// Many small programs through one warm Compiler, entirely in memory.
+static void benchCompileSnippets(const std::string &name, size_t count) {
+    std::vector<std::string> snippets;
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        GeneratorOptions shape;
+        shape.globals = 4;
+        shape.functions = 2;
+        shape.parameters = 2;
+        shape.calls = 8;
+        shape.reassignments = 4;
+        shape.seed = static_cast<unsigned>(i);
+        snippets.push_back(generateProgram(shape));
+        bytes += snippets.back().size();
+    }
+    // No cache: every snippet is distinct, and the point is the compile itself.
+    Compiler *compiler = compilerCreate(0);
+    std::string output;
+    CompileOptions options;
+    benchRun(name, count, bytes, nullptr, [&]() {
+        for (const std::string &snippet : snippets) {
+            output.clear();
+            Error err = compilerCompileBuffer(compiler, snippet.data(), snippet.size(), options, &output, nullptr);
+            if (err.type != ErrorType::NONE) {
+                printError(err);
+                break;
+            }
+        }
+    });
+    compilerDelete(compiler);
+}
+
+//================================================================ RUNTIME BENCHMARKS
+
+/// A loop with an invariant assignment and multiplications of its induction variable.
+static std::string loopProgram(size_t iterations) {
+    return "i : integer = 0\n"
+           "n : integer = " + std::to_string(iterations) + "\n"
+           "s : integer\n"
+           "a : integer = 7\n"
+           "b : integer\n"
+           "c : integer\n"
+           "while i < n {\n"
+           "  b := a * a * 3 + a * 5 + 1\n"
+           "  c := b * b + a * b * 7\n"
+           "  s := s + i * 24 + i * 10 + c\n"
+           "  i := i + 1\n"
+           "}\n";
+}
+
+/**
+ * Time runs of the compiled program, linked with an entry point that calls
+ * _start and exits. The generated code follows the MS x64 convention but
+ * uses no OS, so it runs on x86_64 Linux; skipped without `as` and `ld`.
+ * C99 output is built with `cc -O2` instead, as the reference to compare against.
+ */
+static void benchRuntime(const std::string &name, size_t size, const std::string &source, const CompileOptions &options) {
+    if (bench_options.filter && name.find(bench_options.filter) == std::string::npos)
+        return;
+    Compiler *compiler = compilerCreate(0);
+    std::string output;
+    Error err = compilerCompileBuffer(compiler, source.data(), source.size(), options, &output, nullptr);
+    compilerDelete(compiler);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        return;
+    }
+
+    std::string base = "bench_" + name;
+    std::replace(base.begin(), base.end(), '/', '_');
+    bool is_c = options.format == CodegenOutputFormat::C99;
+    std::string source_file = base + (is_c ? ".c" : ".S");
+    std::string build;
+    if (is_c) {
+        std::ofstream file(source_file, std::ios::binary);
+        file << output;
+        build = "cc -std=c99 -O2 " + source_file + " -o " + base + " > /dev/null 2>&1";
+    } else {
+        std::ofstream file(source_file, std::ios::binary);
+        file << output
+             << ".section .text\n"
+             << ".global bench_entry\n"
+             << "bench_entry:\n"
+             << "call _start\n"
+             << "mov $60, %eax\n"
+             << "xor %edi, %edi\n"
+             << "syscall\n";
+        build = "as " + source_file + " -o " + base + ".o && ld -e bench_entry " + base + ".o -o " + base
+              + " > /dev/null 2>&1";
+    }
+    if (std::system(build.c_str()) == 0) {
+        std::string run = "./" + base;
+        benchRun(name, size, 0, nullptr, [&]() {
+            if (std::system(run.c_str()) != 0)
+                std::cout << name << ": the program failed\n";
+        });
+    } else {
+        std::cout << name << (is_c ? " skipped: could not compile with cc\n"
+                                   : " skipped: could not assemble and link with as and ld\n");
+    }
+    std::remove(source_file.c_str());
+    std::remove((base + ".o").c_str());
+    std::remove(base.c_str());
+}
+
+/// Parse and generate code for every `perf-regression-*.txt` input func_perf_fuzz saved in `path`.
+static void benchRegressions(const char *path) {
+#if defined(__unix__) || defined(__APPLE__)
+    DIR *directory = opendir(path);
+    if (!directory) {
+        std::cout << "Could not open regressions directory " << path << '\n';
+        return;
+    }
+    std::vector<std::string> names;
+    while (dirent *entry = readdir(directory)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 16, "perf-regression-") == 0)
+            names.push_back(name);
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+    for (const std::string &name : names) {
+        std::ifstream file(std::string(path) + '/' + name, std::ios::binary);
+        std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        benchRun("regression/" + name, source.size(), source.size(), nullptr, [&]() {
+            // Saved inputs need not be valid programs; their errors are part of what is measured.
+            std::string copy = source;
+            std::streambuf *stdout_buffer = std::cout.rdbuf(nullptr);
+            ParsingContext *context = parseContextDefaultCreate();
+            Node *program = nodeAllocate();
+            if (parseBuffer(copy, context, program).type == ErrorType::NONE) {
+                std::ostringstream code;
+                codegen_program_output(CodegenOutputFormat::DEFAULT, context, program, code);
+            }
+            parseContextReset(context);
+            deleteNode(program);
+            parseContextDelete(context);
+            std::cout.rdbuf(stdout_buffer);
+            std::cout.clear();
+        });
+    }
+#else
+    (void)path;
+    std::cout << "regression benchmarks skipped: listing directories is not supported here\n";
+#endif
+}
+
+//================================================================ RESULTS
+
+static Error writeResults(const char *path) {
+    Error err = ok;
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        err.prepareError(ErrorType::GENERIC, std::string("writeResults(): Could not open ") + path);
+        return err;
+    }
+    out << "{\n  \"repetitions\": " << bench_options.repetitions
+        << ",\n  \"scale\": " << bench_options.scale
+        << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < bench_results.size(); i++) {
+        const BenchResult &result = bench_results[i];
+        out << (i ? "," : "") << "\n    {\"name\": \"" << result.name << '"'
+            << ", \"size\": " << result.size
+            << ", \"bytes\": " << result.bytes
+            << ", \"repetitions\": " << result.repetitions
+            << std::fixed << std::setprecision(6)
+            << ", \"min_ms\": " << result.min_ms
+            << ", \"median_ms\": " << result.median_ms
+            << ", \"mean_ms\": " << result.mean_ms << '}';
+    }
+    out << "\n  ]\n}\n";
+    if (!out) {
+        err.prepareError(ErrorType::GENERIC, "writeResults(): Could not write results");
+        return err;
+    }
+    return ok;
+}
+
+void displayUsage(char **argv) {
+    std::cout << "Usage: " << argv[0] << " [options]\n"
+              << "Options:\n"
+              << "  --json <file>            Write results as JSON\n"
+              << "  --repetitions <n>        Timed runs per benchmark (default 5)\n"
+              << "  --scale <x>              Multiply every benchmark size by x\n"
+              << "  --filter <substring>     Only run benchmarks whose name contains substring\n"
+              << "  --regressions <dir>      Also compile the inputs func_perf_fuzz saved in dir\n"
+              << "  --generate <file>        Write a synthetic program and exit, shaped by:\n"
+              << "    --globals <n> --functions <n> --parameters <n> --calls <n>\n"
+              << "    --reassignments <n> --comments <n> --nesting <n> --body <n> --seed <n>\n";
+}
+
+int main(int argc, char **argv) {
+    GeneratorOptions shape;
+    const char *generate_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) {
+            displayUsage(argv);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--json") == 0) bench_options.json_path = value;
+        else if (strcmp(arg, "--repetitions") == 0) bench_options.repetitions = std::max(1, std::atoi(value));
+        else if (strcmp(arg, "--scale") == 0) bench_options.scale = std::atof(value);
+        else if (strcmp(arg, "--filter") == 0) bench_options.filter = value;
+        else if (strcmp(arg, "--regressions") == 0) bench_options.regressions_path = value;
+        else if (strcmp(arg, "--generate") == 0) generate_path = value;
+        else if (strcmp(arg, "--globals") == 0) shape.globals = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--functions") == 0) shape.functions = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--parameters") == 0) shape.parameters = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--calls") == 0) shape.calls = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--reassignments") == 0) shape.reassignments = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--comments") == 0) shape.comments_per_expression = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--nesting") == 0) shape.nesting_depth = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--body") == 0) shape.body_statements = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--seed") == 0) shape.seed = std::strtoul(value, nullptr, 10);
+        else {
+            displayUsage(argv);
+            return 1;
+        }
+    }
+
+    if (generate_path) {
+        std::ofstream file(generate_path, std::ios::binary);
+        file << generateProgram(shape);
+        return file ? 0 : 1;
+    }
+
+    GeneratorOptions globals_only;
+    globals_only.globals = scaled(2000);
+    globals_only.functions = 0;
+    globals_only.reassignments = scaled(2000);
+
+    GeneratorOptions functions_only;
+    functions_only.globals = 0;
+    functions_only.functions = scaled(1000);
+    functions_only.calls = 0;
+
+    GeneratorOptions calls_heavy;
+    calls_heavy.globals = 0;
+    calls_heavy.functions = scaled(20);
+    calls_heavy.calls = scaled(20000);
+
+    // A generated library of which the program uses a few functions.
+    GeneratorOptions library;
+    library.globals = scaled(20);
+    library.functions = scaled(2000);
+    library.calls = scaled(20);
+    library.reassignments = 0;
+    library.body_statements = 16;
+
+    GeneratorOptions comment_heavy;
+    comment_heavy.globals = scaled(200);
+    comment_heavy.functions = scaled(20);
+    comment_heavy.calls = scaled(200);
+    comment_heavy.reassignments = scaled(200);
+    comment_heavy.comments_per_expression = 50;
+
+    GeneratorOptions mixed;
+    mixed.globals = scaled(1000);
+    mixed.functions = scaled(200);
+    mixed.calls = scaled(2000);
+    mixed.reassignments = scaled(1000);
+    mixed.comments_per_expression = 2;
+
+    std::cout << std::left << std::setw(36) << "Benchmark"
+              << std::right << std::setw(10) << "Size"
+              << std::setw(15) << "Min" << std::setw(15) << "Median" << '\n';
+
+    benchLex("lex/mixed", mixed);
+    benchLex("lex/comment_heavy", comment_heavy);
+    GeneratorOptions lex_large = mixed;
+    lex_large.globals *= 20;
+    lex_large.calls *= 20;
+    lex_large.reassignments *= 20;
+    benchLex("lex/large", lex_large);
+    for (size_t threads : {1, 2, 4, 8})
+        benchLexParallel("lex/large_parallel_" + std::to_string(threads), lex_large, threads);
+    benchParseExpr("parseExpr/globals", globals_only);
+    benchParseExpr("parseExpr/functions", functions_only);
+    benchParseExpr("parseExpr/calls", calls_heavy);
+    benchParseExpr("parseExpr/comment_heavy", comment_heavy);
+    benchParseProgram("parseProgram/library", library, false);
+    benchParseProgram("parseProgram/library_lazy", library, true);
+    benchEnvironment(scaled(5000));
+    benchNodeAddChild(scaled(10000));
+    benchCodegen("codegen_program/globals", globals_only);
+    benchCodegen("codegen_program/functions", functions_only);
+    benchCodegen("codegen_program/calls", calls_heavy);
+    benchIntern("calls", calls_heavy);
+    benchNesting(scaled(1000000));
+    benchCompile("compile/mixed", mixed);
+    benchCompile("compile/comment_heavy", comment_heavy);
+    benchCompileStream("compile/mixed_stream", mixed, false);
+    benchCompileStream("compile/mixed_pipeline", mixed, true);
+    benchCompileSnippets("compile/in_memory_snippets", scaled(5000));
+    size_t loop_iterations = scaled(20000000);
+    CompileOptions runtime_options;
+    benchRuntime("runtime/loop", loop_iterations, loopProgram(loop_iterations), runtime_options);
+    runtime_options.optimize_loops = true;
+    benchRuntime("runtime/loop_optimized", loop_iterations, loopProgram(loop_iterations), runtime_options);
+    runtime_options.optimize_loops = false;
+    runtime_options.format = CodegenOutputFormat::C99;
+    benchRuntime("runtime/loop_c99", loop_iterations, loopProgram(loop_iterations), runtime_options);
+    if (bench_options.regressions_path)
+        benchRegressions(bench_options.regressions_path);
+
+    if (bench_options.json_path) {
+        Error err = writeResults(bench_options.json_path);
+        if (err.type != ErrorType::NONE) {
+            printError(err);
+            return 1;
+        }
+    }
+    return 0;
+}
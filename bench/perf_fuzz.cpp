@@ -0,0 +1,316 @@
+// Performance fuzzer: runs parseExpr() and codegen_program() over in-memory
+// inputs and flags the ones whose time or allocations per input byte are
+// far above what linear behavior costs.
+//
+// Built against libFuzzer (-DPERF_FUZZ_LIBFUZZER=ON, Clang only) it reads
+// its thresholds from the environment: PERF_FUZZ_NS_PER_BYTE,
+// PERF_FUZZ_ALLOCATIONS_PER_BYTE and PERF_FUZZ_OUT. Otherwise it has its own
+// main, which replays files (also usable as `afl-fuzz ... -- func_perf_fuzz @@`)
+// or mutates a corpus for a number of runs.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "codegen.h"
+#include "error.h"
+#include "memory_stats.h"
+#include "parser.h"
+#include "program_generator.h"
+#include "timing.h"
+
+struct PerfFuzzOptions {
+    double max_ns_per_byte;
+    double max_allocations_per_byte;
+    /// Costs are divided by at least this many bytes, so fixed setup costs do not flag tiny inputs.
+    size_t min_bytes;
+    /// Where flagged inputs are saved as `perf-regression-<hash>.txt`.
+    std::string out_dir;
+
+    PerfFuzzOptions():
+        max_ns_per_byte(2000.0),
+        max_allocations_per_byte(4.0),
+        min_bytes(1024),
+        out_dir(".")
+    {}
+};
+
+struct PerfFuzzCost {
+    long long parse_ns;
+    long long codegen_ns;
+    size_t allocations;
+    bool parsed;
+};
+
+static PerfFuzzOptions perf_fuzz_options;
+
+static size_t perfFuzzAllocations() {
+    size_t allocations = 0;
+    for (int category = 0; category < static_cast<int>(MemoryCategory::MAX); category++)
+        allocations += memoryStats(static_cast<MemoryCategory>(category)).allocations;
+    return allocations;
+}
+
+/// Parse and generate code for one input, from a NUL-terminated copy of it.
+static PerfFuzzCost perfFuzzMeasure(const uint8_t *data, size_t size) {
+    PerfFuzzCost cost = {0, 0, 0, false};
+    std::string source(reinterpret_cast<const char *>(data), size);
+    size_t allocations = perfFuzzAllocations();
+
+    // The parser reports errors on stdout; most mutants have some.
+    std::streambuf *stdout_buffer = std::cout.rdbuf(nullptr);
+    ParsingContext *context = parseContextDefaultCreate();
+    Node *program = nodeAllocate();
+    long long begin = timingNow();
+    Error err = parseProgramBuffer(&source[0], context, program);
+    long long parsed = timingNow();
+    cost.parse_ns = parsed - begin;
+    cost.parsed = err.type == ErrorType::NONE;
+    if (cost.parsed) {
+        std::ostringstream code;
+        codegen_program_output(CodegenOutputFormat::DEFAULT, context, program, code);
+        cost.codegen_ns = timingNow() - parsed;
+    }
+    parseContextReset(context);
+    deleteNode(program);
+    parseContextDelete(context);
+    std::cout.rdbuf(stdout_buffer);
+    std::cout.clear();
+
+    cost.allocations = perfFuzzAllocations() - allocations;
+    return cost;
+}
+
+static double perfFuzzNsPerByte(const PerfFuzzCost &cost, size_t size) {
+    return static_cast<double>(cost.parse_ns + cost.codegen_ns) / std::max(size, perf_fuzz_options.min_bytes);
+}
+
+static double perfFuzzAllocationsPerByte(const PerfFuzzCost &cost, size_t size) {
+    return static_cast<double>(cost.allocations) / std::max(size, perf_fuzz_options.min_bytes);
+}
+
+static bool perfFuzzIsSlow(const PerfFuzzCost &cost, size_t size) {
+    return perfFuzzNsPerByte(cost, size) > perf_fuzz_options.max_ns_per_byte
+        || perfFuzzAllocationsPerByte(cost, size) > perf_fuzz_options.max_allocations_per_byte;
+}
+
+static void perfFuzzSave(const uint8_t *data, size_t size, const PerfFuzzCost &cost) {
+    // FNV-1a names the file, so the same input is saved once.
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    std::ostringstream name;
+    name << perf_fuzz_options.out_dir << "/perf-regression-" << std::hex << hash << ".txt";
+    std::ofstream file(name.str(), std::ios::binary);
+    file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+    std::cerr << "perf_fuzz: " << size << " bytes, parse " << cost.parse_ns / 1e6 << " ms, codegen "
+              << cost.codegen_ns / 1e6 << " ms, " << perfFuzzNsPerByte(cost, size) << " ns/byte, "
+              << perfFuzzAllocationsPerByte(cost, size) << " allocations/byte"
+              << (file ? " -> saved " : " -> could not save ") << name.str() << '\n';
+}
+
+/**
+ * Measure an input and save it if it is slow. A slow first run is measured
+ * twice more and the fastest run counts, so a preempted run is not flagged.
+ * @return The cost that counted.
+ */
+static PerfFuzzCost perfFuzzCheck(const uint8_t *data, size_t size) {
+    PerfFuzzCost cost = perfFuzzMeasure(data, size);
+    for (int retry = 0; retry < 2 && perfFuzzIsSlow(cost, size); retry++) {
+        PerfFuzzCost again = perfFuzzMeasure(data, size);
+        if (again.parse_ns + again.codegen_ns < cost.parse_ns + cost.codegen_ns)
+            cost = again;
+    }
+    if (perfFuzzIsSlow(cost, size))
+        perfFuzzSave(data, size, cost);
+    return cost;
+}
+
+static void perfFuzzInit() {
+    memoryAccountingEnable(true);
+    if (const char *value = std::getenv("PERF_FUZZ_NS_PER_BYTE"))
+        perf_fuzz_options.max_ns_per_byte = std::atof(value);
+    if (const char *value = std::getenv("PERF_FUZZ_ALLOCATIONS_PER_BYTE"))
+        perf_fuzz_options.max_allocations_per_byte = std::atof(value);
+    if (const char *value = std::getenv("PERF_FUZZ_OUT"))
+        perf_fuzz_options.out_dir = value;
+}
+
+#ifdef PERF_FUZZ_LIBFUZZER
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void)argc;
+    (void)argv;
+    perfFuzzInit();
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    perfFuzzCheck(data, size);
+    return 0;
+}
+
+#else
+
+/// Pieces of the language, so mutations produce more than lexer errors.
+static const char *perf_fuzz_tokens[] = {
+    "func ", "f0", "(", ")", " {\n", "}\n", ":integer", " : integer = ", " := ", " + ", " * ", " < ",
+    "while ", "x", "p0", "1", ", ", "\n", "# comment\n", "g0",
+};
+
+static std::string perfFuzzMutate(const std::string &input, const std::vector<std::string> &corpus,
+                                  size_t max_length, std::mt19937 &rng) {
+    std::string out = input;
+    size_t at = out.empty() ? 0 : rng() % (out.size() + 1);
+    switch (rng() % 4) {
+        case 0: {
+            const size_t token_count = sizeof(perf_fuzz_tokens) / sizeof(perf_fuzz_tokens[0]);
+            out.insert(at, perf_fuzz_tokens[rng() % token_count]);
+            break;
+        }
+        case 1: {
+            // Repeating a slice is how linear inputs turn into long lists, deep nesting and many names.
+            if (at >= out.size())
+                break;
+            size_t length = 1 + rng() % std::min<size_t>(out.size() - at, 256);
+            std::string slice = out.substr(at, length);
+            size_t copies = 2 + rng() % 15;
+            for (size_t i = 0; i < copies && out.size() + slice.size() <= max_length; i++)
+                out.insert(at, slice);
+            break;
+        }
+        case 2: {
+            if (at >= out.size())
+                break;
+            out.erase(at, 1 + rng() % std::min<size_t>(out.size() - at, 64));
+            break;
+        }
+        case 3: {
+            const std::string &other = corpus[rng() % corpus.size()];
+            if (other.empty())
+                break;
+            size_t from = rng() % other.size();
+            out.insert(at, other, from, 1 + rng() % std::min<size_t>(other.size() - from, 512));
+            break;
+        }
+    }
+    if (out.size() > max_length)
+        out.resize(max_length);
+    return out;
+}
+
+static bool perfFuzzReadFile(const char *path, std::string *contents) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    *contents = buffer.str();
+    return true;
+}
+
+void displayUsage(char **argv) {
+    std::cout << "Usage: " << argv[0] << " [options] [files...]\n"
+              << "Measures each file, or with --runs mutates them (or generated programs) that many times,\n"
+              << "keeping the mutants that cost the most per byte. Slow inputs are saved for func_bench.\n"
+              << "Options:\n"
+              << "  --runs <n>                  Mutations to try (default 0: only measure the files)\n"
+              << "  --seed <n>                  Seed of the mutator\n"
+              << "  --max-length <n>            Largest input in bytes (default 65536)\n"
+              << "  --ns-per-byte <x>           Flag inputs slower than this (default 2000)\n"
+              << "  --allocations-per-byte <x>  Flag inputs allocating more than this (default 4)\n"
+              << "  --out <dir>                 Where flagged inputs are written (default .)\n";
+}
+
+int main(int argc, char **argv) {
+    perfFuzzInit();
+    size_t runs = 0;
+    unsigned seed = 69;
+    size_t max_length = 65536;
+    std::vector<std::string> corpus;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg[0] != '-') {
+            std::string contents;
+            if (!perfFuzzReadFile(arg, &contents)) {
+                std::cout << "Could not read " << arg << '\n';
+                return 1;
+            }
+            corpus.push_back(contents);
+            continue;
+        }
+        if (!value) {
+            displayUsage(argv);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--runs") == 0) runs = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--seed") == 0) seed = std::strtoul(value, nullptr, 10);
+        else if (strcmp(arg, "--max-length") == 0) max_length = std::strtoull(value, nullptr, 10);
+        else if (strcmp(arg, "--ns-per-byte") == 0) perf_fuzz_options.max_ns_per_byte = std::atof(value);
+        else if (strcmp(arg, "--allocations-per-byte") == 0) perf_fuzz_options.max_allocations_per_byte = std::atof(value);
+        else if (strcmp(arg, "--out") == 0) perf_fuzz_options.out_dir = value;
+        else {
+            displayUsage(argv);
+            return 1;
+        }
+    }
+
+    if (!runs) {
+        if (corpus.empty()) {
+            displayUsage(argv);
+            return 1;
+        }
+        for (const std::string &input : corpus)
+            perfFuzzCheck(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+        return 0;
+    }
+
+    if (corpus.empty()) {
+        for (unsigned i = 0; i < 4; i++) {
+            GeneratorOptions shape;
+            shape.globals = 8;
+            shape.functions = 4;
+            shape.parameters = 2;
+            shape.calls = 8;
+            shape.reassignments = 8;
+            shape.comments_per_expression = i % 2;
+            shape.seed = seed + i;
+            corpus.push_back(generateProgram(shape));
+        }
+    }
+    std::vector<double> corpus_cost;
+    for (const std::string &input : corpus) {
+        PerfFuzzCost cost = perfFuzzCheck(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+        corpus_cost.push_back(perfFuzzNsPerByte(cost, input.size()));
+    }
+
+    // Hill climb: a mutant replaces its parent when it costs more per byte.
+    std::mt19937 rng(seed);
+    size_t flagged = 0;
+    for (size_t run = 0; run < runs; run++) {
+        size_t parent = rng() % corpus.size();
+        std::string mutant = perfFuzzMutate(corpus[parent], corpus, max_length, rng);
+        PerfFuzzCost cost = perfFuzzCheck(reinterpret_cast<const uint8_t *>(mutant.data()), mutant.size());
+        if (perfFuzzIsSlow(cost, mutant.size()))
+            flagged += 1;
+        double per_byte = perfFuzzNsPerByte(cost, mutant.size());
+        if (per_byte > corpus_cost[parent]) {
+            corpus[parent] = std::move(mutant);
+            corpus_cost[parent] = per_byte;
+        }
+    }
+    std::cout << runs << " runs, " << flagged << " slow inputs, highest cost "
+              << *std::max_element(corpus_cost.begin(), corpus_cost.end()) << " ns/byte\n";
+    return 0;
+}
+
+#endif
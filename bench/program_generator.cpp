@@ -0,0 +1,80 @@
+#include "program_generator.h"
+
+#include <random>
+#include <string>
+
+static void generateComments(std::string &out, std::mt19937 &rng, size_t count) {
+    static const char *words[] = {
+        "the", "compiler", "should", "skip", "this", "comment", "quickly",
+        "because", "it", "ends", "at", "newline", "integer", "func"
+    };
+    const size_t word_count = sizeof(words) / sizeof(words[0]);
+    for (size_t i = 0; i < count; i++) {
+        out += (rng() & 1) ? ";" : "#";
+        size_t length = 4 + rng() % 12;
+        for (size_t w = 0; w < length; w++) {
+            out += ' ';
+            out += words[rng() % word_count];
+        }
+        out += '\n';
+    }
+}
+
+std::string generateProgram(const GeneratorOptions &options) {
+    std::mt19937 rng(options.seed);
+    std::string out;
+    const size_t parameters = options.parameters ? options.parameters : 1;
+
+    for (size_t i = 0; i < options.globals; i++) {
+        generateComments(out, rng, options.comments_per_expression);
+        out += "g" + std::to_string(i) + " : integer = " + std::to_string(rng() % 1000) + "\n";
+    }
+
+    for (size_t i = 0; i < options.functions; i++) {
+        generateComments(out, rng, options.comments_per_expression);
+        out += "func f" + std::to_string(i) + " (";
+        for (size_t p = 0; p < parameters; p++) {
+            if (p)
+                out += ", ";
+            out += "p" + std::to_string(p) + ":integer";
+        }
+        out += "):integer {\n";
+        out += "  p0 := " + std::to_string(rng() % 1000) + "\n";
+        for (size_t s = 1; s < options.body_statements; s++)
+            out += "  p0 := p0 + " + std::to_string(rng() % 1000) + "\n";
+        out += "}\n";
+    }
+
+    if (options.globals) {
+        for (size_t i = 0; i < options.reassignments; i++) {
+            generateComments(out, rng, options.comments_per_expression);
+            out += "g" + std::to_string(rng() % options.globals) + " := " + std::to_string(rng() % 1000) + "\n";
+        }
+    }
+
+    if (options.functions) {
+        for (size_t i = 0; i < options.calls; i++) {
+            generateComments(out, rng, options.comments_per_expression);
+            out += "f" + std::to_string(rng() % options.functions) + "(";
+            for (size_t p = 0; p < parameters; p++) {
+                if (p)
+                    out += ", ";
+                out += std::to_string(rng() % 1000);
+            }
+            out += ")\n";
+        }
+    }
+
+    if (options.functions && options.nesting_depth) {
+        for (size_t i = 0; i < options.nesting_depth; i++)
+            out += "f0(";
+        out += "1";
+        for (size_t i = 0; i < options.nesting_depth; i++) {
+            for (size_t p = 1; p < parameters; p++)
+                out += ", " + std::to_string(p);
+            out += ")";
+        }
+        out += "\n";
+    }
+    return out;
+}
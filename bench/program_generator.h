@@ -0,0 +1,45 @@
+#ifndef COMPILER_PROGRAM_GENERATOR_H
+#define COMPILER_PROGRAM_GENERATOR_H
+
+#include <cstddef>
+#include <string>
+
+/// Shape of a synthetic program. Counts may be zero, except that the parser
+/// does not accept empty parameter or argument lists, so `parameters` is
+/// treated as at least one.
+struct GeneratorOptions {
+    size_t globals;
+    size_t functions;
+    size_t parameters;
+    /// Statements in every function body; treated as at least one.
+    size_t body_statements;
+    size_t calls;
+    size_t reassignments;
+    /// Comment lines emitted before every top-level expression.
+    size_t comments_per_expression;
+    /// Depth of one trailing call `f0(f0(...), ...)` whose first argument nests.
+    size_t nesting_depth;
+    unsigned seed;
+
+    GeneratorOptions():
+        globals(1000),
+        functions(200),
+        parameters(4),
+        body_statements(1),
+        calls(2000),
+        reassignments(1000),
+        comments_per_expression(0),
+        nesting_depth(0),
+        seed(69)
+    {}
+};
+
+/**
+ * Generate source text in the language accepted by parseExpr().
+ * Globals are `gN : integer = N`, functions are `func fN (p0:integer, ...):integer { p0 := N }`
+ * (further statements are `p0 := p0 + N`),
+ * followed by reassignments of the globals and calls to the functions with literal arguments.
+ */
+std::string generateProgram(const GeneratorOptions &options);
+
+#endif /* COMPILER_PROGRAM_GENERATOR_H */
@@ -1,244 +1,1176 @@
 #include "codegen.h"
 
+#include "codegen_patterns.h"
 #include "error.h"
 #include "environment.h"
+#include "frame_layout.h"
+#include "memory_stats.h"
+#include "node_walk.h"
+#include "profile.h"
 #include "parser.h"
+#include "record_layout.h"
+#include "timing.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <cstddef>
 #include <cstring>
 #include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 const char *codegen_header = "Header file";
 
 //================================================================ BEG FILE HELPERS
 
-Error fwrite_line(const char *bytestring, std::ofstream &file){
+// Errors are only built on failure: their messages would otherwise be
+// allocated for every line written.
+static Error fwrite_error(const char *message) {
     Error err = ok;
-    err.createError(ErrorType::GENERIC, "fwrite_line(): Could not write line");
-    if (!file.is_open())
-        return err;
+    err.prepareError(ErrorType::GENERIC, message);
+    return err;
+}
+
+Error fwrite_line(const char *bytestring, std::ostream &file){
+    if (!file)
+        return fwrite_error("fwrite_line(): Could not write line");
     size_t length = strlen(bytestring);
     file.write(bytestring, length);
+    file.put('\n');
     if(!file)
-        return err;
-    file.write("\n", 1);
-    if(!file)
-        return err;
+        return fwrite_error("fwrite_line(): Could not write line");
     return ok;
 }
 
-Error fwrite_bytes(const char *bytestring, std::ofstream &file){
-    Error err = ok;
-    err.createError(ErrorType::GENERIC, "fwrite_bytes(): Could not write bytes");
-    if(!file.is_open())
-        return err;
+Error fwrite_bytes(const char *bytestring, std::ostream &file){
+    if(!file)
+        return fwrite_error("fwrite_bytes(): Could not write bytes");
     size_t length = strlen(bytestring);
     file.write(bytestring, length);
     if(!file)
-        return err;
+        return fwrite_error("fwrite_bytes(): Could not write bytes");
     return ok;
 }
 
 constexpr size_t FWRITE_INT_STRING_BUFFER_SIZE = 21;
 
-Error fwrite_integer(long long integer, std::ofstream &file) {
-    Error err = ok;
-    err.createError(ErrorType::GENERIC, "fwrite_integer(): Could not write integer");
-    if(!file.is_open())
-        return err;
-    // Create a stringstream to convert the integer to a string
-    std::ostringstream oss;
-    oss << integer; // Convert the integer to a string
-    
-    err = fwrite_bytes(oss.str().c_str(), file);
-    return err;
+Error fwrite_integer(long long integer, std::ostream &file) {
+    if(!file)
+        return fwrite_error("fwrite_integer(): Could not write integer");
+    // Formatting by hand avoids constructing a stream (and its locale) per integer.
+    char buffer[FWRITE_INT_STRING_BUFFER_SIZE];
+    char *it = buffer + FWRITE_INT_STRING_BUFFER_SIZE;
+    unsigned long long magnitude = integer < 0 ? 0ull - static_cast<unsigned long long>(integer)
+                                               : static_cast<unsigned long long>(integer);
+    do {
+        *--it = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (integer < 0)
+        *--it = '-';
+    file.write(it, buffer + FWRITE_INT_STRING_BUFFER_SIZE - it);
+    if(!file)
+        return fwrite_error("fwrite_integer(): Could not write integer");
+    return ok;
 }
 
 //================================================================ END FILE HELPERS
 
 //================================================================ BEG x86_64 AT&T ASM
 
-Error codegen_program_x86_64_att_asm_data_section(ParsingContext *context, std::ofstream &code) {
+/// Type of a global variable, from its declaration.
+Error codegen_global_type_x86_64_att_asm(ParsingContext *context, Node *var_id, Node *type_info) {
     Error err = ok;
+    Node type_id;
+    while (context->parent)
+        context = context->parent;
+    if (!environmentGet(*context->variables, var_id, &type_id)) {
+        err.prepareError(ErrorType::GENERIC, "codegen: Global variable missing from environment");
+        return err;
+    }
+    if (parseGetType(context, &type_id, type_info).type != ErrorType::NONE) {
+        err.prepareError(ErrorType::TYPE, "codegen: Unknown type of global variable");
+        return err;
+    }
+    return ok;
+}
+
+Error codegen_balign_x86_64_att_asm(long long alignment, std::ostream &code) {
+    fwrite_bytes(".balign ", code);
+    fwrite_integer(alignment, code);
+    return fwrite_bytes("\n", code);
+}
 
-    err = fwrite_line(".section .data", code);
+/// Data directive that emits one value of `size` bytes.
+static const char *codegen_data_directive_x86_64_att_asm(long long size) {
+    switch (size) {
+        case 1: return ".byte ";
+        case 2: return ".short ";
+        case 4: return ".long ";
+        default: return ".quad ";
+    }
+}
+
+/// Whether a global's initializer is known at compile time; NONE means zero.
+static bool codegen_initializer_is_constant(Node *initializer) {
+    return initializer->type == NodeType::NONE || initializer->type == NodeType::INTEGER;
+}
+
+/// Whether a global is all zero bytes before _start runs, and so belongs in .bss.
+static bool codegen_initializer_is_zero(Node *initializer) {
+    return !codegen_initializer_is_constant(initializer)
+        || (initializer->type == NodeType::INTEGER && initializer->value.integer == 0)
+        || initializer->type == NodeType::NONE;
+}
+
+/// A global: its value if it is a non-zero constant, otherwise space that .bss zeroes.
+Error codegen_global_x86_64_att_asm(Node *var_id, Node *initializer, const Node *type_info, std::ostream &code) {
+    Error err = fwrite_bytes(var_id->value.symbol, code);
+    if (err.type != ErrorType::NONE)
+        return err;
+    err = fwrite_bytes(": ", code);
     if (err.type != ErrorType::NONE)
         return err;
+    long long size = typeSize(type_info);
+    if (codegen_initializer_is_zero(initializer)) {
+        fwrite_bytes(".space ", code);
+        fwrite_integer(size, code);
+        return fwrite_bytes("\n", code);
+    }
+    if (!typeContains(type_info, initializer)) {
+        err.prepareError(ErrorType::TYPE, std::string("codegen: Integer literal out of range of the type of ")
+                         + var_id->value.symbol);
+        return err;
+    }
+    fwrite_bytes(codegen_data_directive_x86_64_att_asm(size), code);
+    fwrite_integer(initializer->value.integer, code);
+    return fwrite_bytes("\n", code);
+}
 
-    Node *type_info = nodeAllocate();
-    Binding *it = context->variables->bind;
-    while (it) {
-        Node *var_id = it->id;
-        Node *type_id = it->value;
-        it = it->next;
-        
-        environmentGet(*context->types, type_id, type_info);
+struct CodegenGlobal {
+    Node *id;
+    Node *initializer;
+    Node type_info;
+    long long alignment;
+};
 
-        err = fwrite_bytes(var_id->value.symbol, code);
-        if (err.type != ErrorType::NONE)
-            return err;
-        err = fwrite_bytes(": .space ", code);
-        if (err.type != ErrorType::NONE)
-            return err;
-        err = fwrite_integer(type_info->children->value.integer, code);
+Error codegen_globals_x86_64_att_asm(const char *section, const std::vector<CodegenGlobal> &globals, std::ostream &code) {
+    if (globals.empty())
+        return ok;
+    Error err = fwrite_bytes(".section ", code);
+    if (err.type != ErrorType::NONE)
+        return err;
+    fwrite_line(section, code);
+    long long alignment = 0;
+    for (const CodegenGlobal &global : globals) {
+        if (global.alignment != alignment) {
+            alignment = global.alignment;
+            err = codegen_balign_x86_64_att_asm(alignment, code);
+            if (err.type != ErrorType::NONE)
+                return err;
+        }
+        err = codegen_global_x86_64_att_asm(global.id, global.initializer, &global.type_info, code);
         if (err.type != ErrorType::NONE)
             return err;
-        err = fwrite_bytes("\n", code);
+    }
+    return ok;
+}
+
+/**
+ * Globals with a non-zero constant initializer go to .data as values; the
+ * rest go to .bss, and those with a call as initializer are stored by
+ * _start. Within each section globals keep declaration order, most aligned
+ * first, so no padding is needed between them and each group only needs one
+ * .balign.
+ */
+Error codegen_program_x86_64_att_asm_data_section(ParsingContext *context, Node *program, std::ostream &code) {
+    TimingScope timing("codegen data section");
+    Error err = ok;
+
+    std::vector<CodegenGlobal> data;
+    std::vector<CodegenGlobal> bss;
+    for (Node *it = program->children; it; it = it->next_child) {
+        if (it->type != NodeType::VARIABLE_DECLARATION)
+            continue;
+        CodegenGlobal global;
+        global.id = it->children;
+        global.initializer = it->children->next_child;
+        err = codegen_global_type_x86_64_att_asm(context, global.id, &global.type_info);
         if (err.type != ErrorType::NONE)
             return err;
+        global.alignment = typeAlignment(&global.type_info);
+        if (codegen_initializer_is_zero(global.initializer))
+            bss.push_back(global);
+        else
+            data.push_back(global);
     }
-    delete type_info;
-    return err;
+    auto by_alignment = [](const CodegenGlobal &a, const CodegenGlobal &b) {
+        return a.alignment > b.alignment;
+    };
+    std::stable_sort(data.begin(), data.end(), by_alignment);
+    std::stable_sort(bss.begin(), bss.end(), by_alignment);
+
+    err = codegen_globals_x86_64_att_asm(".data", data, code);
+    if (err.type != ErrorType::NONE)
+        return err;
+    return codegen_globals_x86_64_att_asm(".bss", bss, code);
 }
 
+/// Operand size suffix of an access of `size` bytes.
+static const char *codegen_size_suffix_x86_64_att_asm(long long size) {
+    switch (size) {
+        case 1: return "b";
+        case 2: return "w";
+        case 4: return "l";
+        default: return "q";
+    }
+}
 
-Error codegen_function_x86_64_att_asm_mswin(ParsingContext *context, char *name, Node *function, std::ofstream &code);
+/// A general purpose register by the names of its 64, 32, 16 and 8-bit parts.
+struct CodegenRegister {
+    const char *q;
+    const char *l;
+    const char *w;
+    const char *b;
+};
 
-Error codegen_expression_list_x86_64_att_asm_mswin(ParsingContext *context, Node *expression, std::ofstream &code) {
-    Error err = ok;
-    Node *tmpnode = nodeAllocate();
-    size_t tmpcount;
-    const size_t lambda_symbol_size = 8;
-    char lambda_symbol[8];
-    for (size_t i = 0; i < lambda_symbol_size; i++) {
-        lambda_symbol[i] = (rand() % 26) + 97;
-    }
-    while(expression){
-        tmpcount = 0;
-        switch(expression->type){
-            default:
-                break;
-            case NodeType::FUNCTION:
-                // Handling a function here means a lambda should be generated, I think.
-                // TODO: Generate name from some sort of hashing algorithm or something.
-                err = codegen_function_x86_64_att_asm_mswin(context, lambda_symbol, expression, code);
-                // If we were to keep track of the name of this function, we could
-                // then properly fill in the jump memory label further on in the program.
-                if(err.type != ErrorType::NONE){ return err; }
-                break;
-            case NodeType::FUNCTION_CALL:
-                // TODO: Actually codegen argument expressions.
-                tmpnode = expression->children->next_child->children;
-                while(tmpnode){
-                    switch(tmpcount){
-                        default:
-                            std::cout << "TODO: Codegen stack allocated arguments\n";
-                            break;
-                        case 0:
-                            fwrite_bytes("mov $",code);
-                            // TODO:FIXME: This assumes integer type, and is bad bad bad!!!
-                            fwrite_integer(tmpnode->value.integer,code);
-                            fwrite_line(", %rcx",code);
-                            break;
-                        case 1:
-                            fwrite_bytes("mov $",code);
-                            // TODO:FIXME: This assumes integer type, and is bad bad bad!!!
-                            fwrite_integer(tmpnode->value.integer,code);
-                            fwrite_line(", %rdx",code);
-                            break;
-                        case 2:
-                            fwrite_bytes("mov $",code);
-                            // TODO:FIXME: This assumes integer type, and is bad bad bad!!!
-                            fwrite_integer(tmpnode->value.integer,code);
-                            fwrite_line(", %r8",code);
-                            break;
-                        case 3:
-                            fwrite_bytes("mov $",code);
-                            // TODO:FIXME: This assumes integer type, and is bad bad bad!!!
-                            fwrite_integer(tmpnode->value.integer,code);
-                            fwrite_line(", %r9",code);
-                            break;
-                    }
-                    tmpnode = tmpnode->next_child;
-                    tmpcount += 1;
-                }
-                fwrite_bytes("call ",code);
-                fwrite_line(expression->children->value.symbol,code);
-                break;
-            case NodeType::VARIABLE_REASSIGNMENT:
-                // TODO: Find variable binding and keep track of which context it is found in.
-                //       If context is top-level, use global variable access, otherwise local.
-
-                // TODO: Evaluate reassignment expression and get return value,
-                //       that way we can actually use it!
-
-                if (!context->parent) {
-                    fwrite_bytes("lea ",code);
-                    fwrite_bytes(expression->children->value.symbol,code);
-                    fwrite_line("(%rip), %rax",code);
-                    fwrite_bytes("movq $",code);
-                    // TODO: FIXME: This assumes integer type, and is bad bad bad!!!
-                    fwrite_integer(expression->children->next_child->value.integer,code);
-                    fwrite_line(", (%rax)",code);
-                } else {
+static const CodegenRegister codegen_rax = {"%rax", "%eax", "%ax", "%al"};
+static const CodegenRegister codegen_rcx = {"%rcx", "%ecx", "%cx", "%cl"};
+
+/// The part of `reg` holding `size` bytes.
+static const char *codegen_register_part_x86_64_att_asm(const CodegenRegister &reg, long long size) {
+    switch (size) {
+        case 1: return reg.b;
+        case 2: return reg.w;
+        case 4: return reg.l;
+        default: return reg.q;
+    }
+}
 
-                    // TODO: Get index of argument within function parameter list
+/// MS x64 integer argument registers, in order.
+static const CodegenRegister codegen_argument_registers_mswin[] = {
+    {"%rcx", "%ecx", "%cx", "%cl"},
+    {"%rdx", "%edx", "%dx", "%dl"},
+    {"%r8", "%r8d", "%r8w", "%r8b"},
+    {"%r9", "%r9d", "%r9w", "%r9b"},
+};
+constexpr size_t CODEGEN_ARGUMENT_REGISTER_COUNT_MSWIN = 4;
 
-                    // TODO: Use index of argument to write to proper address/register
+/// Stack frame of the function currently being emitted.
+struct CodegenFrame {
+    FrameLayout layout;
+    /// Nested call results currently held in spill slots.
+    size_t spill_depth;
+    /// Parameter list of the function, or NULL for _start.
+    Node *parameters;
+    std::vector<FrameLocal> locals;
+};
 
-                }
+/// RSP-relative address of a spill slot.
+static std::string codegen_spill_slot_x86_64_att_asm(CodegenFrame *frame, size_t slot) {
+    return std::to_string(frame->layout.spill_offset + slot * FRAME_SLOT_SIZE) + "(%rsp)";
+}
 
-                break;
-        }
+void codegen_frame_allocate_x86_64_att_asm(const FrameLayout &layout, std::ostream &code) {
+    if (!layout.size)
+        return;
+    fwrite_bytes("sub $",code);
+    fwrite_integer(static_cast<long long>(layout.size),code);
+    fwrite_line(", %rsp",code);
+}
 
-        expression = expression->next_child;
-    }
-    delete tmpnode;
+void codegen_frame_free_x86_64_att_asm(const FrameLayout &layout, std::ostream &code) {
+    if (!layout.size)
+        return;
+    fwrite_bytes("add $",code);
+    fwrite_integer(static_cast<long long>(layout.size),code);
+    fwrite_line(", %rsp",code);
+}
 
-    return ok;
+/// Whether the body reads or assigns any parameter, which then needs a home in memory.
+static bool codegen_uses_parameters(Node *parameters, Node *body) {
+    struct Search {
+        Node *parameters;
+        bool found;
+    } search = {parameters, false};
+    auto pre = [](Node *node, Node *parent, size_t depth, void *data) {
+        (void)parent;
+        (void)depth;
+        Search *search = static_cast<Search *>(data);
+        if (node->type != NodeType::SYMBOL)
+            return WalkAction::CONTINUE;
+        for (Node *parameter = search->parameters->children; parameter; parameter = parameter->next_child) {
+            if (nodeCompare(parameter->children, node)) {
+                search->found = true;
+                return WalkAction::STOP;
+            }
+        }
+        return WalkAction::CONTINUE;
+    };
+    for (Node *expression = body; expression && !search.found; expression = expression->next_child)
+        nodeWalk(expression, {pre, nullptr, &search});
+    return search.found;
 }
 
-Error codegen_function_x86_64_att_asm_mswin(ParsingContext *context, char *name, Node *function, std::ofstream &code) {
-    Node *parameter = function->children;
+/**
+ * @param home_registers Register arguments to store in the shadow space the
+ *                       caller reserved for them, so they can be addressed
+ *                       like stack arguments.
+ */
+void codegen_function_header_x86_64_att_asm_mswin(const char *name, const FrameLayout &layout, size_t home_registers,
+                                                  bool align_entry, std::ostream &code) {
     // Nested function execution protection
     fwrite_bytes("jmp after",code);
     fwrite_line(name,code);
 
+    // Padding lands after the jmp, so it is never executed.
+    if (align_entry)
+        fwrite_line(".p2align 4",code);
+
     // Function begin memory symbol
     fwrite_bytes(name,code);
     fwrite_line(":",code);
 
-    // Function header
-    fwrite_line("push %rbp", code);
-    fwrite_line("mov %rsp, %rbp", code);
-    fwrite_line("sub $32, %rsp", code);
+    for (size_t i = 0; i < home_registers && i < CODEGEN_ARGUMENT_REGISTER_COUNT_MSWIN; i++) {
+        fwrite_bytes("mov ",code);
+        fwrite_bytes(codegen_argument_registers_mswin[i].q,code);
+        fwrite_bytes(", ",code);
+        fwrite_integer(static_cast<long long>(FRAME_SLOT_SIZE * (i + 1)),code);
+        fwrite_line("(%rsp)",code);
+    }
 
-    // Function body
-    context = parseContextCreate(context);
-    codegen_expression_list_x86_64_att_asm_mswin(context, function->children->next_child->next_child->children, code);
-    // TODO: Free context;
-    context = context->parent;
+    // Function header; nothing is addressed relative to RBP, so no frame pointer.
+    codegen_frame_allocate_x86_64_att_asm(layout, code);
+}
 
+void codegen_function_footer_x86_64_att_asm_mswin(const char *name, const FrameLayout &layout, std::ostream &code) {
     // Function footer
-    fwrite_line("add $32, %rsp", code);
-    fwrite_line("pop %rbp", code);
+    codegen_frame_free_x86_64_att_asm(layout, code);
     fwrite_line("ret", code);
 
     // Nested function execution jump label
     fwrite_bytes("after",code);
     fwrite_bytes(name,code);
     fwrite_line(":",code);
+}
+
+/// Where a variable lives: a global, or an RSP-relative local or parameter slot.
+struct CodegenVariable {
+    const char *global;
+    /// From RSP, or from the global for record fields.
+    long long offset;
+    Node type_info;
+};
 
+Error codegen_variable_x86_64_att_asm(ParsingContext *context, CodegenFrame *frame, Node *symbol, CodegenVariable *variable) {
+    Error err = ok;
+    // A record field, `p.x`: the record variable, then a fixed offset into it.
+    const char *dot = strchr(symbol->value.symbol, '.');
+    if (dot) {
+        Node *record = nodeSymbolFromBuffer(symbol->value.symbol, static_cast<size_t>(dot - symbol->value.symbol));
+        err = codegen_variable_x86_64_att_asm(context, frame, record, variable);
+        if (err.type == ErrorType::NONE && variable->global) {
+            // The name must outlive `record`.
+            ParsingContext *root = context;
+            while (root->parent)
+                root = root->parent;
+            variable->global = environmentFind(root->variables, record)->id->value.symbol;
+        }
+        deleteNode(record);
+        if (err.type != ErrorType::NONE)
+            return err;
+        Node record_info = variable->type_info;
+        return recordFieldPath(context, &record_info, dot + 1, &variable->offset, &variable->type_info);
+    }
+    Node *type_id = nullptr;
+    for (const FrameLocal &local : frame->locals) {
+        if (nodeCompare(local.declaration->children, symbol)) {
+            variable->global = nullptr;
+            variable->offset = static_cast<long long>(frame->layout.locals_offset + local.offset);
+            type_id = local.declaration->children->next_child->next_child;
+            break;
+        }
+    }
+    if (!type_id && frame->parameters) {
+        size_t index = 0;
+        for (Node *parameter = frame->parameters->children; parameter; parameter = parameter->next_child, index++) {
+            if (nodeCompare(parameter->children, symbol)) {
+                // Above the return address: the homed register arguments, then the stack arguments.
+                variable->global = nullptr;
+                variable->offset = static_cast<long long>(frame->layout.size + FRAME_SLOT_SIZE * (index + 1));
+                type_id = parameter->children->next_child;
+                break;
+            }
+        }
+    }
+    if (!type_id) {
+        variable->global = symbol->value.symbol;
+        variable->offset = 0;
+        return codegen_global_type_x86_64_att_asm(context, symbol, &variable->type_info);
+    }
+    if (parseGetType(context, type_id, &variable->type_info).type != ErrorType::NONE) {
+        err.prepareError(ErrorType::TYPE, std::string("codegen: Unknown type of variable ") + symbol->value.symbol);
+        return err;
+    }
     return ok;
 }
 
-/// Emit x86_64 AT&T Assembly with MS Windows function calling convention.
-/// Arguments passed in: RCX, RDX, R8, R9 -> stack
-Error codegen_program_x86_64_att_asm_mswin(ParsingContext *context, Node *program){
+static void codegen_variable_address_x86_64_att_asm(const CodegenVariable &variable, std::ostream &code) {
+    if (variable.global) {
+        fwrite_bytes(variable.global,code);
+        if (variable.offset) {
+            fwrite_bytes("+",code);
+            fwrite_integer(variable.offset,code);
+        }
+        fwrite_bytes("(%rip)",code);
+        return;
+    }
+    fwrite_integer(variable.offset,code);
+    fwrite_bytes("(%rsp)",code);
+}
+
+/// Whether a value fits the sign-extended 32-bit immediate of most instructions.
+static bool codegen_is_immediate(const Node *value) {
+    return value->type == NodeType::INTEGER && value->value.integer == static_cast<int>(value->value.integer);
+}
+
+/// Where a loop branches, while its condition is emitted: lets a comparison jump directly.
+struct CodegenBranch {
+    Node *condition;
+    const char *label;
+    size_t number;
+    bool when_true;
+};
+
+struct CodegenWalkState {
+    ParsingContext *context;
+    std::ostream *code;
+    /// Lambdas currently being emitted and their labels, innermost last.
+    std::vector<std::pair<Node *, std::string>> lambdas;
+    /// Frames of the enclosing function followed by those of the lambdas.
+    std::vector<CodegenFrame *> frames;
+    /// Argument lists of the calls currently being emitted, innermost last.
+    std::vector<Node *> argument_lists;
+    CodegenBranch branch;
+    /// Set when the walk stopped on an error.
+    Error err;
+};
+
+/// Numbers the labels of loops, which must be unique in the output file.
+static thread_local size_t codegen_label_count = 0;
+
+//================================================================ BEG x86_64 INSTRUCTION SELECTION
+
+/// An operand by every form it can take, see codegen_patterns.h.
+struct CodegenOperand {
+    /// Bit n is set when the operand belongs to CodegenOperandClass n.
+    unsigned classes;
+    long long integer;
+    CodegenVariable variable;
+    const char *reg;
+};
+
+static unsigned codegen_operand_class_bit(CodegenOperandClass operand_class) {
+    return 1u << static_cast<unsigned>(operand_class);
+}
+
+static CodegenOperand codegen_operand_register(const CodegenRegister &reg) {
+    CodegenOperand operand;
+    operand.classes = codegen_operand_class_bit(CodegenOperandClass::REGISTER);
+    operand.integer = 0;
+    operand.reg = reg.q;
+    return operand;
+}
+
+static CodegenOperand codegen_operand_spill_slot(CodegenFrame *frame, size_t slot) {
+    CodegenOperand operand;
+    operand.classes = codegen_operand_class_bit(CodegenOperandClass::MEMORY_64);
+    operand.integer = 0;
+    operand.variable.global = nullptr;
+    operand.variable.offset = static_cast<long long>(frame->layout.spill_offset + slot * FRAME_SLOT_SIZE);
+    operand.reg = nullptr;
+    return operand;
+}
+
+/// Classify a literal or a variable.
+static Error codegen_operand_x86_64_att_asm(CodegenWalkState *state, Node *value, CodegenOperand *operand) {
+    operand->classes = 0;
+    operand->integer = 0;
+    operand->reg = nullptr;
+    if (value->type == NodeType::SYMBOL) {
+        Error err = codegen_variable_x86_64_att_asm(state->context, state->frames.back(), value, &operand->variable);
+        if (err.type != ErrorType::NONE)
+            return err;
+        bool is_signed = typeIsSigned(&operand->variable.type_info);
+        CodegenOperandClass operand_class = CodegenOperandClass::MEMORY_64;
+        switch (typeSize(&operand->variable.type_info)) {
+            case 1:
+                operand_class = is_signed ? CodegenOperandClass::MEMORY_S8 : CodegenOperandClass::MEMORY_U8;
+                break;
+            case 2:
+                operand_class = is_signed ? CodegenOperandClass::MEMORY_S16 : CodegenOperandClass::MEMORY_U16;
+                break;
+            case 4:
+                operand_class = is_signed ? CodegenOperandClass::MEMORY_S32 : CodegenOperandClass::MEMORY_U32;
+                break;
+        }
+        operand->classes = codegen_operand_class_bit(operand_class);
+        return ok;
+    }
+    // TODO:FIXME: This assumes integer type, and is bad bad bad!!!
+    long long integer = value->value.integer;
+    operand->integer = integer;
+    operand->classes = codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_S64);
+    if (integer == static_cast<int>(integer))
+        operand->classes |= codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_S32);
+    if (integer >= 0 && integer <= static_cast<long long>(UINT_MAX))
+        operand->classes |= codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_U32);
+    if (integer > 0 && (integer & (integer - 1)) == 0)
+        operand->classes |= codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_POWER_OF_TWO);
+    if (integer == 0)
+        operand->classes |= codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_ZERO);
+    if (integer == 1)
+        operand->classes |= codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_ONE);
+    if (integer == -1)
+        operand->classes |= codegen_operand_class_bit(CodegenOperandClass::IMMEDIATE_MINUS_ONE);
+    return ok;
+}
+
+/// The cheapest pattern of `operation` for any class of `operand`, or NULL.
+static const CodegenPattern *codegen_pattern_select(CodegenOperation operation, const CodegenOperand &operand) {
+    const CodegenPattern *best = nullptr;
+    for (size_t operand_class = 0; operand_class < CODEGEN_OPERAND_CLASS_COUNT; operand_class++) {
+        if (!(operand.classes & (1u << operand_class)))
+            continue;
+        int index = codegen_pattern_index_x86_64.best[static_cast<size_t>(operation)][operand_class];
+        if (index >= 0 && (!best || codegen_patterns_x86_64[index].cost < best->cost))
+            best = &codegen_patterns_x86_64[index];
+    }
+    return best;
+}
+
+static const CodegenPattern &codegen_pattern_register(CodegenOperation operation) {
+    size_t operand_class = static_cast<size_t>(CodegenOperandClass::REGISTER);
+    return codegen_patterns_x86_64[codegen_pattern_index_x86_64.best[static_cast<size_t>(operation)][operand_class]];
+}
+
+/// Cost of `operation` on `operand`, directly or after loading it into a scratch register.
+static unsigned codegen_operation_cost(CodegenOperation operation, const CodegenOperand &operand) {
+    const CodegenPattern *direct = codegen_pattern_select(operation, operand);
+    unsigned through_register = codegen_pattern_select(CodegenOperation::LOAD, operand)->cost
+        + codegen_pattern_register(operation).cost;
+    return direct && direct->cost <= through_register ? direct->cost : through_register;
+}
+
+/// Write the instruction of `pattern` for `operand`, computing into `destination`.
+static Error codegen_pattern_emit_x86_64_att_asm(const CodegenPattern &pattern, const CodegenOperand &operand,
+                                                 const CodegenRegister &destination, std::ostream &code) {
+    if (!*pattern.instruction)
+        return ok;
+    for (const char *it = pattern.instruction; *it; it++) {
+        if (*it != '%') {
+            code.put(*it);
+            continue;
+        }
+        switch (*++it) {
+            case 'd':
+                fwrite_bytes(destination.q,code);
+                break;
+            case 'e':
+                fwrite_bytes(destination.l,code);
+                break;
+            default:
+                if (pattern.operand == CodegenOperandClass::REGISTER) {
+                    fwrite_bytes(operand.reg,code);
+                } else if (pattern.operand >= CodegenOperandClass::MEMORY_S8) {
+                    codegen_variable_address_x86_64_att_asm(operand.variable, code);
+                } else if (pattern.operand == CodegenOperandClass::IMMEDIATE_POWER_OF_TWO) {
+                    long long shift = 0;
+                    while ((1ll << shift) != operand.integer)
+                        shift += 1;
+                    fwrite_bytes("$",code);
+                    fwrite_integer(shift,code);
+                } else {
+                    fwrite_bytes("$",code);
+                    fwrite_integer(operand.integer,code);
+                }
+                break;
+        }
+    }
+    return fwrite_line("",code);
+}
+
+/// Load `operand` into all of `reg`, sign or zero extended from its width.
+static Error codegen_operand_load_x86_64_att_asm(const CodegenOperand &operand, const CodegenRegister &reg,
+                                                 std::ostream &code) {
+    return codegen_pattern_emit_x86_64_att_asm(*codegen_pattern_select(CodegenOperation::LOAD, operand), operand,
+                                               reg, code);
+}
+
+/// Apply `operation` to RAX and `operand`, through RCX when that is cheaper than any direct form.
+static Error codegen_operation_x86_64_att_asm(CodegenOperation operation, const CodegenOperand &operand,
+                                              std::ostream &code) {
+    const CodegenPattern *direct = codegen_pattern_select(operation, operand);
+    const CodegenPattern &load = *codegen_pattern_select(CodegenOperation::LOAD, operand);
+    const CodegenPattern &through_register = codegen_pattern_register(operation);
+    if (direct && direct->cost <= load.cost + through_register.cost)
+        return codegen_pattern_emit_x86_64_att_asm(*direct, operand, codegen_rax, code);
+    codegen_pattern_emit_x86_64_att_asm(load, operand, codegen_rcx, code);
+    return codegen_pattern_emit_x86_64_att_asm(through_register, codegen_operand_register(codegen_rcx), codegen_rax,
+                                               code);
+}
+
+//================================================================ END x86_64 INSTRUCTION SELECTION
+
+/// Load a literal or a variable into all of `reg`.
+static Error codegen_load_x86_64_att_asm(CodegenWalkState *state, Node *value, const CodegenRegister &reg) {
+    CodegenOperand operand;
+    Error err = codegen_operand_x86_64_att_asm(state, value, &operand);
+    if (err.type != ErrorType::NONE)
+        return err;
+    return codegen_operand_load_x86_64_att_asm(operand, reg, *state->code);
+}
+
+/**
+ * Store to a variable, using its width: a literal (NONE is zero), another
+ * variable, or a computed value left in RAX.
+ */
+Error codegen_store_x86_64_att_asm(CodegenWalkState *state, Node *var_id, Node *value) {
+    std::ostream &code = *state->code;
+    CodegenVariable variable;
+    Error err = codegen_variable_x86_64_att_asm(state->context, state->frames.back(), var_id, &variable);
+    if (err.type != ErrorType::NONE)
+        return err;
+    long long size = typeSize(&variable.type_info);
+    if (typeIsRecord(&variable.type_info)) {
+        // Only a declaration stores to a whole record, and it zeroes it.
+        for (long long offset = 0; offset < size;) {
+            long long chunk = 8;
+            while (chunk > size - offset)
+                chunk /= 2;
+            CodegenVariable part = variable;
+            part.offset += offset;
+            fwrite_bytes("mov",code);
+            fwrite_bytes(codegen_size_suffix_x86_64_att_asm(chunk),code);
+            fwrite_bytes(" $0, ",code);
+            codegen_variable_address_x86_64_att_asm(part, code);
+            fwrite_line("",code);
+            offset += chunk;
+        }
+        return ok;
+    }
+    if (value->type == NodeType::INTEGER || value->type == NodeType::NONE) {
+        if (!typeContains(&variable.type_info, value)) {
+            err.prepareError(ErrorType::TYPE, std::string("codegen: Integer literal out of range of the type of ")
+                             + var_id->value.symbol);
+            return err;
+        }
+        if (size == 8 && value->type == NodeType::INTEGER && !codegen_is_immediate(value)) {
+            // Stores only take sign-extended 32-bit immediates.
+            fwrite_bytes("movabs $",code);
+            fwrite_integer(value->value.integer,code);
+            fwrite_line(", %rcx",code);
+            fwrite_bytes("mov %rcx, ",code);
+        } else {
+            fwrite_bytes("mov",code);
+            fwrite_bytes(codegen_size_suffix_x86_64_att_asm(size),code);
+            fwrite_bytes(" $",code);
+            fwrite_integer(value->value.integer,code);
+            fwrite_bytes(", ",code);
+        }
+        codegen_variable_address_x86_64_att_asm(variable, code);
+        return fwrite_line("",code);
+    }
+    if (value->type == NodeType::SYMBOL) {
+        err = codegen_load_x86_64_att_asm(state, value, codegen_rax);
+        if (err.type != ErrorType::NONE)
+            return err;
+    }
+    // Only the low `size` bytes of the value are stored.
+    fwrite_bytes("mov ",code);
+    fwrite_bytes(codegen_register_part_x86_64_att_asm(codegen_rax, size),code);
+    fwrite_bytes(", ",code);
+    codegen_variable_address_x86_64_att_asm(variable, code);
+    return fwrite_line("",code);
+}
+
+/// Keep the value in RAX in the next spill slot, until a sibling is done.
+static void codegen_spill_x86_64_att_asm(CodegenFrame *frame, std::ostream &code) {
+    fwrite_bytes("mov %rax, ",code);
+    fwrite_line(codegen_spill_slot_x86_64_att_asm(frame, frame->spill_depth).c_str(),code);
+    frame->spill_depth += 1;
+}
+
+Error codegen_function_call_x86_64_att_asm_mswin(CodegenWalkState *state, Node *call, bool spill) {
+    std::ostream &code = *state->code;
+    CodegenFrame *frame = state->frames.back();
+    // Computed arguments were spilled in argument order into the topmost
+    // slots; the rest are loaded afterwards so nothing can clobber them.
+    std::vector<Node *> arguments;
+    size_t spilled = 0;
+    for (Node *argument = call->children->next_child->children; argument; argument = argument->next_child) {
+        arguments.push_back(argument);
+        if (frameValueIsComputed(argument))
+            spilled += 1;
+    }
+    // Arguments after the fourth go above the shadow space, through RAX.
+    size_t slot = frame->spill_depth - spilled;
+    for (size_t i = 0; i < arguments.size(); i++) {
+        bool computed = frameValueIsComputed(arguments[i]);
+        if (i < CODEGEN_ARGUMENT_REGISTER_COUNT_MSWIN) {
+            if (computed)
+                codegen_operand_load_x86_64_att_asm(codegen_operand_spill_slot(frame, slot),
+                                                    codegen_argument_registers_mswin[i], code);
+        } else {
+            if (computed) {
+                codegen_operand_load_x86_64_att_asm(codegen_operand_spill_slot(frame, slot), codegen_rax, code);
+            } else {
+                Error err = codegen_load_x86_64_att_asm(state, arguments[i], codegen_rax);
+                if (err.type != ErrorType::NONE)
+                    return err;
+            }
+            size_t offset = FRAME_SHADOW_SPACE_MSWIN + FRAME_SLOT_SIZE * (i - CODEGEN_ARGUMENT_REGISTER_COUNT_MSWIN);
+            fwrite_bytes("mov %rax, ",code);
+            fwrite_line((std::to_string(offset) + "(%rsp)").c_str(),code);
+        }
+        if (computed)
+            slot += 1;
+    }
+    frame->spill_depth -= spilled;
+    for (size_t i = 0; i < arguments.size() && i < CODEGEN_ARGUMENT_REGISTER_COUNT_MSWIN; i++) {
+        if (frameValueIsComputed(arguments[i]))
+            continue;
+        Error err = codegen_load_x86_64_att_asm(state, arguments[i], codegen_argument_registers_mswin[i]);
+        if (err.type != ErrorType::NONE)
+            return err;
+    }
+    fwrite_bytes("call ",code);
+    fwrite_line(call->children->value.symbol,code);
+
+    if (spill)
+        codegen_spill_x86_64_att_asm(frame, code);
+    return ok;
+}
+
+/**
+ * Operators compute into RAX from the pattern table: one operand is loaded
+ * there and the instruction takes the other as an immediate, from memory or
+ * from RCX, whichever is cheapest; for + and * either operand may be the
+ * one loaded. A computed left operand waits in a spill slot while a
+ * computed right operand is evaluated.
+ */
+Error codegen_binary_operator_x86_64_att_asm(CodegenWalkState *state, Node *node, bool spill) {
+    std::ostream &code = *state->code;
+    CodegenFrame *frame = state->frames.back();
     Error err = ok;
-    if(!program || program->type != NodeType::PROGRAM){
-        err.prepareError(ErrorType::ARGUMENTS, "codegen_program() requires a program!");
+    CodegenOperation operation;
+    switch (node->children->value.symbol[0]) {
+        case '+': operation = CodegenOperation::ADD; break;
+        case '-': operation = CodegenOperation::SUBTRACT; break;
+        case '*': operation = CodegenOperation::MULTIPLY; break;
+        case '<': operation = CodegenOperation::LESS; break;
+        default:
+            err.prepareError(ErrorType::TODO, std::string("codegen: Unsupported operator ") + node->children->value.symbol);
+            return err;
+    }
+    bool commutative = operation == CodegenOperation::ADD || operation == CodegenOperation::MULTIPLY;
+    Node *left = node->children->next_child;
+    Node *right = left->next_child;
+    CodegenOperand left_operand;
+    CodegenOperand right_operand;
+    if (frameValueIsComputed(right)) {
+        // The right operand is in RAX.
+        if (frameValueIsComputed(left)) {
+            frame->spill_depth -= 1;
+            left_operand = codegen_operand_spill_slot(frame, frame->spill_depth);
+        } else {
+            err = codegen_operand_x86_64_att_asm(state, left, &left_operand);
+            if (err.type != ErrorType::NONE)
+                return err;
+        }
+        if (commutative) {
+            right_operand = left_operand;
+        } else {
+            codegen_operand_load_x86_64_att_asm(codegen_operand_register(codegen_rax), codegen_rcx, code);
+            codegen_operand_load_x86_64_att_asm(left_operand, codegen_rax, code);
+            right_operand = codegen_operand_register(codegen_rcx);
+        }
+    } else {
+        err = codegen_operand_x86_64_att_asm(state, right, &right_operand);
+        if (err.type == ErrorType::NONE && !frameValueIsComputed(left))
+            err = codegen_operand_x86_64_att_asm(state, left, &left_operand);
+        if (err.type != ErrorType::NONE)
+            return err;
+        // A computed left operand is in RAX already.
+        if (!frameValueIsComputed(left)) {
+            unsigned in_order = codegen_pattern_select(CodegenOperation::LOAD, left_operand)->cost
+                + codegen_operation_cost(operation, right_operand);
+            unsigned swapped = codegen_pattern_select(CodegenOperation::LOAD, right_operand)->cost
+                + codegen_operation_cost(operation, left_operand);
+            if (commutative && swapped < in_order)
+                std::swap(left_operand, right_operand);
+            codegen_operand_load_x86_64_att_asm(left_operand, codegen_rax, code);
+        }
+    }
+    codegen_operation_x86_64_att_asm(operation, right_operand, code);
+
+    if (operation == CodegenOperation::LESS) {
+        if (state->branch.condition == node) {
+            // The comparison feeds the loop branch directly.
+            fwrite_bytes(state->branch.when_true ? "jl " : "jge ",code);
+            fwrite_bytes(state->branch.label,code);
+            fwrite_integer(static_cast<long long>(state->branch.number),code);
+            return fwrite_line("",code);
+        }
+        fwrite_line("setl %al",code);
+        fwrite_line("movzbq %al, %rax",code);
+    }
+    if (spill)
+        codegen_spill_x86_64_att_asm(frame, code);
+    return ok;
+}
+
+WalkAction codegen_expression_pre_x86_64_att_asm_mswin(Node *expression, Node *parent, size_t depth, void *data);
+WalkAction codegen_expression_post_x86_64_att_asm_mswin(Node *expression, Node *parent, size_t depth, void *data);
+
+/// Emit a list of statements with the state of the walk that is in progress.
+static Error codegen_walk_list_x86_64_att_asm_mswin(CodegenWalkState *state, Node *expression) {
+    NodeVisitor visitor = {
+        codegen_expression_pre_x86_64_att_asm_mswin,
+        codegen_expression_post_x86_64_att_asm_mswin,
+        state
+    };
+    for (; expression; expression = expression->next_child) {
+        nodeWalk(expression, visitor);
+        if (state->err.type != ErrorType::NONE)
+            return state->err;
+    }
+    return ok;
+}
+
+/// Jump to `label` `number` if the condition is (or, with `when_true` false, is not) non-zero.
+static Error codegen_branch_x86_64_att_asm_mswin(CodegenWalkState *state, Node *condition, const char *label,
+                                                 size_t number, bool when_true) {
+    std::ostream &code = *state->code;
+    Error err = ok;
+    if (condition->type == NodeType::INTEGER || condition->type == NodeType::NONE) {
+        if ((condition->value.integer != 0) != when_true)
+            return ok;
+        fwrite_bytes("jmp ",code);
+    } else if (condition->type == NodeType::BINARY_OPERATOR && condition->children->value.symbol[0] == '<') {
+        // The comparison itself emits the jump, see codegen_binary_operator_x86_64_att_asm().
+        state->branch = {condition, label, number, when_true};
+        err = codegen_walk_list_x86_64_att_asm_mswin(state, condition);
+        state->branch.condition = nullptr;
         return err;
+    } else {
+        if (condition->type == NodeType::SYMBOL)
+            err = codegen_load_x86_64_att_asm(state, condition, codegen_rax);
+        else
+            err = codegen_walk_list_x86_64_att_asm_mswin(state, condition);
+        if (err.type != ErrorType::NONE)
+            return err;
+        fwrite_line("test %rax, %rax",code);
+        fwrite_bytes(when_true ? "jnz " : "jz ",code);
     }
+    fwrite_bytes(label,code);
+    fwrite_integer(static_cast<long long>(number),code);
+    return fwrite_line("",code);
+}
 
-    std::ofstream code("code.S", std::ios::binary);
-    if (!code.is_open()) {
-        err.prepareError(ErrorType::GENERIC, "codegen_program() could not open code file.");
+/**
+ * Loops are rotated: the condition is tested once before the loop and then
+ * at the bottom of the body, so each iteration takes a single branch.
+ * Statements hoisted out of the loop run once, after the first test.
+ */
+Error codegen_while_x86_64_att_asm_mswin(CodegenWalkState *state, Node *loop) {
+    std::ostream &code = *state->code;
+    size_t number = codegen_label_count++;
+    Node *condition = loop->children;
+    Node *body = condition->next_child;
+    Node *preheader = body->next_child;
+    // Walking a single condition must not continue into the loop's other children.
+    Node *rest = condition->next_child;
+    condition->next_child = nullptr;
+    Error err = codegen_branch_x86_64_att_asm_mswin(state, condition, ".Lwhile_end_", number, false);
+    if (err.type == ErrorType::NONE)
+        err = codegen_walk_list_x86_64_att_asm_mswin(state, preheader->children);
+    if (err.type == ErrorType::NONE) {
+        fwrite_bytes(".Lwhile_body_",code);
+        fwrite_integer(static_cast<long long>(number),code);
+        fwrite_line(":",code);
+        err = codegen_walk_list_x86_64_att_asm_mswin(state, body->children);
+    }
+    if (err.type == ErrorType::NONE)
+        err = codegen_branch_x86_64_att_asm_mswin(state, condition, ".Lwhile_body_", number, true);
+    condition->next_child = rest;
+    if (err.type != ErrorType::NONE)
         return err;
+    fwrite_bytes(".Lwhile_end_",code);
+    fwrite_integer(static_cast<long long>(number),code);
+    return fwrite_line(":",code);
+}
+
+/// A body returns the value of its last expression; computed values are in RAX already.
+static Error codegen_body_result_x86_64_att_asm(CodegenWalkState *state, Node *body) {
+    if (!body)
+        return ok;
+    while (body->next_child)
+        body = body->next_child;
+    if (body->type != NodeType::INTEGER && body->type != NodeType::SYMBOL)
+        return ok;
+    return codegen_load_x86_64_att_asm(state, body, codegen_rax);
+}
+
+WalkAction codegen_expression_pre_x86_64_att_asm_mswin(Node *expression, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    CodegenWalkState *state = static_cast<CodegenWalkState *>(data);
+    std::ostream &code = *state->code;
+    switch(expression->type){
+        default:
+            return WalkAction::SKIP_CHILDREN;
+        case NodeType::NONE:
+            // Walk function bodies and call argument lists, but not parameter lists.
+            if (parent && parent->type == NodeType::FUNCTION && expression == parent->children)
+                return WalkAction::SKIP_CHILDREN;
+            if (parent && parent->type == NodeType::FUNCTION_CALL)
+                state->argument_lists.push_back(expression);
+            return WalkAction::CONTINUE;
+        case NodeType::FUNCTION_CALL:
+        case NodeType::BINARY_OPERATOR:
+            return WalkAction::CONTINUE;
+        case NodeType::VARIABLE_REASSIGNMENT:
+            return WalkAction::CONTINUE;
+        case NodeType::VARIABLE_DECLARATION:
+            // Constant initializers of globals are static data; the rest run here.
+            if (!state->context->parent && !codegen_initializer_is_constant(expression->children->next_child))
+                return WalkAction::CONTINUE;
+            if (state->context->parent && frameValueIsComputed(expression->children->next_child))
+                return WalkAction::CONTINUE;
+            return WalkAction::SKIP_CHILDREN;
+        case NodeType::WHILE:
+            state->err = codegen_while_x86_64_att_asm_mswin(state, expression);
+            if (state->err.type != ErrorType::NONE)
+                return WalkAction::STOP;
+            return WalkAction::SKIP_CHILDREN;
+        case NodeType::FUNCTION: {
+            // Top-level definitions are emitted once, from the functions environment.
+            if (!parent && !state->context->parent)
+                return WalkAction::SKIP_CHILDREN;
+            // Handling a function here means a lambda should be generated, I think.
+            // TODO: Generate name from some sort of hashing algorithm or something.
+            const size_t lambda_symbol_size = 8;
+            std::string lambda_symbol(lambda_symbol_size, 'a');
+            for (size_t i = 0; i < lambda_symbol_size; i++) {
+                lambda_symbol[i] = (rand() % 26) + 97;
+            }
+            state->lambdas.push_back({expression, lambda_symbol});
+            state->context = scopePush(state->context->scopes, state->context, "func");
+            CodegenFrame *frame = new CodegenFrame;
+            memoryAllocated(MemoryCategory::CODEGEN, sizeof(CodegenFrame));
+            Node *body = expression->children->next_child->next_child->children;
+            frame->layout = frameLayoutCompute(state->context, body, &frame->locals);
+            frame->spill_depth = 0;
+            frame->parameters = expression->children;
+            state->frames.push_back(frame);
+            size_t home_registers = 0;
+            if (codegen_uses_parameters(frame->parameters, body))
+                for (Node *parameter = frame->parameters->children; parameter; parameter = parameter->next_child)
+                    home_registers += 1;
+            codegen_function_header_x86_64_att_asm_mswin(lambda_symbol.c_str(), frame->layout, home_registers, false, code);
+            return WalkAction::CONTINUE;
+        }
     }
+}
+
+WalkAction codegen_expression_post_x86_64_att_asm_mswin(Node *expression, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    CodegenWalkState *state = static_cast<CodegenWalkState *>(data);
+    std::ostream &code = *state->code;
+    switch(expression->type){
+        default:
+            break;
+        case NodeType::NONE:
+            if (!state->argument_lists.empty() && state->argument_lists.back() == expression)
+                state->argument_lists.pop_back();
+            break;
+        case NodeType::FUNCTION: {
+            if (state->lambdas.empty() || state->lambdas.back().first != expression)
+                break;
+            state->err = codegen_body_result_x86_64_att_asm(state, expression->children->next_child->next_child->children);
+            if (state->err.type != ErrorType::NONE)
+                return WalkAction::STOP;
+            ParsingContext *function_context = state->context;
+            state->context = function_context->parent;
+            scopeRelease(function_context->scopes, scopeMark(function_context->scopes) - 1);
+            CodegenFrame *frame = state->frames.back();
+            codegen_function_footer_x86_64_att_asm_mswin(state->lambdas.back().second.c_str(), frame->layout, code);
+            state->frames.pop_back();
+            memoryFreed(MemoryCategory::CODEGEN, sizeof(CodegenFrame));
+            delete frame;
+            state->lambdas.pop_back();
+            break;
+        }
+        case NodeType::FUNCTION_CALL:
+        case NodeType::BINARY_OPERATOR: {
+            bool is_argument = !state->argument_lists.empty() && state->argument_lists.back() == parent;
+            bool spill = frameValueSpills(expression, parent, is_argument);
+            if (expression->type == NodeType::FUNCTION_CALL)
+                state->err = codegen_function_call_x86_64_att_asm_mswin(state, expression, spill);
+            else
+                state->err = codegen_binary_operator_x86_64_att_asm(state, expression, spill);
+            if (state->err.type != ErrorType::NONE)
+                return WalkAction::STOP;
+            break;
+        }
+        case NodeType::VARIABLE_DECLARATION:
+            if (!state->context->parent && codegen_initializer_is_constant(expression->children->next_child))
+                break;
+            // Locals are set where they are declared; without an initializer, to zero.
+            state->err = codegen_store_x86_64_att_asm(state, expression->children, expression->children->next_child);
+            if (state->err.type != ErrorType::NONE)
+                return WalkAction::STOP;
+            break;
+        case NodeType::VARIABLE_REASSIGNMENT:
+            state->err = codegen_store_x86_64_att_asm(state, expression->children, expression->children->next_child);
+            if (state->err.type != ErrorType::NONE)
+                return WalkAction::STOP;
+            break;
+    }
+    return WalkAction::CONTINUE;
+}
+
+/// @param result Leave the value of the last expression in RAX.
+Error codegen_expression_list_x86_64_att_asm_mswin(ParsingContext *context, Node *expression, CodegenFrame *frame,
+                                                   bool result, std::ostream &code) {
+    CodegenWalkState state;
+    state.context = context;
+    state.code = &code;
+    state.frames.push_back(frame);
+    state.branch.condition = nullptr;
+    state.err = ok;
+    Error err = codegen_walk_list_x86_64_att_asm_mswin(&state, expression);
+    if (err.type != ErrorType::NONE || !result)
+        return err;
+    return codegen_body_result_x86_64_att_asm(&state, expression);
+}
+
+/**
+ * @param instrument Count calls in the function's __profile_count_<name> counter.
+ * @param align_entry Align the entry to 16 bytes, for hot functions.
+ */
+Error codegen_function_x86_64_att_asm_mswin(ParsingContext *context, char *name, Node *function,
+                                            bool instrument, bool align_entry, std::ostream &code) {
+    TimingScope timing("codegen function", name);
+    Node *body = function->children->next_child->next_child->children;
+
+    size_t scope_mark = scopeMark(context->scopes);
+    context = scopePush(context->scopes, context, "func");
+    CodegenFrame frame;
+    frame.layout = frameLayoutCompute(context, body, &frame.locals);
+    frame.spill_depth = 0;
+    frame.parameters = function->children;
+    size_t home_registers = 0;
+    if (codegen_uses_parameters(frame.parameters, body))
+        for (Node *parameter = frame.parameters->children; parameter; parameter = parameter->next_child)
+            home_registers += 1;
+
+    codegen_function_header_x86_64_att_asm_mswin(name, frame.layout, home_registers, align_entry, code);
+    if (instrument) {
+        fwrite_bytes("incq __profile_count_",code);
+        fwrite_bytes(name,code);
+        fwrite_line("(%rip)",code);
+    }
+
+    // Function body
+    Error err = codegen_expression_list_x86_64_att_asm_mswin(context, body, &frame, true, code);
+    context = context->parent;
+    scopeRelease(context->scopes, scope_mark);
+    if (err.type != ErrorType::NONE)
+        return err;
+
+    codegen_function_footer_x86_64_att_asm_mswin(name, frame.layout, code);
+    return ok;
+}
+
+/**
+ * Counter block of an instrumented program, laid out exactly as profileRead()
+ * expects, followed by the path it is written to.
+ */
+Error codegen_profile_data_x86_64_att_asm(const std::vector<Binding *> &functions, const char *path, std::ostream &code) {
+    // The counters are written at run time, and the data section may have ended in .bss.
+    fwrite_line(".section .data", code);
+    fwrite_line(".balign 8", code);
+    fwrite_line("__profile_data:", code);
+    fwrite_bytes(".ascii \"", code);
+    fwrite_bytes(PROFILE_MAGIC, code);
+    fwrite_line("\"", code);
+    fwrite_bytes(".quad ", code);
+    fwrite_integer(static_cast<long long>(functions.size()), code);
+    fwrite_line("", code);
+    for (Binding *function : functions) {
+        const char *name = function->id->value.symbol;
+        fwrite_bytes("__profile_count_", code);
+        fwrite_bytes(name, code);
+        fwrite_line(":", code);
+        fwrite_line(".quad 0", code);
+        fwrite_bytes(".quad ", code);
+        fwrite_integer(static_cast<long long>(strlen(name)), code);
+        fwrite_line("", code);
+        fwrite_bytes(".ascii \"", code);
+        fwrite_bytes(name, code);
+        fwrite_line("\"", code);
+        fwrite_line(".balign 8", code);
+    }
+    fwrite_line("__profile_data_end:", code);
+    fwrite_line("__profile_path:", code);
+    fwrite_bytes(".asciz \"", code);
+    for (const char *it = path; *it; it++) {
+        if (*it == '"' || *it == '\\')
+            code.put('\\');
+        code.put(*it);
+    }
+    return fwrite_line("\"", code);
+}
 
+/**
+ * Write the counter block to the profile path and exit. There is no runtime
+ * library to lean on, so this uses Linux system calls directly (open, write,
+ * close, exit); it is the only place the generated code assumes an OS.
+ */
+Error codegen_profile_dump_x86_64_att_asm_linux(std::ostream &code) {
+    fwrite_line("lea __profile_path(%rip), %rdi", code);
+    fwrite_line("mov $577, %rsi", code); // O_WRONLY | O_CREAT | O_TRUNC
+    fwrite_line("mov $420, %rdx", code); // 0644
+    fwrite_line("mov $2, %rax", code);
+    fwrite_line("syscall", code);
+    fwrite_line("test %rax, %rax", code);
+    fwrite_line("js __profile_exit", code);
+    fwrite_line("mov %rax, %rdi", code);
+    fwrite_line("lea __profile_data(%rip), %rsi", code);
+    fwrite_line("lea __profile_data_end(%rip), %rdx", code);
+    fwrite_line("sub %rsi, %rdx", code);
+    fwrite_line("mov $1, %rax", code);
+    fwrite_line("syscall", code);
+    // The kernel leaves RDI, the descriptor, alone.
+    fwrite_line("mov $3, %rax", code);
+    fwrite_line("syscall", code);
+    fwrite_line("__profile_exit:", code);
+    fwrite_line("xor %rdi, %rdi", code);
+    fwrite_line("mov $60, %rax", code);
+    return fwrite_line("syscall", code);
+}
+
+/// Emit x86_64 AT&T Assembly with MS Windows function calling convention.
+/// Arguments passed in: RCX, RDX, R8, R9 -> stack
+Error codegen_program_x86_64_att_asm_mswin(ParsingContext *context, Node *program, const CodegenOptions &options,
+                                           bool instrument, std::ostream &code){
+    Error err = ok;
+    codegen_label_count = 0;
     err = fwrite_bytes(";;#; ", code);
     if(err.type != ErrorType::NONE)
         return err;
@@ -246,47 +1178,748 @@ Error codegen_program_x86_64_att_asm_mswin(ParsingContext *context, Node *progra
     if(err.type != ErrorType::NONE)
         return err;
 
-    codegen_program_x86_64_att_asm_data_section(context, code);
+    std::vector<Binding *> functions;
+    for (Binding *function_it = context->functions->bind; function_it; function_it = function_it->next)
+        functions.push_back(function_it);
+    // Hot functions first and next to each other, most called first.
+    if (options.profile) {
+        std::stable_sort(functions.begin(), functions.end(), [&](Binding *a, Binding *b) {
+            return profileCalls(options.profile, a->id->value.symbol) > profileCalls(options.profile, b->id->value.symbol);
+        });
+    }
+
+    err = codegen_program_x86_64_att_asm_data_section(context, program, code);
+    if (err.type != ErrorType::NONE)
+        return err;
+    if (instrument)
+        codegen_profile_data_x86_64_att_asm(functions, options.profile_path, code);
 
     fwrite_line(".section .text", code);
 
-    Binding *function_it = context->functions->bind;
-    while(function_it){
-        Node *function_id = function_it->id;
-        Node *function = function_it->value;
-        function_it = function_it->next;
+    for (Binding *function : functions) {
+        char *name = function->id->value.symbol;
+        err = codegen_function_x86_64_att_asm_mswin(context, name, function->value,
+                                                    instrument, profileIsHot(options.profile, name), code);
+        if (err.type != ErrorType::NONE)
+            return err;
+    }
+
+    {
+        TimingScope timing("codegen _start");
+        CodegenFrame frame;
+        frame.layout = frameLayoutCompute(context, program->children);
+        frame.spill_depth = 0;
+        frame.parameters = nullptr;
 
-        err = codegen_function_x86_64_att_asm_mswin(context, function_id->value.symbol, function, code);
+        fwrite_line(".global _start", code);
+        fwrite_line("_start:", code);
+        codegen_frame_allocate_x86_64_att_asm(frame.layout, code);
+
+        err = codegen_expression_list_x86_64_att_asm_mswin(context, program->children, &frame, false, code);
+        if (err.type != ErrorType::NONE)
+            return err;
+
+        if (instrument)
+            return codegen_profile_dump_x86_64_att_asm_linux(code);
+        codegen_frame_free_x86_64_att_asm(frame.layout, code);
+        err = fwrite_line("ret", code);
     }
+    return err;
+}
 
+Error codegen_stream_begin_x86_64_att_asm_mswin(CodegenStream *stream) {
+    Error err = ok;
+    stream->code.open("code.S", std::ios::binary);
+    if (!stream->code.is_open()) {
+        err.prepareError(ErrorType::GENERIC, "codegen_stream_begin() could not open code file.");
+        return err;
+    }
+    std::ofstream &code = stream->code;
+    codegen_label_count = 0;
+    fwrite_bytes(";;#; ", code);
+    fwrite_line((char *)codegen_header, code);
+    fwrite_line(".section .text", code);
     fwrite_line(".global _start", code);
     fwrite_line("_start:", code);
-    fwrite_line("push %rbp", code);
-    fwrite_line("mov %rsp, %rbp", code);
-    fwrite_line("sub $32, %rsp", code);
+    // The frame size is only known once every expression has been seen.
+    err = fwrite_line("sub $_start_frame_size, %rsp", code);
+    frameLayoutInit(&stream->start_frame);
+    return err;
+}
 
-    codegen_expression_list_x86_64_att_asm_mswin(context, program->children, code);
+/// Code for a top-level expression, in the body of _start.
+static Error codegen_stream_start_code_x86_64_att_asm_mswin(CodegenStream *stream, Node *expression) {
+    frameLayoutAdd(&stream->start_frame, stream->context, expression);
+    // Spill slots sit above the outgoing area so far; it only grows, and the final size covers it.
+    CodegenFrame frame;
+    frame.layout = stream->start_frame;
+    frame.layout.spill_offset = frameOutgoingSize(stream->start_frame);
+    frame.spill_depth = 0;
+    frame.parameters = nullptr;
+    return codegen_expression_list_x86_64_att_asm_mswin(stream->context, expression, &frame, false, stream->code);
+}
+
+/// Everything lands in the body of _start, in source order; functions are
+/// jumped over and globals switch to .data and back.
+Error codegen_stream_expression_x86_64_att_asm_mswin(CodegenStream *stream, Node *expression) {
+    Error err = ok;
+    ParsingContext *context = stream->context;
+    std::ofstream &code = stream->code;
+    switch (expression->type) {
+        default:
+            return codegen_stream_start_code_x86_64_att_asm_mswin(stream, expression);
+        case NodeType::VARIABLE_DECLARATION: {
+            Node *initializer = expression->children->next_child;
+            {
+                TimingScope timing("codegen data section");
+                Node type_info;
+                err = codegen_global_type_x86_64_att_asm(context, expression->children, &type_info);
+                if (err.type != ErrorType::NONE)
+                    return err;
+                // Globals are emitted as they are declared, so each is aligned on its own.
+                fwrite_line(codegen_initializer_is_zero(initializer) ? ".section .bss" : ".section .data", code);
+                codegen_balign_x86_64_att_asm(typeAlignment(&type_info), code);
+                err = codegen_global_x86_64_att_asm(expression->children, initializer, &type_info, code);
+                if (err.type != ErrorType::NONE)
+                    return err;
+                err = fwrite_line(".section .text", code);
+            }
+            if (err.type != ErrorType::NONE || codegen_initializer_is_constant(initializer))
+                return err;
+            return codegen_stream_start_code_x86_64_att_asm_mswin(stream, expression);
+        }
+        case NodeType::FUNCTION: {
+            // Definitions are prepended to the environment, so this is found immediately.
+            Binding *function_it = context->functions->bind;
+            while (function_it && function_it->value != expression)
+                function_it = function_it->next;
+            if (!function_it) {
+                err.prepareError(ErrorType::GENERIC, "codegen: Function definition missing from environment");
+                return err;
+            }
+            return codegen_function_x86_64_att_asm_mswin(context, function_it->id->value.symbol, expression, false, false, code);
+        }
+    }
+}
 
-    fwrite_line("add $32, %rsp", code);
-    fwrite_line("pop %rbp", code);
+Error codegen_stream_end_x86_64_att_asm_mswin(CodegenStream *stream) {
+    std::ofstream &code = stream->code;
+    frameLayoutFinish(&stream->start_frame);
+    fwrite_line("add $_start_frame_size, %rsp", code);
     fwrite_line("ret", code);
+    fwrite_bytes(".set _start_frame_size, ", code);
+    fwrite_integer(static_cast<long long>(stream->start_frame.size), code);
+    Error err = fwrite_line("", code);
+    {
+        TimingScope timing("write code.S");
+        code.close();
+    }
+    return err;
+}
+
+//================================================================ END x86_64 AT&T ASM
+
+//================================================================ BEG C99
+
+static const char *codegen_c99_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum", "extern",
+    "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+    "_Bool", "_Complex", "_Imaginary", "main",
+};
+
+/// Whether a source identifier can be written to C unchanged: not a
+/// keyword, not reserved, and clear of `<stdint.h>` and our `func_` helpers.
+static bool codegen_c99_identifier_is_plain(const char *symbol) {
+    size_t length = strlen(symbol);
+    if (!length || !(isalpha(static_cast<unsigned char>(symbol[0]))))
+        return false;
+    for (size_t i = 0; i < length; i++)
+        if (!isalnum(static_cast<unsigned char>(symbol[i])) && symbol[i] != '_')
+            return false;
+    for (const char *keyword : codegen_c99_keywords)
+        if (strcmp(symbol, keyword) == 0)
+            return false;
+    if (length >= 2 && strcmp(symbol + length - 2, "_t") == 0)
+        return false;
+    return strncmp(symbol, "func_", 5) != 0 && strncmp(symbol, "INT", 3) != 0 && strncmp(symbol, "UINT", 4) != 0;
+}
+
+/**
+ * The C spelling of a source identifier. Others get a `func_v_` prefix, `__`
+ * for `_` and `_XX` for other bytes. A record field `p.x` is spelled one
+ * part at a time, since records are structs.
+ */
+static void codegen_c99_identifier(const char *symbol, std::ostream &code) {
+    const char *dot = strchr(symbol, '.');
+    if (dot) {
+        codegen_c99_identifier(std::string(symbol, dot).c_str(), code);
+        code.put('.');
+        codegen_c99_identifier(dot + 1, code);
+        return;
+    }
+    if (codegen_c99_identifier_is_plain(symbol)) {
+        fwrite_bytes(symbol, code);
+        return;
+    }
+    static const char *hex = "0123456789abcdef";
+    fwrite_bytes("func_v_", code);
+    for (const char *it = symbol; *it; it++) {
+        unsigned char c = static_cast<unsigned char>(*it);
+        if (c == '_') {
+            code << "__";
+        } else if (isalnum(c)) {
+            code.put(static_cast<char>(c));
+        } else {
+            code.put('_');
+            code.put(hex[c >> 4]);
+            code.put(hex[c & 15]);
+        }
+    }
+}
+
+static std::string codegen_c99_type(const Node *type_info) {
+    if (typeIsRecord(type_info)) {
+        std::ostringstream name;
+        name << "struct ";
+        codegen_c99_identifier(recordTypeName(type_info), name);
+        return name.str();
+    }
+    bool is_signed = typeIsSigned(type_info);
+    switch (typeSize(type_info)) {
+        case 1: return is_signed ? "int8_t" : "uint8_t";
+        case 2: return is_signed ? "int16_t" : "uint16_t";
+        case 4: return is_signed ? "int32_t" : "uint32_t";
+        default: return is_signed ? "int64_t" : "uint64_t";
+    }
+}
 
-    code.close();
+/**
+ * A struct per record type, its members in offset order. Without packing,
+ * C lays them out at the very offsets the native backend uses.
+ */
+static Error codegen_c99_records(ParsingContext *context, std::ostream &code) {
+    Error err = ok;
+    std::vector<const Node *> records;
+    for (Binding *it = context->types->bind; it; it = it->next)
+        if (typeIsRecord(it->value))
+            records.push_back(it->value);
+    // Bindings are kept newest first; a record's fields only use records declared before it.
+    for (auto record = records.rbegin(); record != records.rend(); ++record) {
+        if (recordTypeLayout(*record) == RecordLayoutKind::PACKED) {
+            err.prepareError(ErrorType::TODO, std::string("codegen: C99 output does not support packed records like ")
+                             + recordTypeName(*record));
+            return err;
+        }
+        fwrite_bytes(codegen_c99_type(*record).c_str(), code);
+        fwrite_line(" {", code);
+        for (Node *field : recordFieldsByOffset(*record)) {
+            Node type_info;
+            if (parseGetType(context, field->children->next_child, &type_info).type != ErrorType::NONE) {
+                err.prepareError(ErrorType::TYPE, std::string("codegen: Unknown type of field ")
+                                 + field->children->value.symbol);
+                return err;
+            }
+            fwrite_bytes("    ", code);
+            fwrite_bytes(codegen_c99_type(&type_info).c_str(), code);
+            fwrite_bytes(" ", code);
+            codegen_c99_identifier(field->children->value.symbol, code);
+            fwrite_line(";", code);
+        }
+        fwrite_line("};", code);
+        fwrite_line("", code);
+    }
     return ok;
 }
 
-//================================================================ END x86_64 AT&T ASM
+/// An integer literal of type int64_t; the most negative one has no literal.
+static void codegen_c99_integer(long long integer, std::ostream &code) {
+    if (integer == LLONG_MIN) {
+        fwrite_bytes("INT64_MIN", code);
+        return;
+    }
+    bool is_int = integer >= -2147483647ll && integer <= 2147483647ll;
+    if (!is_int)
+        fwrite_bytes("INT64_C(", code);
+    fwrite_integer(integer, code);
+    if (!is_int)
+        fwrite_bytes(")", code);
+}
+
+struct CodegenC99State {
+    ParsingContext *context;
+    /// The function being emitted, or NULL for main.
+    Node *function;
+    size_t indent;
+};
+
+/// Type of a variable, or of a record field like `p.x`, visible in the function being emitted.
+static Error codegen_c99_variable_type(CodegenC99State *state, Node *var_id, Node *type_info) {
+    Error err = ok;
+    const char *dot = strchr(var_id->value.symbol, '.');
+    if (dot) {
+        Node *record = nodeSymbolFromBuffer(var_id->value.symbol, static_cast<size_t>(dot - var_id->value.symbol));
+        err = codegen_c99_variable_type(state, record, type_info);
+        deleteNode(record);
+        if (err.type != ErrorType::NONE)
+            return err;
+        Node record_info = *type_info;
+        long long offset = 0;
+        return recordFieldPath(state->context, &record_info, dot + 1, &offset, type_info);
+    }
+    if (state->function) {
+        Node *type_id = nullptr;
+        for (Node *parameter = state->function->children->children; parameter; parameter = parameter->next_child)
+            if (nodeCompare(parameter->children, var_id))
+                type_id = parameter->children->next_child;
+        Node *body = state->function->children->next_child->next_child;
+        for (Node *expression = body->children; expression && !type_id; expression = expression->next_child)
+            if (expression->type == NodeType::VARIABLE_DECLARATION && nodeCompare(expression->children, var_id))
+                type_id = expression->children->next_child->next_child;
+        if (type_id) {
+            if (parseGetType(state->context, type_id, type_info).type != ErrorType::NONE)
+                err.prepareError(ErrorType::TYPE, std::string("codegen: Unknown type of ") + var_id->value.symbol);
+            return err;
+        }
+    }
+    return codegen_global_type_x86_64_att_asm(state->context, var_id, type_info);
+}
+
+static void codegen_c99_indent(CodegenC99State *state, std::ostream &code) {
+    for (size_t i = 0; i < state->indent; i++)
+        fwrite_bytes("    ", code);
+}
 
-Error codegen_program(CodegenOutputFormat format, ParsingContext *context, Node *program) {
+/// An expression of type int64_t. Arithmetic goes through helpers that wrap around like the native backend.
+static Error codegen_c99_expression(CodegenC99State *state, Node *expression, std::ostream &code) {
+    Error err = ok;
+    switch (expression->type) {
+        default:
+            err.prepareError(ErrorType::TODO, "codegen: C99 output does not support this expression");
+            return err;
+        case NodeType::INTEGER:
+            codegen_c99_integer(expression->value.integer, code);
+            return ok;
+        case NodeType::SYMBOL:
+            codegen_c99_identifier(expression->value.symbol, code);
+            return ok;
+        case NodeType::BINARY_OPERATOR: {
+            switch (expression->children->value.symbol[0]) {
+                case '+': fwrite_bytes("func_add(", code); break;
+                case '-': fwrite_bytes("func_sub(", code); break;
+                case '*': fwrite_bytes("func_mul(", code); break;
+                case '<': fwrite_bytes("func_lt(", code); break;
+                default:
+                    err.prepareError(ErrorType::TODO, std::string("codegen: Unknown operator ")
+                                     + expression->children->value.symbol);
+                    return err;
+            }
+            err = codegen_c99_expression(state, expression->children->next_child, code);
+            if (err.type != ErrorType::NONE)
+                return err;
+            fwrite_bytes(", ", code);
+            err = codegen_c99_expression(state, expression->children->next_child->next_child, code);
+            if (err.type != ErrorType::NONE)
+                return err;
+            return fwrite_bytes(")", code);
+        }
+        case NodeType::FUNCTION_CALL: {
+            Binding *callee = environmentFind(state->context->functions, expression->children);
+            Node *parameter = callee ? callee->value->children->children : nullptr;
+            codegen_c99_identifier(expression->children->value.symbol, code);
+            fwrite_bytes("(", code);
+            for (Node *argument = expression->children->next_child->children; argument; argument = argument->next_child) {
+                Node type_info;
+                // Literals the parameter can not hold are truncated on purpose, as in a register.
+                if (parameter && argument->type == NodeType::INTEGER
+                    && parseGetType(state->context, parameter->children->next_child, &type_info).type == ErrorType::NONE
+                    && !typeContains(&type_info, argument)) {
+                    fwrite_bytes("(", code);
+                    fwrite_bytes(codegen_c99_type(&type_info).c_str(), code);
+                    fwrite_bytes(")", code);
+                }
+                if (parameter)
+                    parameter = parameter->next_child;
+                err = codegen_c99_expression(state, argument, code);
+                if (err.type != ErrorType::NONE)
+                    return err;
+                if (argument->next_child)
+                    fwrite_bytes(", ", code);
+            }
+            return fwrite_bytes(")", code);
+        }
+    }
+}
+
+/**
+ * `name = value;`, rejecting literals out of the variable's range like the native backend.
+ * @param declare Also declare the variable, with this type.
+ */
+static Error codegen_c99_store(CodegenC99State *state, Node *var_id, Node *value, const char *declare,
+                               std::ostream &code) {
+    Node type_info;
+    Error err = codegen_c99_variable_type(state, var_id, &type_info);
+    if (err.type != ErrorType::NONE)
+        return err;
+    if (value->type == NodeType::INTEGER && !typeContains(&type_info, value)) {
+        err.prepareError(ErrorType::TYPE, std::string("codegen: Integer literal out of range of the type of ")
+                         + var_id->value.symbol);
+        return err;
+    }
+    codegen_c99_indent(state, code);
+    if (declare) {
+        fwrite_bytes(declare, code);
+        fwrite_bytes(" ", code);
+    }
+    codegen_c99_identifier(var_id->value.symbol, code);
+    fwrite_bytes(" = ", code);
+    if (value->type == NodeType::NONE)
+        fwrite_bytes("0", code);
+    else if ((err = codegen_c99_expression(state, value, code)).type != ErrorType::NONE)
+        return err;
+    return fwrite_line(";", code);
+}
+
+static Error codegen_c99_statements(CodegenC99State *state, Node *statement, bool returns, std::ostream &code);
+
+static Error codegen_c99_statement(CodegenC99State *state, Node *statement, std::ostream &code) {
+    Error err = ok;
+    switch (statement->type) {
+        default:
+            break;
+        case NodeType::FUNCTION:
+            // Top-level definitions are emitted once, from the functions environment.
+            if (!state->function)
+                return ok;
+            err.prepareError(ErrorType::TODO, "codegen: C99 output does not support nested functions");
+            return err;
+        case NodeType::NONE:
+        case NodeType::INTEGER:
+        case NodeType::SYMBOL:
+            // No effect.
+            return ok;
+        case NodeType::VARIABLE_DECLARATION: {
+            Node *initializer = statement->children->next_child;
+            if (!state->function) {
+                // Globals are defined at file scope; only computed initial values are stored here.
+                if (codegen_initializer_is_constant(initializer))
+                    return ok;
+                return codegen_c99_store(state, statement->children, initializer, nullptr, code);
+            }
+            Node type_info;
+            err = codegen_c99_variable_type(state, statement->children, &type_info);
+            if (err.type != ErrorType::NONE)
+                return err;
+            if (typeIsRecord(&type_info)) {
+                // Records start out zeroed, like globals do.
+                codegen_c99_indent(state, code);
+                fwrite_bytes(codegen_c99_type(&type_info).c_str(), code);
+                fwrite_bytes(" ", code);
+                codegen_c99_identifier(statement->children->value.symbol, code);
+                return fwrite_line(" = {0};", code);
+            }
+            return codegen_c99_store(state, statement->children, initializer, codegen_c99_type(&type_info).c_str(), code);
+        }
+        case NodeType::VARIABLE_REASSIGNMENT:
+            return codegen_c99_store(state, statement->children, statement->children->next_child, nullptr, code);
+        case NodeType::WHILE: {
+            Node *condition = statement->children;
+            Node *body = condition->next_child;
+            Node *preheader = body->next_child;
+            codegen_c99_indent(state, code);
+            fwrite_bytes(preheader->children ? "if (" : "while (", code);
+            err = codegen_c99_expression(state, condition, code);
+            if (err.type != ErrorType::NONE)
+                return err;
+            fwrite_line(") {", code);
+            state->indent += 1;
+            if (preheader->children) {
+                // Hoisted code runs once, after the condition was first found true.
+                err = codegen_c99_statements(state, preheader->children, false, code);
+                if (err.type != ErrorType::NONE)
+                    return err;
+                codegen_c99_indent(state, code);
+                fwrite_line("do {", code);
+                state->indent += 1;
+            }
+            err = codegen_c99_statements(state, body->children, false, code);
+            if (err.type != ErrorType::NONE)
+                return err;
+            if (preheader->children) {
+                state->indent -= 1;
+                codegen_c99_indent(state, code);
+                fwrite_bytes("} while (", code);
+                err = codegen_c99_expression(state, condition, code);
+                if (err.type != ErrorType::NONE)
+                    return err;
+                fwrite_line(");", code);
+            }
+            state->indent -= 1;
+            codegen_c99_indent(state, code);
+            return fwrite_line("}", code);
+        }
+    }
+    codegen_c99_indent(state, code);
+    if (statement->type != NodeType::FUNCTION_CALL)
+        fwrite_bytes("(void)", code);
+    err = codegen_c99_expression(state, statement, code);
+    if (err.type != ErrorType::NONE)
+        return err;
+    return fwrite_line(";", code);
+}
+
+/// Whether a statement leaves a value behind, which a function returns if it comes last.
+static bool codegen_c99_has_value(Node *statement) {
+    switch (statement->type) {
+        default:
+            return false;
+        case NodeType::INTEGER:
+        case NodeType::SYMBOL:
+        case NodeType::BINARY_OPERATOR:
+        case NodeType::FUNCTION_CALL:
+            return true;
+    }
+}
+
+/**
+ * @param returns Return the value of the last statement. The native backend
+ *                leaves whatever is in RAX when it has none; C returns 0.
+ */
+static Error codegen_c99_statements(CodegenC99State *state, Node *statement, bool returns, std::ostream &code) {
+    Error err = ok;
+    for (; statement; statement = statement->next_child) {
+        if (returns && !statement->next_child && codegen_c99_has_value(statement)) {
+            codegen_c99_indent(state, code);
+            fwrite_bytes("return ", code);
+            err = codegen_c99_expression(state, statement, code);
+            if (err.type != ErrorType::NONE)
+                return err;
+            return fwrite_line(";", code);
+        }
+        err = codegen_c99_statement(state, statement, code);
+        if (err.type != ErrorType::NONE)
+            return err;
+    }
+    if (returns) {
+        codegen_c99_indent(state, code);
+        return fwrite_line("return 0;", code);
+    }
+    return ok;
+}
+
+/// `static int64_t name(type parameter, ...)`. Results are not narrowed to the return type, as in RAX.
+static Error codegen_c99_function_signature(CodegenC99State *state, const char *name, Node *function, std::ostream &code) {
+    fwrite_bytes("static int64_t ", code);
+    codegen_c99_identifier(name, code);
+    fwrite_bytes("(", code);
+    if (!function->children->children)
+        fwrite_bytes("void", code);
+    for (Node *parameter = function->children->children; parameter; parameter = parameter->next_child) {
+        Node type_info;
+        if (parseGetType(state->context, parameter->children->next_child, &type_info).type != ErrorType::NONE) {
+            Error err = ok;
+            err.prepareError(ErrorType::TYPE, std::string("codegen: Unknown type of parameter ")
+                             + parameter->children->value.symbol);
+            return err;
+        }
+        fwrite_bytes(codegen_c99_type(&type_info).c_str(), code);
+        fwrite_bytes(" ", code);
+        codegen_c99_identifier(parameter->children->value.symbol, code);
+        if (parameter->next_child)
+            fwrite_bytes(", ", code);
+    }
+    return fwrite_bytes(")", code);
+}
+
+/// Helpers that compute in 64 bits and wrap around, which signed arithmetic in C may not.
+static const char *codegen_c99_prelude =
+    "#include <stdint.h>\n"
+    "\n"
+    "static inline int64_t func_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }\n"
+    "static inline int64_t func_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }\n"
+    "static inline int64_t func_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }\n"
+    "static inline int64_t func_lt(int64_t a, int64_t b) { return a < b; }\n";
+
+/**
+ * Emit the program as C99: globals at file scope with their constant
+ * initial values, every function, and `main` running the top-level
+ * expressions in order. Values behave as in the native backend: variables
+ * hold their declared type, everything else is 64-bit and wraps around.
+ */
+Error codegen_program_c99(ParsingContext *context, Node *program, std::ostream &code) {
+    Error err = ok;
+    CodegenC99State state;
+    state.context = context;
+    state.function = nullptr;
+    state.indent = 0;
+
+    fwrite_bytes("/* ", code);
+    fwrite_bytes(codegen_header, code);
+    fwrite_line(" */", code);
+    fwrite_line(codegen_c99_prelude, code);
+    err = codegen_c99_records(context, code);
+    if (err.type != ErrorType::NONE)
+        return err;
+
+    {
+        TimingScope timing("codegen data section");
+        for (Node *it = program->children; it; it = it->next_child) {
+            if (it->type != NodeType::VARIABLE_DECLARATION)
+                continue;
+            Node type_info;
+            err = codegen_global_type_x86_64_att_asm(context, it->children, &type_info);
+            if (err.type != ErrorType::NONE)
+                return err;
+            Node *initializer = it->children->next_child;
+            fwrite_bytes("static ", code);
+            fwrite_bytes(codegen_c99_type(&type_info).c_str(), code);
+            fwrite_bytes(" ", code);
+            codegen_c99_identifier(it->children->value.symbol, code);
+            if (initializer->type == NodeType::INTEGER) {
+                if (!typeContains(&type_info, initializer)) {
+                    err.prepareError(ErrorType::TYPE, std::string("codegen: Integer literal out of range of the type of ")
+                                     + it->children->value.symbol);
+                    return err;
+                }
+                fwrite_bytes(" = ", code);
+                codegen_c99_integer(initializer->value.integer, code);
+            }
+            fwrite_line(";", code);
+        }
+    }
+
+    if (context->functions->bind)
+        fwrite_line("", code);
+    for (Binding *function = context->functions->bind; function; function = function->next) {
+        err = codegen_c99_function_signature(&state, function->id->value.symbol, function->value, code);
+        if (err.type != ErrorType::NONE)
+            return err;
+        fwrite_line(";", code);
+    }
+    for (Binding *function = context->functions->bind; function; function = function->next) {
+        TimingScope timing("codegen function");
+        fwrite_line("", code);
+        err = codegen_c99_function_signature(&state, function->id->value.symbol, function->value, code);
+        if (err.type != ErrorType::NONE)
+            return err;
+        fwrite_line(" {", code);
+        state.function = function->value;
+        state.indent = 1;
+        err = codegen_c99_statements(&state, function->value->children->next_child->next_child->children, true, code);
+        if (err.type != ErrorType::NONE)
+            return err;
+        fwrite_line("}", code);
+    }
+
+    TimingScope timing("codegen main");
+    state.function = nullptr;
+    state.indent = 1;
+    fwrite_line("", code);
+    fwrite_line("int main(void) {", code);
+    err = codegen_c99_statements(&state, program->children, false, code);
+    if (err.type != ErrorType::NONE)
+        return err;
+    fwrite_line("    return 0;", code);
+    return fwrite_line("}", code);
+}
+
+//================================================================ END C99
+
+Error codegen_program_output(CodegenOutputFormat format, ParsingContext *context, Node *program, std::ostream &code,
+                             const CodegenOptions &options) {
     Error err = ok;
     if(!context){
-        err.createError(ErrorType::ARGUMENTS, "codegen_program() must be passed a non-NULL context.");
+        err.prepareError(ErrorType::ARGUMENTS, "codegen_program() must be passed a non-NULL context.");
+        return err;
+    }
+    if(!program || program->type != NodeType::PROGRAM){
+        err.prepareError(ErrorType::ARGUMENTS, "codegen_program() requires a program!");
         return err;
     }
     switch(format){
         case CodegenOutputFormat::DEFAULT:
         case CodegenOutputFormat::x86_64_AT_T_ASM:
-            return codegen_program_x86_64_att_asm_mswin(context, program);
+            return codegen_program_x86_64_att_asm_mswin(context, program, options, false, code);
+        case CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED:
+            return codegen_program_x86_64_att_asm_mswin(context, program, options, true, code);
+        case CodegenOutputFormat::C99:
+            return codegen_program_c99(context, program, code);
+    }
+    return ok;
+}
+
+Error codegen_program_file(CodegenOutputFormat format, ParsingContext *context, Node *program, const char *path,
+                           const CodegenOptions &options) {
+    Error err = ok;
+    std::ofstream code(path, std::ios::binary);
+    if (!code.is_open()) {
+        err.prepareError(ErrorType::GENERIC, std::string("codegen_program() could not open code file ") + path);
+        return err;
+    }
+    err = codegen_program_output(format, context, program, code, options);
+    if (err.type != ErrorType::NONE)
+        return err;
+    {
+        TimingScope timing("write code.S");
+        code.close();
+    }
+    if (!code) {
+        err.prepareError(ErrorType::GENERIC, std::string("codegen_program() could not write code file ") + path);
+        return err;
+    }
+    return ok;
+}
+
+const char *codegen_output_path(CodegenOutputFormat format) {
+    return format == CodegenOutputFormat::C99 ? "code.c" : "code.S";
+}
+
+Error codegen_program(CodegenOutputFormat format, ParsingContext *context, Node *program, const CodegenOptions &options) {
+    return codegen_program_file(format, context, program, codegen_output_path(format), options);
+}
+
+Error codegen_stream_begin(CodegenStream *stream, CodegenOutputFormat format, ParsingContext *context) {
+    Error err = ok;
+    if(!stream || !context){
+        err.prepareError(ErrorType::ARGUMENTS, "codegen_stream_begin() must be passed a non-NULL stream and context.");
+        return err;
+    }
+    stream->format = format;
+    stream->context = context;
+    switch(stream->format){
+        case CodegenOutputFormat::DEFAULT:
+        case CodegenOutputFormat::x86_64_AT_T_ASM:
+            return codegen_stream_begin_x86_64_att_asm_mswin(stream);
+        case CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED:
+            err.prepareError(ErrorType::TODO, "codegen_stream_begin(): Instrumentation needs every function up front; compile without streaming");
+            return err;
+        case CodegenOutputFormat::C99:
+            err.prepareError(ErrorType::TODO, "codegen_stream_begin(): C99 output needs the whole program; compile without streaming");
+            return err;
+    }
+    return ok;
+}
+
+Error codegen_stream_expression(CodegenStream *stream, Node *expression) {
+    switch(stream->format){
+        case CodegenOutputFormat::DEFAULT:
+        case CodegenOutputFormat::x86_64_AT_T_ASM:
+            return codegen_stream_expression_x86_64_att_asm_mswin(stream, expression);
+        case CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED:
+        case CodegenOutputFormat::C99:
+            break;
+    }
+    return ok;
+}
+
+Error codegen_stream_end(CodegenStream *stream) {
+    switch(stream->format){
+        case CodegenOutputFormat::DEFAULT:
+        case CodegenOutputFormat::x86_64_AT_T_ASM:
+            return codegen_stream_end_x86_64_att_asm_mswin(stream);
+        case CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED:
+        case CodegenOutputFormat::C99:
+            break;
     }
     return ok;
 }
@@ -1,14 +1,58 @@
 #ifndef COMPILER_CODEGEN_H
 #define COMPILER_CODEGEN_H
 
+#include <fstream>
+#include <ostream>
+
 #include "error.h"
+#include "frame_layout.h"
 #include "parser.h"
+#include "profile.h"
 
 enum class CodegenOutputFormat {
     DEFAULT = 0,
     x86_64_AT_T_ASM,
+    /// x86_64_AT_T_ASM that counts calls to every function and writes the
+    /// counts to CodegenOptions::profile_path when the program exits.
+    x86_64_AT_T_ASM_INSTRUMENTED,
+    /// Portable C for an optimizing C compiler; `main` runs the top-level expressions.
+    C99,
+};
+
+struct CodegenOptions {
+    /// Lay out hot functions first, together, with aligned entries; may be NULL.
+    const Profile *profile;
+    /// Where an instrumented program writes its profile, relative to its working directory.
+    const char *profile_path;
+
+    CodegenOptions():
+        profile(nullptr),
+        profile_path(PROFILE_DEFAULT_PATH)
+    {}
+};
+
+/// Where codegen_program() writes: "code.S", or "code.c" for C99.
+const char *codegen_output_path(CodegenOutputFormat format);
+/// Write the program to codegen_output_path() in the current directory.
+Error codegen_program(CodegenOutputFormat format, ParsingContext *context, Node *program,
+                      const CodegenOptions &options = CodegenOptions());
+Error codegen_program_file(CodegenOutputFormat format, ParsingContext *context, Node *program, const char *path,
+                           const CodegenOptions &options = CodegenOptions());
+Error codegen_program_output(CodegenOutputFormat format, ParsingContext *context, Node *program, std::ostream &code,
+                             const CodegenOptions &options = CodegenOptions());
+
+/// Output state for emitting a program one top-level expression at a time.
+struct CodegenStream {
+    CodegenOutputFormat format;
+    ParsingContext *context;
+    std::ofstream code;
+    /// Accumulated over every top-level expression, which all run in _start.
+    FrameLayout start_frame;
 };
 
-Error codegen_program(CodegenOutputFormat format, ParsingContext *context, Node *program);
+Error codegen_stream_begin(CodegenStream *stream, CodegenOutputFormat format, ParsingContext *context);
+/// `expression` may be freed once this returns, unless it is a function definition.
+Error codegen_stream_expression(CodegenStream *stream, Node *expression);
+Error codegen_stream_end(CodegenStream *stream);
 
 #endif /* COMPILER_CODEGEN_H */
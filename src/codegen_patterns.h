@@ -0,0 +1,150 @@
+#ifndef COMPILER_CODEGEN_PATTERNS_H
+#define COMPILER_CODEGEN_PATTERNS_H
+
+#include <cstddef>
+
+/**
+ * Instruction selection for x86_64 is driven by the pattern table below.
+ * Each operation computes into a destination register from one operand,
+ * and every operand is classified by all the forms it can take: a literal
+ * may be zero, a power of two and a 32-bit immediate at once, a 64-bit
+ * variable is a memory operand, and anything can be loaded into a scratch
+ * register. The selector picks the cheapest pattern among the classes the
+ * operand belongs to, or loads the operand into a register first when that
+ * is cheaper. Supporting a new operator takes a CodegenOperation and its
+ * rows; the static_asserts check that the table stays complete.
+ *
+ * Instructions are AT&T templates: `%o` is the operand (`$5`, `x(%rip)`,
+ * `8(%rsp)` or `%rcx`; `$<log2>` for IMMEDIATE_POWER_OF_TWO), `%d` the
+ * 64-bit destination register and `%e` its 32-bit part. An empty template
+ * leaves the destination unchanged.
+ */
+
+enum class CodegenOperation {
+    /// Set the destination to the operand, extended to 64 bits.
+    LOAD,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    /// Compare the destination with the operand; the caller uses the flags.
+    LESS,
+    COUNT,
+};
+
+enum class CodegenOperandClass {
+    /// In a register, or loaded into one.
+    REGISTER,
+    IMMEDIATE_ZERO,
+    IMMEDIATE_ONE,
+    IMMEDIATE_MINUS_ONE,
+    IMMEDIATE_POWER_OF_TWO,
+    /// Zero-extends from 32 bits: `mov $n, %eax` is the shortest load.
+    IMMEDIATE_U32,
+    /// Sign-extends from 32 bits, like the immediates of ALU instructions.
+    IMMEDIATE_S32,
+    IMMEDIATE_S64,
+    /// Variables in memory, by width and signedness.
+    MEMORY_S8,
+    MEMORY_U8,
+    MEMORY_S16,
+    MEMORY_U16,
+    MEMORY_S32,
+    MEMORY_U32,
+    MEMORY_64,
+    COUNT,
+};
+
+struct CodegenPattern {
+    CodegenOperation operation;
+    CodegenOperandClass operand;
+    const char *instruction;
+    /// Encoded bytes, roughly; only compared between patterns.
+    unsigned cost;
+};
+
+constexpr CodegenPattern codegen_patterns_x86_64[] = {
+    {CodegenOperation::LOAD, CodegenOperandClass::REGISTER, "mov %o, %d", 3},
+    {CodegenOperation::LOAD, CodegenOperandClass::IMMEDIATE_ZERO, "xor %e, %e", 2},
+    {CodegenOperation::LOAD, CodegenOperandClass::IMMEDIATE_U32, "mov %o, %e", 5},
+    {CodegenOperation::LOAD, CodegenOperandClass::IMMEDIATE_S32, "mov %o, %d", 7},
+    {CodegenOperation::LOAD, CodegenOperandClass::IMMEDIATE_S64, "movabs %o, %d", 10},
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_S8, "movsbq %o, %d", 7},
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_U8, "movzbq %o, %d", 7},
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_S16, "movswq %o, %d", 7},
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_U16, "movzwq %o, %d", 7},
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_S32, "movslq %o, %d", 7},
+    // Writing a 32-bit register clears the upper half.
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_U32, "movl %o, %e", 6},
+    {CodegenOperation::LOAD, CodegenOperandClass::MEMORY_64, "mov %o, %d", 7},
+
+    {CodegenOperation::ADD, CodegenOperandClass::REGISTER, "add %o, %d", 3},
+    {CodegenOperation::ADD, CodegenOperandClass::IMMEDIATE_ZERO, "", 0},
+    {CodegenOperation::ADD, CodegenOperandClass::IMMEDIATE_S32, "add %o, %d", 4},
+    {CodegenOperation::ADD, CodegenOperandClass::MEMORY_64, "add %o, %d", 7},
+
+    {CodegenOperation::SUBTRACT, CodegenOperandClass::REGISTER, "sub %o, %d", 3},
+    {CodegenOperation::SUBTRACT, CodegenOperandClass::IMMEDIATE_ZERO, "", 0},
+    {CodegenOperation::SUBTRACT, CodegenOperandClass::IMMEDIATE_S32, "sub %o, %d", 4},
+    {CodegenOperation::SUBTRACT, CodegenOperandClass::MEMORY_64, "sub %o, %d", 7},
+
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::REGISTER, "imul %o, %d", 4},
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::IMMEDIATE_ZERO, "xor %e, %e", 2},
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::IMMEDIATE_ONE, "", 0},
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::IMMEDIATE_MINUS_ONE, "neg %d", 3},
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::IMMEDIATE_POWER_OF_TWO, "shl %o, %d", 4},
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::IMMEDIATE_S32, "imul %o, %d", 7},
+    {CodegenOperation::MULTIPLY, CodegenOperandClass::MEMORY_64, "imul %o, %d", 8},
+
+    // `test` sets the sign flag and clears overflow, so `jl` and `setl` still work.
+    {CodegenOperation::LESS, CodegenOperandClass::REGISTER, "cmp %o, %d", 3},
+    {CodegenOperation::LESS, CodegenOperandClass::IMMEDIATE_ZERO, "test %d, %d", 3},
+    {CodegenOperation::LESS, CodegenOperandClass::IMMEDIATE_S32, "cmp %o, %d", 4},
+    {CodegenOperation::LESS, CodegenOperandClass::MEMORY_64, "cmp %o, %d", 7},
+};
+
+constexpr size_t CODEGEN_OPERATION_COUNT = static_cast<size_t>(CodegenOperation::COUNT);
+constexpr size_t CODEGEN_OPERAND_CLASS_COUNT = static_cast<size_t>(CodegenOperandClass::COUNT);
+
+/// The cheapest pattern of every operation for every operand class, or -1.
+struct CodegenPatternIndex {
+    int best[CODEGEN_OPERATION_COUNT][CODEGEN_OPERAND_CLASS_COUNT];
+};
+
+template <size_t N>
+constexpr CodegenPatternIndex codegen_pattern_index(const CodegenPattern (&patterns)[N]) {
+    CodegenPatternIndex index = {};
+    for (size_t operation = 0; operation < CODEGEN_OPERATION_COUNT; operation++)
+        for (size_t operand = 0; operand < CODEGEN_OPERAND_CLASS_COUNT; operand++)
+            index.best[operation][operand] = -1;
+    for (size_t i = 0; i < N; i++) {
+        int &best = index.best[static_cast<size_t>(patterns[i].operation)][static_cast<size_t>(patterns[i].operand)];
+        if (best < 0 || patterns[i].cost < patterns[best].cost)
+            best = static_cast<int>(i);
+    }
+    return index;
+}
+
+constexpr CodegenPatternIndex codegen_pattern_index_x86_64 = codegen_pattern_index(codegen_patterns_x86_64);
+
+/// Every operand can be loaded, and every operation takes a register, so selection always succeeds.
+constexpr bool codegen_patterns_complete(const CodegenPatternIndex &index) {
+    for (size_t operation = 0; operation < CODEGEN_OPERATION_COUNT; operation++)
+        if (index.best[operation][static_cast<size_t>(CodegenOperandClass::REGISTER)] < 0)
+            return false;
+    // Every operand belongs to one of these, whatever other classes it is in.
+    const CodegenOperandClass loadable[] = {
+        CodegenOperandClass::IMMEDIATE_S64, CodegenOperandClass::MEMORY_S8, CodegenOperandClass::MEMORY_U8,
+        CodegenOperandClass::MEMORY_S16, CodegenOperandClass::MEMORY_U16, CodegenOperandClass::MEMORY_S32,
+        CodegenOperandClass::MEMORY_U32, CodegenOperandClass::MEMORY_64,
+    };
+    for (CodegenOperandClass operand : loadable)
+        if (index.best[static_cast<size_t>(CodegenOperation::LOAD)][static_cast<size_t>(operand)] < 0)
+            return false;
+    return true;
+}
+
+static_assert(codegen_patterns_complete(codegen_pattern_index_x86_64),
+              "codegen_patterns_x86_64 must load every operand and give every operation a register form");
+static_assert(CODEGEN_OPERAND_CLASS_COUNT <= 32, "Operand classes are kept in a 32-bit mask");
+
+#endif /* COMPILER_CODEGEN_PATTERNS_H */
@@ -0,0 +1,241 @@
+#include "compile_server.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+/// Parse the arguments of a `compile` request and run it.
+static std::string compileServerCompile(Compiler *compiler, std::istringstream &request) {
+    CompileOptions options;
+    std::vector<std::string> paths;
+    std::string word;
+    while (request >> word) {
+        if (word == "--emit-c") {
+            options.format = CodegenOutputFormat::C99;
+        } else if (word == "-O0" || word == "-O1" || word == "-O2") {
+            options.optimization_level = word[2] - '0';
+        } else if (word == "--lazy-parse") {
+            options.lazy_parse = true;
+        } else if (word == "--const-eval") {
+            options.evaluate_calls = true;
+        } else if (word == "--inline") {
+            options.inline_functions = true;
+        } else if (word == "--inline-threshold" && request >> word) {
+            options.inline_functions = true;
+            options.inline_options.max_body_nodes = std::strtoull(word.c_str(), nullptr, 10);
+        } else if (word == "--inline-depth" && request >> word) {
+            options.inline_functions = true;
+            options.inline_options.max_depth = std::strtoull(word.c_str(), nullptr, 10);
+        } else if (word == "--optimize-loops") {
+            options.optimize_loops = true;
+        } else if (word[0] == '-') {
+            return "error unknown option " + word;
+        } else {
+            paths.push_back(word);
+        }
+    }
+    if (paths.size() != 2)
+        return "error expected: compile [options] <source> <output>";
+
+    bool cached = false;
+    Error err = compilerCompileFile(compiler, paths[0].c_str(), paths[1].c_str(), options, &cached);
+    if (err.type != ErrorType::NONE)
+        return "error " + err.msg;
+    return cached ? "ok cached" : "ok";
+}
+
+/// Handle one request line; sets `shutdown` when the server should stop.
+static std::string compileServerHandle(Compiler *compiler, const std::string &line, bool *shutdown) {
+    std::istringstream request(line);
+    std::string command;
+    request >> command;
+    if (command == "compile")
+        return compileServerCompile(compiler, request);
+    if (command == "stats") {
+        std::ostringstream reply;
+        reply << "ok jobs " << compiler->stats.jobs
+              << " cache_hits " << compiler->stats.cache_hits
+              << " failures " << compiler->stats.failures;
+        return reply.str();
+    }
+    if (command == "shutdown") {
+        *shutdown = true;
+        return "ok";
+    }
+    return "error unknown request " + command;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/// A client that sends or takes nothing for this long is dropped, so it can't hold up the others.
+constexpr time_t COMPILE_SERVER_IDLE_SECONDS = 5;
+
+static bool compileServerAddress(const char *socket_path, sockaddr_un *address, Error &err) {
+    std::memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (std::strlen(socket_path) >= sizeof(address->sun_path)) {
+        err.prepareError(ErrorType::ARGUMENTS, std::string("compile server: socket path too long: ") + socket_path);
+        return false;
+    }
+    std::strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+static bool compileServerSend(int fd, const std::string &line) {
+    std::string data = line + '\n';
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count <= 0)
+            return false;
+        sent += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+/// Read up to the next newline; `buffer` keeps whatever was read past it.
+static bool compileServerReceive(int fd, std::string &buffer, std::string *line) {
+    size_t newline;
+    while ((newline = buffer.find('\n')) == std::string::npos) {
+        char chunk[4096];
+        ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+        if (count <= 0)
+            return false;
+        buffer.append(chunk, static_cast<size_t>(count));
+    }
+    *line = buffer.substr(0, newline);
+    buffer.erase(0, newline + 1);
+    return true;
+}
+
+/// Remove a socket file left behind by a previous server, which would make bind() fail.
+/// Anything else at `socket_path` is left alone and reported.
+static bool compileServerRemoveStale(const char *socket_path, Error &err) {
+    struct stat info;
+    if (lstat(socket_path, &info) != 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(info.st_mode)) {
+        err.prepareError(ErrorType::ARGUMENTS,
+                         std::string("compile server: not a socket, refusing to replace: ") + socket_path);
+        return false;
+    }
+    unlink(socket_path);
+    return true;
+}
+
+static void compileServerSetTimeouts(int fd) {
+    timeval timeout;
+    timeout.tv_sec = COMPILE_SERVER_IDLE_SECONDS;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+Error compileServerRun(Compiler *compiler, const char *socket_path) {
+    Error err = ok;
+    sockaddr_un address;
+    if (!compileServerAddress(socket_path, &address, err))
+        return err;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        err.prepareError(ErrorType::GENERIC, "compile server: could not create socket");
+        return err;
+    }
+    if (!compileServerRemoveStale(socket_path, err)) {
+        close(listener);
+        if (err.type == ErrorType::NONE)
+            err.prepareError(ErrorType::GENERIC, std::string("compile server: could not inspect ") + socket_path);
+        return err;
+    }
+    struct stat bound;
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || listen(listener, 16) != 0 || lstat(socket_path, &bound) != 0) {
+        close(listener);
+        err.prepareError(ErrorType::GENERIC, std::string("compile server: could not listen on ") + socket_path);
+        return err;
+    }
+    std::cout << "Serving compile jobs on " << socket_path << std::endl;
+
+    bool shutdown = false;
+    while (!shutdown) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        compileServerSetTimeouts(client);
+        std::string buffer;
+        std::string line;
+        while (!shutdown && compileServerReceive(client, buffer, &line)) {
+            if (!compileServerSend(client, compileServerHandle(compiler, line, &shutdown)))
+                break;
+        }
+        close(client);
+    }
+
+    close(listener);
+    // Only our own socket: the path may have been replaced while serving.
+    struct stat current;
+    if (lstat(socket_path, &current) == 0 && S_ISSOCK(current.st_mode)
+        && current.st_dev == bound.st_dev && current.st_ino == bound.st_ino)
+        unlink(socket_path);
+    return ok;
+}
+
+Error compileServerRequest(const char *socket_path, const std::string &request, std::string *reply) {
+    Error err = ok;
+    sockaddr_un address;
+    if (!compileServerAddress(socket_path, &address, err))
+        return err;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        if (fd >= 0)
+            close(fd);
+        err.prepareError(ErrorType::GENERIC, std::string("compile server: could not connect to ") + socket_path);
+        return err;
+    }
+    std::string buffer;
+    if (!compileServerSend(fd, request) || !compileServerReceive(fd, buffer, reply)) {
+        close(fd);
+        err.prepareError(ErrorType::GENERIC, "compile server: connection closed before a reply");
+        return err;
+    }
+    close(fd);
+    return ok;
+}
+
+#else
+
+Error compileServerRun(Compiler *compiler, const char *socket_path) {
+    (void)compiler;
+    (void)socket_path;
+    Error err = ok;
+    err.prepareError(ErrorType::TODO, "compile server: Unix domain sockets are not available on this platform");
+    return err;
+}
+
+Error compileServerRequest(const char *socket_path, const std::string &request, std::string *reply) {
+    (void)socket_path;
+    (void)request;
+    (void)reply;
+    Error err = ok;
+    err.prepareError(ErrorType::TODO, "compile server: Unix domain sockets are not available on this platform");
+    return err;
+}
+
+#endif
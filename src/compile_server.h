@@ -0,0 +1,30 @@
+#ifndef COMPILER_COMPILE_SERVER_H
+#define COMPILER_COMPILE_SERVER_H
+
+#include <string>
+
+#include "compiler.h"
+#include "error.h"
+
+/**
+ * Serve compile jobs on a Unix domain socket until a `shutdown` request.
+ * Requests and replies are single lines; one connection may send several:
+ *
+ *   compile [--emit-c] [-O0|-O1|-O2] [--lazy-parse] [--const-eval] [--inline] [--inline-threshold <n>] [--inline-depth <n>]
+ *           [--optimize-loops] <source> <output>
+ *       -> "ok", "ok cached" or "error <message>"
+ *   stats    -> "ok jobs <n> cache_hits <n> failures <n>"
+ *   shutdown -> "ok", then the server exits
+ *
+ * Paths are taken as-is (relative to the server's working directory) and
+ * may not contain whitespace. Jobs run one at a time on the warm compiler;
+ * a client that stays idle for a few seconds is disconnected so that the
+ * next one gets its turn. An existing file at `socket_path` is only
+ * replaced if it is a socket.
+ */
+Error compileServerRun(Compiler *compiler, const char *socket_path);
+
+/// Send one request line to a running server and wait for its reply line.
+Error compileServerRequest(const char *socket_path, const std::string &request, std::string *reply);
+
+#endif /* COMPILER_COMPILE_SERVER_H */
@@ -0,0 +1,160 @@
+#include "compiler.h"
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include "memory_stats.h"
+#include "pass_manager.h"
+#include "timing.h"
+
+Compiler *compilerCreate(size_t cache_capacity) {
+    Compiler *compiler = new Compiler;
+    compiler->context = parseContextDefaultCreate();
+    compiler->cache_next = 0;
+    compiler->cache_capacity = cache_capacity;
+    compiler->stats = {0, 0, 0};
+    return compiler;
+}
+
+void compilerDelete(Compiler *compiler) {
+    if (!compiler)
+        return;
+    parseContextReset(compiler->context);
+    parseContextDelete(compiler->context);
+    for (const CompileCacheEntry &entry : compiler->cache)
+        memoryFreed(MemoryCategory::CODEGEN, entry.source.size() + entry.output.size());
+    delete compiler;
+}
+
+static bool compileOptionsEqual(const CompileOptions &a, const CompileOptions &b) {
+    // Profiles are compared by identity: a job with a freshly read profile misses.
+    // Pass options are compared whether or not the pass is asked for by name, as the -O level may run it.
+    return a.format == b.format
+        && a.codegen.profile == b.codegen.profile
+        && std::strcmp(a.codegen.profile_path, b.codegen.profile_path) == 0
+        && a.inline_options.profile == b.inline_options.profile
+        && a.optimization_level == b.optimization_level
+        && a.lazy_parse == b.lazy_parse
+        && a.evaluate_calls == b.evaluate_calls
+        && a.const_eval_options.max_steps == b.const_eval_options.max_steps
+        && a.const_eval_options.max_depth == b.const_eval_options.max_depth
+        && a.inline_functions == b.inline_functions
+        && a.inline_options.max_body_nodes == b.inline_options.max_body_nodes
+        && a.inline_options.max_depth == b.inline_options.max_depth
+        && a.inline_options.remove_unused == b.inline_options.remove_unused
+        && a.optimize_loops == b.optimize_loops
+        && a.loop_options.hoist_invariants == b.loop_options.hoist_invariants
+        && a.loop_options.reduce_strength == b.loop_options.reduce_strength;
+}
+
+static CompileCacheEntry *compilerCacheFind(Compiler *compiler, size_t hash, const std::string &source,
+                                            const CompileOptions &options) {
+    for (CompileCacheEntry &entry : compiler->cache)
+        if (entry.hash == hash && compileOptionsEqual(entry.options, options) && entry.source == source)
+            return &entry;
+    return nullptr;
+}
+
+static void compilerCacheInsert(Compiler *compiler, size_t hash, const std::string &source,
+                                const CompileOptions &options, const std::string &output) {
+    if (!compiler->cache_capacity)
+        return;
+    CompileCacheEntry entry = {hash, source, options, output};
+    memoryAllocated(MemoryCategory::CODEGEN, source.size() + output.size());
+    if (compiler->cache.size() < compiler->cache_capacity) {
+        compiler->cache.push_back(entry);
+        return;
+    }
+    CompileCacheEntry &evicted = compiler->cache[compiler->cache_next];
+    memoryFreed(MemoryCategory::CODEGEN, evicted.source.size() + evicted.output.size());
+    evicted = entry;
+    compiler->cache_next = (compiler->cache_next + 1) % compiler->cache_capacity;
+}
+
+Error compilerCompileBuffer(Compiler *compiler, const char *source_bytes, size_t length, const CompileOptions &options,
+                            std::string *output, bool *cached) {
+    TimingScope timing("compile job");
+    Error err = ok;
+    if (!compiler || !output || (!source_bytes && length)) {
+        err.prepareError(ErrorType::ARGUMENTS, "compilerCompileBuffer(): compiler, source and output must not be NULL");
+        return err;
+    }
+    compiler->stats.jobs += 1;
+    if (cached)
+        *cached = false;
+
+    // The lexer relies on a terminating NUL, which the caller's buffer may lack.
+    std::string &source = compiler->source;
+    source.assign(source_bytes, length);
+    size_t hash = std::hash<std::string>()(source);
+    CompileCacheEntry *entry = compilerCacheFind(compiler, hash, source, options);
+    if (entry) {
+        compiler->stats.cache_hits += 1;
+        output->append(entry->output);
+        if (cached)
+            *cached = true;
+        return ok;
+    }
+
+    ParsingContext *context = compiler->context;
+    Node *program = nodeAllocate();
+    std::ostringstream code;
+    context->defer_bodies = options.lazy_parse;
+    err = parseProgramBuffer(&source[0], context, program);
+    if (err.type == ErrorType::NONE) {
+        std::vector<const Pass *> pipeline;
+        err = passPipelineBuild(options, &pipeline);
+        if (err.type == ErrorType::NONE)
+            err = passPipelineRun(pipeline, context, program, options, PassRunOptions(), nullptr, code);
+    }
+    if (err.type == ErrorType::NONE)
+        err = codegen_program_output(options.format, context, program, code, options.codegen);
+    parseContextReset(context);
+    deleteNode(program);
+    if (err.type != ErrorType::NONE) {
+        compiler->stats.failures += 1;
+        return err;
+    }
+
+    std::string generated = code.str();
+    // Accounts for the stream's buffer; the copy above is freed with it.
+    memoryAllocated(MemoryCategory::CODEGEN, generated.size());
+    compilerCacheInsert(compiler, hash, source, options, generated);
+    output->append(generated);
+    memoryFreed(MemoryCategory::CODEGEN, generated.size());
+    return ok;
+}
+
+Error compilerCompile(Compiler *compiler, const std::string &source, const CompileOptions &options,
+                      std::string *output, bool *cached) {
+    return compilerCompileBuffer(compiler, source.data(), source.size(), options, output, cached);
+}
+
+Error compilerCompileFile(Compiler *compiler, const char *source_path, const char *output_path,
+                          const CompileOptions &options, bool *cached) {
+    Error err = ok;
+    std::ifstream source_file(source_path, std::ios::binary);
+    if (!source_file.is_open()) {
+        err.prepareError(ErrorType::GENERIC, std::string("compilerCompileFile(): Could not open ") + source_path);
+        return err;
+    }
+    std::ostringstream source;
+    source << source_file.rdbuf();
+    std::string contents = source.str();
+
+    std::string output;
+    err = compilerCompileBuffer(compiler, contents.data(), contents.size(), options, &output, cached);
+    if (err.type != ErrorType::NONE)
+        return err;
+
+    std::ofstream code(output_path, std::ios::binary);
+    code << output;
+    code.close();
+    if (!code) {
+        err.prepareError(ErrorType::GENERIC, std::string("compilerCompileFile(): Could not write ") + output_path);
+        return err;
+    }
+    return ok;
+}
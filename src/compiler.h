@@ -0,0 +1,86 @@
+#ifndef COMPILER_COMPILER_H
+#define COMPILER_COMPILER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "codegen.h"
+#include "const_eval.h"
+#include "error.h"
+#include "inline.h"
+#include "loop_optimize.h"
+#include "parser.h"
+
+/// Everything that changes the output of one compile job.
+struct CompileOptions {
+    CodegenOutputFormat format;
+    /// -O level; passes it includes run whether or not they are asked for by name.
+    int optimization_level;
+    /// Parse only the function bodies the program can call (see parseProgramBuffer()).
+    bool lazy_parse;
+    bool evaluate_calls;
+    ConstEvalOptions const_eval_options;
+    bool inline_functions;
+    InlineOptions inline_options;
+    bool optimize_loops;
+    LoopOptions loop_options;
+    CodegenOptions codegen;
+
+    CompileOptions():
+        format(CodegenOutputFormat::DEFAULT),
+        optimization_level(0),
+        lazy_parse(false),
+        evaluate_calls(false),
+        inline_functions(false),
+        optimize_loops(false)
+    {}
+};
+
+struct CompileCacheEntry {
+    size_t hash;
+    std::string source;
+    CompileOptions options;
+    std::string output;
+};
+
+struct CompilerStats {
+    size_t jobs;
+    size_t cache_hits;
+    size_t failures;
+};
+
+/**
+ * State kept warm between compile jobs: the root context with the built-in
+ * types (and the scope frames and bindings it has grown), and the output of
+ * recent jobs keyed by source text and options.
+ */
+struct Compiler {
+    ParsingContext *context;
+    std::vector<CompileCacheEntry> cache;
+    /// Oldest entry, overwritten next once the cache is full.
+    size_t cache_next;
+    size_t cache_capacity;
+    CompilerStats stats;
+    /// NUL-terminated copy of the job's source, reused across jobs.
+    std::string source;
+};
+
+Compiler *compilerCreate(size_t cache_capacity = 64);
+void compilerDelete(Compiler *compiler);
+
+/**
+ * Compile `length` bytes of source text and append the generated code to
+ * `output`. Touches no files; `source` need not be NUL-terminated and may
+ * be reused as soon as this returns.
+ * @param cached Set to whether the output came from the cache; may be NULL.
+ */
+Error compilerCompileBuffer(Compiler *compiler, const char *source, size_t length, const CompileOptions &options,
+                            std::string *output, bool *cached);
+Error compilerCompile(Compiler *compiler, const std::string &source, const CompileOptions &options,
+                      std::string *output, bool *cached);
+/// Compile the file at `source_path` and write the generated code to `output_path`.
+Error compilerCompileFile(Compiler *compiler, const char *source_path, const char *output_path,
+                          const CompileOptions &options, bool *cached);
+
+#endif /* COMPILER_COMPILER_H */
@@ -0,0 +1,460 @@
+#include "const_eval.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "environment.h"
+#include "node_walk.h"
+#include "record_layout.h"
+#include "timing.h"
+
+enum class ConstEvalResult {
+    VALUE,
+    /// A statement ran that leaves no value behind.
+    NO_VALUE,
+    STEP_LIMIT,
+    DEPTH_LIMIT,
+    UNSUPPORTED,
+};
+
+struct ConstEvalVariable {
+    const char *name;
+    long long value;
+    Node type_info;
+};
+
+struct ConstEvalState {
+    /// The root context, where functions, globals and types live.
+    ParsingContext *context;
+    const ConstEvalOptions *options;
+    ConstEvalStats *stats;
+    std::unordered_map<std::string, Node *> functions;
+    std::unordered_set<std::string> pure;
+    /// The function whose body is being folded, or NULL at the top level.
+    Node *function;
+    size_t steps;
+    size_t depth;
+};
+
+/// What a function body reads and calls, as far as purity is concerned.
+struct ConstEvalUses {
+    std::unordered_set<std::string> locals;
+    std::vector<std::string> callees;
+    bool reads_other;
+    bool has_functions;
+
+    ConstEvalUses():
+        reads_other(false),
+        has_functions(false)
+    {}
+};
+
+static WalkAction constEvalUsesVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    ConstEvalUses *uses = static_cast<ConstEvalUses *>(data);
+    switch (node->type) {
+        default:
+            return WalkAction::CONTINUE;
+        case NodeType::FUNCTION:
+            uses->has_functions = true;
+            return WalkAction::STOP;
+        case NodeType::FUNCTION_CALL:
+            uses->callees.push_back(node->children->value.symbol);
+            return WalkAction::CONTINUE;
+        case NodeType::SYMBOL:
+            break;
+    }
+    // Names of assigned variables, callees, operators and types are not reads.
+    if (parent && node == parent->children) {
+        switch (parent->type) {
+            default:
+                break;
+            case NodeType::VARIABLE_REASSIGNMENT:
+            case NodeType::FUNCTION_CALL:
+            case NodeType::BINARY_OPERATOR:
+            case NodeType::VARIABLE_DECLARATION:
+                return WalkAction::SKIP_CHILDREN;
+        }
+    }
+    if (parent && parent->type == NodeType::VARIABLE_DECLARATION && node != parent->children->next_child)
+        return WalkAction::SKIP_CHILDREN;
+    if (!uses->locals.count(node->value.symbol))
+        uses->reads_other = true;
+    return WalkAction::SKIP_CHILDREN;
+}
+
+/**
+ * Find the pure functions: assume every function is, then drop the ones
+ * that read something other than their parameters and locals, define a
+ * function, or call a function that is not pure, until nothing changes.
+ */
+static void constEvalFindPure(ConstEvalState *state) {
+    std::unordered_map<std::string, std::vector<std::string>> callees;
+    for (auto &function : state->functions) {
+        ConstEvalUses uses;
+        for (Node *parameter = function.second->children->children; parameter; parameter = parameter->next_child)
+            uses.locals.insert(parameter->children->value.symbol);
+        Node *body = function.second->children->next_child->next_child;
+        for (Node *expression = body->children; expression; expression = expression->next_child)
+            if (expression->type == NodeType::VARIABLE_DECLARATION)
+                uses.locals.insert(expression->children->value.symbol);
+        nodeWalk(body, {constEvalUsesVisit, nullptr, &uses});
+        if (uses.reads_other || uses.has_functions)
+            continue;
+        state->pure.insert(function.first);
+        callees[function.first] = std::move(uses.callees);
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &function : callees) {
+            if (!state->pure.count(function.first))
+                continue;
+            for (const std::string &callee : function.second) {
+                if (state->pure.count(callee))
+                    continue;
+                state->pure.erase(function.first);
+                changed = true;
+                break;
+            }
+        }
+    }
+}
+
+/// Truncate `value` to the type and extend it back to 64 bits, like a store followed by a load.
+static long long constEvalTruncate(const Node *type_info, long long value) {
+    long long size = typeSize(type_info);
+    if (size >= 8)
+        return value;
+    unsigned long long mask = (1ull << (size * 8)) - 1;
+    unsigned long long bits = static_cast<unsigned long long>(value) & mask;
+    if (typeIsSigned(type_info) && (bits >> (size * 8 - 1)))
+        bits |= ~mask;
+    return static_cast<long long>(bits);
+}
+
+static ConstEvalVariable *constEvalFind(std::vector<ConstEvalVariable> &variables, const char *name) {
+    for (size_t i = variables.size(); i--;)
+        if (strcmp(variables[i].name, name) == 0)
+            return &variables[i];
+    return nullptr;
+}
+
+static ConstEvalResult constEvalNode(ConstEvalState *state, std::vector<ConstEvalVariable> &variables, Node *node,
+                                     long long *value);
+
+/// Run a statement list; `value` is that of the last statement, if it has one.
+static ConstEvalResult constEvalList(ConstEvalState *state, std::vector<ConstEvalVariable> &variables, Node *statement,
+                                     long long *value) {
+    ConstEvalResult result = ConstEvalResult::NO_VALUE;
+    for (; statement; statement = statement->next_child) {
+        result = constEvalNode(state, variables, statement, value);
+        if (result != ConstEvalResult::VALUE && result != ConstEvalResult::NO_VALUE)
+            return result;
+    }
+    return result;
+}
+
+static ConstEvalResult constEvalCall(ConstEvalState *state, Node *function, const std::vector<long long> &arguments,
+                                     long long *value) {
+    if (state->depth >= state->options->max_depth)
+        return ConstEvalResult::DEPTH_LIMIT;
+    std::vector<ConstEvalVariable> variables;
+    Node *parameter = function->children->children;
+    for (long long argument : arguments) {
+        if (!parameter)
+            return ConstEvalResult::UNSUPPORTED;
+        ConstEvalVariable variable;
+        variable.name = parameter->children->value.symbol;
+        if (parseGetType(state->context, parameter->children->next_child, &variable.type_info).type != ErrorType::NONE)
+            return ConstEvalResult::UNSUPPORTED;
+        variable.value = constEvalTruncate(&variable.type_info, argument);
+        variables.push_back(variable);
+        parameter = parameter->next_child;
+    }
+    if (parameter)
+        return ConstEvalResult::UNSUPPORTED;
+
+    state->depth += 1;
+    ConstEvalResult result = constEvalList(state, variables, function->children->next_child->next_child->children, value);
+    state->depth -= 1;
+    // The caller would see whatever the last statement left in rax.
+    if (result == ConstEvalResult::NO_VALUE)
+        return ConstEvalResult::UNSUPPORTED;
+    return result;
+}
+
+/// Store into a variable the way the generated code does, rejecting literals it would reject.
+static ConstEvalResult constEvalStore(ConstEvalVariable *variable, Node *value_node, long long value) {
+    if (value_node->type == NodeType::INTEGER && !typeContains(&variable->type_info, value_node))
+        return ConstEvalResult::UNSUPPORTED;
+    variable->value = constEvalTruncate(&variable->type_info, value);
+    return ConstEvalResult::NO_VALUE;
+}
+
+static ConstEvalResult constEvalNode(ConstEvalState *state, std::vector<ConstEvalVariable> &variables, Node *node,
+                                     long long *value) {
+    if (++state->steps > state->options->max_steps)
+        return ConstEvalResult::STEP_LIMIT;
+    ConstEvalResult result = ConstEvalResult::UNSUPPORTED;
+    switch (node->type) {
+        default:
+            return ConstEvalResult::UNSUPPORTED;
+        case NodeType::INTEGER:
+            *value = node->value.integer;
+            return ConstEvalResult::VALUE;
+        case NodeType::SYMBOL: {
+            ConstEvalVariable *variable = constEvalFind(variables, node->value.symbol);
+            if (!variable)
+                return ConstEvalResult::UNSUPPORTED;
+            *value = variable->value;
+            return ConstEvalResult::VALUE;
+        }
+        case NodeType::BINARY_OPERATOR: {
+            long long left = 0;
+            long long right = 0;
+            if ((result = constEvalNode(state, variables, node->children->next_child, &left)) != ConstEvalResult::VALUE)
+                return result;
+            if ((result = constEvalNode(state, variables, node->children->next_child->next_child, &right))
+                != ConstEvalResult::VALUE)
+                return result;
+            // Unsigned arithmetic wraps around like the 64-bit instructions.
+            unsigned long long a = static_cast<unsigned long long>(left);
+            unsigned long long b = static_cast<unsigned long long>(right);
+            switch (node->children->value.symbol[0]) {
+                default:
+                    return ConstEvalResult::UNSUPPORTED;
+                case '+':
+                    *value = static_cast<long long>(a + b);
+                    break;
+                case '-':
+                    *value = static_cast<long long>(a - b);
+                    break;
+                case '*':
+                    *value = static_cast<long long>(a * b);
+                    break;
+                case '<':
+                    *value = left < right;
+                    break;
+            }
+            return ConstEvalResult::VALUE;
+        }
+        case NodeType::FUNCTION_CALL: {
+            auto function = state->functions.find(node->children->value.symbol);
+            if (function == state->functions.end())
+                return ConstEvalResult::UNSUPPORTED;
+            std::vector<long long> arguments;
+            for (Node *argument = node->children->next_child->children; argument; argument = argument->next_child) {
+                long long argument_value = 0;
+                if ((result = constEvalNode(state, variables, argument, &argument_value)) != ConstEvalResult::VALUE)
+                    return result;
+                arguments.push_back(argument_value);
+            }
+            return constEvalCall(state, function->second, arguments, value);
+        }
+        case NodeType::VARIABLE_DECLARATION: {
+            ConstEvalVariable variable;
+            variable.name = node->children->value.symbol;
+            variable.value = 0;
+            if (parseGetType(state->context, node->children->next_child->next_child, &variable.type_info).type
+                != ErrorType::NONE)
+                return ConstEvalResult::UNSUPPORTED;
+            Node *initializer = node->children->next_child;
+            long long initial = 0;
+            if (initializer->type != NodeType::NONE) {
+                if ((result = constEvalNode(state, variables, initializer, &initial)) != ConstEvalResult::VALUE)
+                    return result;
+                if ((result = constEvalStore(&variable, initializer, initial)) != ConstEvalResult::NO_VALUE)
+                    return result;
+            }
+            variables.push_back(variable);
+            return ConstEvalResult::NO_VALUE;
+        }
+        case NodeType::VARIABLE_REASSIGNMENT: {
+            ConstEvalVariable *variable = constEvalFind(variables, node->children->value.symbol);
+            if (!variable)
+                return ConstEvalResult::UNSUPPORTED;
+            long long assigned = 0;
+            if ((result = constEvalNode(state, variables, node->children->next_child, &assigned)) != ConstEvalResult::VALUE)
+                return result;
+            // Evaluating the value may have grown `variables`.
+            variable = constEvalFind(variables, node->children->value.symbol);
+            return constEvalStore(variable, node->children->next_child, assigned);
+        }
+        case NodeType::WHILE: {
+            // The loop is rotated: the preheader runs once, after the condition was first true.
+            Node *condition = node->children;
+            Node *body = condition->next_child;
+            long long test = 0;
+            if ((result = constEvalNode(state, variables, condition, &test)) != ConstEvalResult::VALUE)
+                return result;
+            if (!test)
+                return ConstEvalResult::NO_VALUE;
+            long long ignored = 0;
+            if ((result = constEvalList(state, variables, body->next_child->children, &ignored))
+                != ConstEvalResult::VALUE && result != ConstEvalResult::NO_VALUE)
+                return result;
+            do {
+                if ((result = constEvalList(state, variables, body->children, &ignored))
+                    != ConstEvalResult::VALUE && result != ConstEvalResult::NO_VALUE)
+                    return result;
+                if ((result = constEvalNode(state, variables, condition, &test)) != ConstEvalResult::VALUE)
+                    return result;
+            } while (test);
+            return ConstEvalResult::NO_VALUE;
+        }
+    }
+}
+
+/// Type symbol of a variable or record field visible where calls are folded, or NULL.
+static Node *constEvalVariableType(ConstEvalState *state, const char *name) {
+    // A record field, `p.x`: the type of the field in the type of `p`.
+    const char *dot = strchr(name, '.');
+    if (dot) {
+        Node *record_id = constEvalVariableType(state, std::string(name, dot).c_str());
+        Node record_info;
+        if (!record_id || parseGetType(state->context, record_id, &record_info).type != ErrorType::NONE)
+            return nullptr;
+        long long offset = 0;
+        Node field_info;
+        Node *field_id = nullptr;
+        if (recordFieldPath(state->context, &record_info, dot + 1, &offset, &field_info, &field_id).type != ErrorType::NONE)
+            return nullptr;
+        return field_id;
+    }
+    if (state->function) {
+        for (Node *parameter = state->function->children->children; parameter; parameter = parameter->next_child)
+            if (strcmp(parameter->children->value.symbol, name) == 0)
+                return parameter->children->next_child;
+        Node *body = state->function->children->next_child->next_child;
+        for (Node *expression = body->children; expression; expression = expression->next_child)
+            if (expression->type == NodeType::VARIABLE_DECLARATION && strcmp(expression->children->value.symbol, name) == 0)
+                return expression->children->next_child->next_child;
+    }
+    for (Binding *it = state->context->variables->bind; it; it = it->next)
+        if (strcmp(it->id->value.symbol, name) == 0)
+            return it->value;
+    return nullptr;
+}
+
+/// Type symbol of the variable a folded value is stored to, or NULL.
+static Node *constEvalTargetType(ConstEvalState *state, Node *assignment) {
+    if (assignment->type == NodeType::VARIABLE_DECLARATION)
+        return assignment->children->next_child->next_child;
+    return constEvalVariableType(state, assignment->children->value.symbol);
+}
+
+/// Replace `call` by its value if its callee is pure and its arguments are literals.
+static void constEvalFold(ConstEvalState *state, Node *call, Node *parent) {
+    state->stats->call_sites += 1;
+    auto function = state->functions.find(call->children->value.symbol);
+    if (function == state->functions.end() || !state->pure.count(function->first)) {
+        state->stats->impure += 1;
+        return;
+    }
+    std::vector<long long> arguments;
+    for (Node *argument = call->children->next_child->children; argument; argument = argument->next_child) {
+        if (argument->type != NodeType::INTEGER) {
+            state->stats->non_constant += 1;
+            return;
+        }
+        arguments.push_back(argument->value.integer);
+    }
+
+    long long value = 0;
+    state->steps = 0;
+    state->depth = 0;
+    switch (constEvalCall(state, function->second, arguments, &value)) {
+        default:
+            break;
+        case ConstEvalResult::STEP_LIMIT:
+            state->stats->step_limit += 1;
+            return;
+        case ConstEvalResult::DEPTH_LIMIT:
+            state->stats->depth_limit += 1;
+            return;
+        case ConstEvalResult::NO_VALUE:
+        case ConstEvalResult::UNSUPPORTED:
+            state->stats->unsupported += 1;
+            return;
+    }
+    // The call's result would be stored with truncation; a literal store is range checked instead.
+    if (parent && call != parent->children
+        && (parent->type == NodeType::VARIABLE_DECLARATION || parent->type == NodeType::VARIABLE_REASSIGNMENT)) {
+        Node *type_id = constEvalTargetType(state, parent);
+        Node type_info;
+        if (!type_id || parseGetType(state->context, type_id, &type_info).type != ErrorType::NONE) {
+            state->stats->unsupported += 1;
+            return;
+        }
+        value = constEvalTruncate(&type_info, value);
+    }
+
+    for (Node *child = call->children; child;) {
+        Node *next = child->next_child;
+        deleteNode(child);
+        child = next;
+    }
+    call->type = NodeType::INTEGER;
+    call->value.integer = value;
+    call->children = nullptr;
+    state->stats->evaluated += 1;
+}
+
+static WalkAction constEvalPre(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    (void)data;
+    // Definitions are folded through the function bindings; nested ones are left alone.
+    if (node->type == NodeType::FUNCTION)
+        return WalkAction::SKIP_CHILDREN;
+    return WalkAction::CONTINUE;
+}
+
+static WalkAction constEvalPost(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    if (node->type == NodeType::FUNCTION_CALL)
+        constEvalFold(static_cast<ConstEvalState *>(data), node, parent);
+    return WalkAction::CONTINUE;
+}
+
+Error constEvalProgram(ParsingContext *context, Node *program, const ConstEvalOptions &options, ConstEvalStats *stats) {
+    TimingScope timing("evaluate constant calls");
+    Error err = ok;
+    if (!context || !program || program->type != NodeType::PROGRAM || !stats) {
+        err.prepareError(ErrorType::ARGUMENTS, "constEvalProgram() requires a context, a program and stats!");
+        return err;
+    }
+    *stats = ConstEvalStats();
+    ConstEvalState state;
+    state.context = context;
+    state.options = &options;
+    state.stats = stats;
+    state.function = nullptr;
+    state.steps = 0;
+    state.depth = 0;
+    for (Binding *function = context->functions->bind; function; function = function->next)
+        state.functions.emplace(function->id->value.symbol, function->value);
+    constEvalFindPure(&state);
+
+    for (Binding *function = context->functions->bind; function; function = function->next) {
+        state.function = function->value;
+        nodeWalk(function->value->children->next_child->next_child, {constEvalPre, constEvalPost, &state});
+    }
+    state.function = nullptr;
+    nodeWalk(program, {constEvalPre, constEvalPost, &state});
+    return ok;
+}
+
+void printConstEvalStats(const ConstEvalStats &stats, std::ostream &out) {
+    out << "Constant evaluation: " << stats.call_sites << " call sites, "
+        << stats.evaluated << " evaluated, "
+        << stats.impure << " impure callee, "
+        << stats.non_constant << " non-constant arguments, "
+        << stats.step_limit << " over step limit, "
+        << stats.depth_limit << " over depth limit, "
+        << stats.unsupported << " unsupported\n";
+}
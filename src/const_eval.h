@@ -0,0 +1,45 @@
+#ifndef COMPILER_CONST_EVAL_H
+#define COMPILER_CONST_EVAL_H
+
+#include <cstddef>
+#include <ostream>
+
+#include "error.h"
+#include "parser.h"
+
+struct ConstEvalOptions {
+    /// Most expressions one folded call may evaluate, loop iterations included.
+    size_t max_steps;
+    /// Deepest chain of calls one folded call may make.
+    size_t max_depth;
+
+    ConstEvalOptions():
+        max_steps(1000000),
+        max_depth(128)
+    {}
+};
+
+struct ConstEvalStats {
+    size_t call_sites;
+    size_t evaluated;
+    /// The callee is unknown, defines a function, reads a global or calls such a function.
+    size_t impure;
+    /// Some argument is not an integer literal.
+    size_t non_constant;
+    size_t step_limit;
+    size_t depth_limit;
+    /// The callee ends in a statement without a value, or stores a literal that does not fit.
+    size_t unsupported;
+};
+
+/**
+ * Evaluate calls to pure functions whose arguments are all integer literals
+ * and replace each by its result, innermost first, so `f(g(1), 2)` folds
+ * completely. A function is pure when it reads only its parameters and
+ * locals and calls only pure functions. Values wrap and are truncated to the
+ * declared types exactly as the generated code does.
+ */
+Error constEvalProgram(ParsingContext *context, Node *program, const ConstEvalOptions &options, ConstEvalStats *stats);
+void printConstEvalStats(const ConstEvalStats &stats, std::ostream &out);
+
+#endif /* COMPILER_CONST_EVAL_H */
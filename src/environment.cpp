@@ -4,16 +4,55 @@
 #include <cassert>
 #include <cstdlib>
 
+#include "memory_stats.h"
 #include "parser.h"
 
+/// Bindings released by environmentClear(), linked through `next`; one list per thread.
+static thread_local Binding *binding_free_list = nullptr;
+
 Environment *environmentCreate(Environment *parent){
     Environment *env = new Environment;
     assert(env && "Could not allocate memory for new environment.");
+    memoryAllocated(MemoryCategory::ENVIRONMENTS, sizeof(Environment));
     env->parent = parent;
     env->bind = nullptr;
     return env;
 }
 
+void environmentDelete(Environment *env){
+    if(!env)
+        return;
+    Binding *binding_it = env->bind;
+    while(binding_it){
+        Binding *next = binding_it->next;
+        memoryFreed(MemoryCategory::ENVIRONMENTS, sizeof(Binding));
+        delete binding_it;
+        binding_it = next;
+    }
+    memoryFreed(MemoryCategory::ENVIRONMENTS, sizeof(Environment));
+    delete env;
+}
+
+void environmentClear(Environment *env){
+    if(!env || !env->bind)
+        return;
+    Binding *last = env->bind;
+    while(last->next)
+        last = last->next;
+    last->next = binding_free_list;
+    binding_free_list = env->bind;
+    env->bind = nullptr;
+}
+
+void environmentFreeListRelease(){
+    while(binding_free_list){
+        Binding *next = binding_free_list->next;
+        memoryFreed(MemoryCategory::ENVIRONMENTS, sizeof(Binding));
+        delete binding_free_list;
+        binding_free_list = next;
+    }
+}
+
 int environmentSet(Environment *env, Node *id, Node *value){
     // Over-writing an existing value
     if (!env || !id || !value) {
@@ -29,7 +68,13 @@ int environmentSet(Environment *env, Node *id, Node *value){
     }
     
     // Creating a new binding
-    Binding *binding = new Binding;
+    Binding *binding = binding_free_list;
+    if(binding)
+        binding_free_list = binding->next;
+    else {
+        binding = new Binding;
+        memoryAllocated(MemoryCategory::ENVIRONMENTS, sizeof(Binding));
+    }
     assert(binding && "Could not allocate new binding for the environment.");
     binding->id = id;
     binding->value = value;
@@ -50,9 +95,54 @@ bool environmentGet(Environment env, Node *id, Node *result){
     return false;
 }
 
+Binding *environmentFind(Environment *env, Node *id){
+    if(!env)
+        return nullptr;
+    Binding *binding_it = env->bind;
+    while(binding_it){
+        if(nodeCompare(binding_it->id, id))
+            return binding_it;
+        binding_it = binding_it->next;
+    }
+    return nullptr;
+}
+
+bool environmentRemove(Environment *env, Node *id){
+    if(!env)
+        return false;
+    Binding **link = &env->bind;
+    while(*link){
+        Binding *binding = *link;
+        if(nodeCompare(binding->id, id)){
+            *link = binding->next;
+            binding->next = binding_free_list;
+            binding_free_list = binding;
+            return true;
+        }
+        link = &binding->next;
+    }
+    return false;
+}
+
+void environmentRemoveIf(Environment *env, bool (*remove)(Binding *binding, void *data), void *data){
+    if(!env)
+        return;
+    Binding **link = &env->bind;
+    while(*link){
+        Binding *binding = *link;
+        if(remove(binding, data)){
+            *link = binding->next;
+            binding->next = binding_free_list;
+            binding_free_list = binding;
+        } else {
+            link = &binding->next;
+        }
+    }
+}
+
 bool environmentGetBySymbol(Environment env, char *symbol, Node *result) {
     Node *symbol_node = nodeSymbol(symbol);
     bool status = environmentGet(env, symbol_node, result);
-    delete symbol_node;
+    deleteNode(symbol_node);
     return status;
 }
\ No newline at end of file
@@ -15,6 +15,12 @@ struct Environment {
 };
 
 Environment *environmentCreate(Environment *parent);
+/// Frees the environment and its bindings, but not the bound nodes.
+void environmentDelete(Environment *env);
+/// Removes every binding; their storage is reused by later environmentSet() calls.
+void environmentClear(Environment *env);
+/// Frees the bindings environmentClear() left for reuse on the calling thread; call it before a thread exits.
+void environmentFreeListRelease();
 /**
  * @retval 0 Failure.
  * @retval 1 Creation of new binding.
@@ -22,6 +28,12 @@ Environment *environmentCreate(Environment *parent);
  */
 int environmentSet(Environment *env, Node *id, Node *value);
 bool environmentGet(Environment env, Node *id, Node *result);
+/// Binding of `id` in `env` itself (parents are not searched), or NULL.
+Binding *environmentFind(Environment *env, Node *id);
+/// @retval false `id` was not bound in `env`.
+bool environmentRemove(Environment *env, Node *id);
+/// Remove, in one pass, every binding `remove` returns true for.
+void environmentRemoveIf(Environment *env, bool (*remove)(Binding *binding, void *data), void *data);
 bool environmentGetBySymbol(Environment env, char *symbol, Node *result);
 
 #endif /* COMPILER_ENVIRONMENT_H */
\ No newline at end of file
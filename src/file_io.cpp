@@ -4,6 +4,16 @@
 #include <cstdlib>
 #include <fstream>
 #include <cassert>
+#include <cstring>
+
+#include "memory_stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 char *FileContents(char *path) {
     std::fstream file(path, std::ios::in);
@@ -13,16 +23,25 @@ char *FileContents(char *path) {
     }
     std::streamoff size = fileSize(file);
     char *contents = new char[size + 1];
+    memoryAllocated(MemoryCategory::SOURCE, size + 1);
     file.read(contents, size);
     if (!file.is_open()) {
         std::cout << "Error while reading!";
-        delete[] contents;
+        fileContentsFree(contents);
         std::exit(0);
     }
     contents[size] = '\0';
     return contents;
 }
 
+void fileContentsFree(char *contents) {
+    if (!contents)
+        return;
+    if (memory_accounting_enabled)
+        memoryRecordFree(MemoryCategory::SOURCE, std::strlen(contents) + 1);
+    delete[] contents;
+}
+
 std::streamoff fileSize(std::fstream &file) {
     if (!file.is_open()) {
         std::exit(0);
@@ -32,4 +51,84 @@ std::streamoff fileSize(std::fstream &file) {
     std::streamoff out = file.tellg();
     file.seekg(original);
     return out;
-}
\ No newline at end of file
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+bool fileMap(char *path, SourceMapping *mapping) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = static_cast<size_t>(info.st_size);
+    // Reserve one byte more than the file so the source is always NUL-terminated:
+    // the tail of the last file page and any page after it read as zero.
+    size_t mapped_size = (size + 1 + page - 1) / page * page;
+    void *reserved = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (size && mmap(reserved, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(reserved, mapped_size);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    mapping->contents = static_cast<char *>(reserved);
+    mapping->size = size;
+    mapping->mapped_size = mapped_size;
+    mapping->released = mapping->contents;
+    memoryAllocated(MemoryCategory::SOURCE, size + 1);
+    return true;
+}
+
+void fileRelease(SourceMapping *mapping, char *consumed) {
+    if (!mapping->mapped_size)
+        return;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t offset = static_cast<size_t>(consumed - mapping->contents) / page * page;
+    char *release_end = mapping->contents + offset;
+    if (release_end <= mapping->released)
+        return;
+    madvise(mapping->released, release_end - mapping->released, MADV_DONTNEED);
+    memoryFreed(MemoryCategory::SOURCE, release_end - mapping->released);
+    mapping->released = release_end;
+}
+
+void fileUnmap(SourceMapping *mapping) {
+    if (mapping->mapped_size) {
+        memoryFreed(MemoryCategory::SOURCE, mapping->size + 1 - (mapping->released - mapping->contents));
+        munmap(mapping->contents, mapping->mapped_size);
+    } else {
+        fileContentsFree(mapping->contents);
+    }
+    mapping->contents = nullptr;
+}
+
+#else
+
+bool fileMap(char *path, SourceMapping *mapping) {
+    mapping->contents = FileContents(path);
+    mapping->size = std::strlen(mapping->contents);
+    mapping->mapped_size = 0;
+    mapping->released = mapping->contents;
+    return true;
+}
+
+void fileRelease(SourceMapping *mapping, char *consumed) {
+    (void)mapping;
+    (void)consumed;
+}
+
+void fileUnmap(SourceMapping *mapping) {
+    fileContentsFree(mapping->contents);
+    mapping->contents = nullptr;
+}
+
+#endif
@@ -5,6 +5,22 @@
 #include <fstream>
 
 char *FileContents(char *path);
+/// Free the result of FileContents().
+void fileContentsFree(char *contents);
 std::streamoff fileSize(std::fstream &file);
 
+/// NUL-terminated source whose already-parsed prefix can be handed back to
+/// the OS. Backed by a private mapping where available, FileContents() otherwise.
+struct SourceMapping {
+    char *contents;
+    size_t size;
+    size_t mapped_size;
+    char *released;
+};
+
+bool fileMap(char *path, SourceMapping *mapping);
+/// Drop every whole page before `consumed`; it will not be read again.
+void fileRelease(SourceMapping *mapping, char *consumed);
+void fileUnmap(SourceMapping *mapping);
+
 #endif /* COMPILER_FILE_IO_H */
\ No newline at end of file
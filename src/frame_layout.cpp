@@ -0,0 +1,157 @@
+#include "frame_layout.h"
+
+#include <vector>
+
+#include "node_walk.h"
+
+constexpr size_t FRAME_STACK_ALIGNMENT = 16;
+
+struct FrameLayoutState {
+    FrameLayout *layout;
+    ParsingContext *context;
+    /// Nested call results live at this point of the walk.
+    size_t spills;
+    std::vector<Node *> argument_lists;
+    /// Where to record local slots, if anywhere.
+    std::vector<FrameLocal> *locals;
+};
+
+static size_t frameAlign(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static WalkAction frameLayoutPre(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    FrameLayoutState *state = static_cast<FrameLayoutState *>(data);
+    switch (node->type) {
+        default:
+            return WalkAction::SKIP_CHILDREN;
+        case NodeType::FUNCTION:
+            return WalkAction::SKIP_CHILDREN;
+        case NodeType::NONE:
+            if (parent && parent->type == NodeType::FUNCTION_CALL)
+                state->argument_lists.push_back(node);
+            return WalkAction::CONTINUE;
+        case NodeType::FUNCTION_CALL:
+        case NodeType::VARIABLE_REASSIGNMENT:
+        case NodeType::BINARY_OPERATOR:
+        case NodeType::WHILE:
+            return WalkAction::CONTINUE;
+        case NodeType::VARIABLE_DECLARATION: {
+            // Top-level declarations are globals, not locals; only a computed initializer runs code.
+            if (!state->context->parent)
+                return frameValueIsComputed(node->children->next_child)
+                    ? WalkAction::CONTINUE : WalkAction::SKIP_CHILDREN;
+            Node type_info;
+            Node *type_symbol = node->children->next_child->next_child;
+            size_t size = FRAME_SLOT_SIZE;
+            size_t alignment = FRAME_SLOT_SIZE;
+            if (type_symbol && parseGetType(state->context, type_symbol, &type_info).type == ErrorType::NONE) {
+                size = static_cast<size_t>(typeSize(&type_info));
+                alignment = static_cast<size_t>(typeAlignment(&type_info));
+            }
+            // Small locals pack together; the frame as a whole is aligned in frameLayoutFinish().
+            size_t offset = frameAlign(state->layout->locals_size, alignment);
+            if (state->locals)
+                state->locals->push_back({node, offset});
+            state->layout->locals_size = offset + size;
+            return WalkAction::SKIP_CHILDREN;
+        }
+    }
+}
+
+static WalkAction frameLayoutPost(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    FrameLayoutState *state = static_cast<FrameLayoutState *>(data);
+    if (node->type == NodeType::NONE && !state->argument_lists.empty() && state->argument_lists.back() == node)
+        state->argument_lists.pop_back();
+    if (!frameValueIsComputed(node))
+        return WalkAction::CONTINUE;
+
+    // Mirrors codegen: the spilled operands of this node are consumed, and
+    // its own result is spilled if it has to wait for a sibling.
+    if (node->type == NodeType::FUNCTION_CALL) {
+        state->layout->has_calls = true;
+        size_t arguments = 0;
+        for (Node *argument = node->children->next_child->children; argument; argument = argument->next_child) {
+            arguments += 1;
+            if (frameValueSpills(argument, node->children->next_child, true))
+                state->spills -= 1;
+        }
+        if (arguments > state->layout->max_arguments)
+            state->layout->max_arguments = arguments;
+    } else if (frameValueSpills(node->children->next_child, node, false)) {
+        state->spills -= 1;
+    }
+    bool is_argument = !state->argument_lists.empty() && state->argument_lists.back() == parent;
+    if (frameValueSpills(node, parent, is_argument)) {
+        state->spills += 1;
+        if (state->spills > state->layout->spill_slots)
+            state->layout->spill_slots = state->spills;
+    }
+    return WalkAction::CONTINUE;
+}
+
+bool frameValueIsComputed(const Node *node) {
+    return node->type == NodeType::FUNCTION_CALL || node->type == NodeType::BINARY_OPERATOR;
+}
+
+bool frameValueSpills(const Node *node, const Node *parent, bool is_argument) {
+    if (!frameValueIsComputed(node))
+        return false;
+    if (is_argument)
+        return true;
+    return parent && parent->type == NodeType::BINARY_OPERATOR && node == parent->children->next_child
+        && frameValueIsComputed(node->next_child);
+}
+
+void frameLayoutInit(FrameLayout *layout) {
+    layout->has_calls = false;
+    layout->max_arguments = 0;
+    layout->spill_slots = 0;
+    layout->locals_size = 0;
+    layout->outgoing_size = 0;
+    layout->spill_offset = 0;
+    layout->locals_offset = 0;
+    layout->size = 0;
+}
+
+size_t frameOutgoingSize(const FrameLayout &layout) {
+    if (!layout.has_calls)
+        return 0;
+    size_t stack_arguments = layout.max_arguments > FRAME_REGISTER_ARGUMENTS_MSWIN
+        ? layout.max_arguments - FRAME_REGISTER_ARGUMENTS_MSWIN : 0;
+    return FRAME_SHADOW_SPACE_MSWIN + stack_arguments * FRAME_SLOT_SIZE;
+}
+
+void frameLayoutAdd(FrameLayout *layout, ParsingContext *context, Node *expression, std::vector<FrameLocal> *locals) {
+    FrameLayoutState state;
+    state.layout = layout;
+    state.context = context;
+    state.spills = 0;
+    state.locals = locals;
+    nodeWalk(expression, {frameLayoutPre, frameLayoutPost, &state});
+}
+
+void frameLayoutFinish(FrameLayout *layout) {
+    layout->outgoing_size = frameOutgoingSize(*layout);
+    layout->spill_offset = layout->outgoing_size;
+    layout->locals_offset = layout->spill_offset + layout->spill_slots * FRAME_SLOT_SIZE;
+    size_t size = layout->locals_offset + layout->locals_size;
+    if (layout->has_calls) {
+        // The return address leaves RSP 8 bytes off alignment on entry.
+        size = frameAlign(size + FRAME_SLOT_SIZE, FRAME_STACK_ALIGNMENT) - FRAME_SLOT_SIZE;
+    } else {
+        size = frameAlign(size, FRAME_SLOT_SIZE);
+    }
+    layout->size = size;
+}
+
+FrameLayout frameLayoutCompute(ParsingContext *context, Node *expressions, std::vector<FrameLocal> *locals) {
+    FrameLayout layout;
+    frameLayoutInit(&layout);
+    for (Node *expression = expressions; expression; expression = expression->next_child)
+        frameLayoutAdd(&layout, context, expression, locals);
+    frameLayoutFinish(&layout);
+    return layout;
+}
@@ -0,0 +1,65 @@
+#ifndef COMPILER_FRAME_LAYOUT_H
+#define COMPILER_FRAME_LAYOUT_H
+
+#include <cstddef>
+#include <vector>
+
+#include "parser.h"
+
+/// Bytes the caller reserves below the return address for the callee's register arguments.
+constexpr size_t FRAME_SHADOW_SPACE_MSWIN = 32;
+constexpr size_t FRAME_SLOT_SIZE = 8;
+/// Arguments passed in registers; the rest go on the stack above the shadow space.
+constexpr size_t FRAME_REGISTER_ARGUMENTS_MSWIN = 4;
+
+/**
+ * Stack frame of one function body (or of _start) under the MS x64 calling
+ * convention, relative to RSP after the prologue:
+ *
+ *   [0, outgoing_size)             shadow space for the callees, if any call is made,
+ *                                  then the arguments after the fourth of the largest call
+ *   [spill_offset, locals_offset)  results of nested calls waiting to become arguments
+ *   [locals_offset, size)          local variables, then padding
+ *
+ * RSP is 16-byte aligned at every call. A body without calls, spills or
+ * locals gets size 0 and no frame setup at all.
+ */
+struct FrameLayout {
+    bool has_calls;
+    /// Most arguments passed by any one call.
+    size_t max_arguments;
+    size_t spill_slots;
+    size_t locals_size;
+    size_t outgoing_size;
+    size_t spill_offset;
+    size_t locals_offset;
+    size_t size;
+};
+
+/// A local variable and its offset from FrameLayout::locals_offset.
+struct FrameLocal {
+    Node *declaration;
+    size_t offset;
+};
+
+/// Whether a value is computed into RAX by the code walk (calls and operators) rather than loaded where it is used.
+bool frameValueIsComputed(const Node *node);
+/**
+ * Whether the computed value of `node` waits in a spill slot: call arguments
+ * always do, and so does the left operand of an operator while a computed
+ * right operand is evaluated.
+ */
+bool frameValueSpills(const Node *node, const Node *parent, bool is_argument);
+
+void frameLayoutInit(FrameLayout *layout);
+/// Bytes below the spill slots for the calls accounted so far: shadow space and stack arguments.
+size_t frameOutgoingSize(const FrameLayout &layout);
+/// Account for one statement; nested function definitions get frames of their own.
+void frameLayoutAdd(FrameLayout *layout, ParsingContext *context, Node *expression,
+                    std::vector<FrameLocal> *locals = nullptr);
+/// Assign offsets and the final, aligned size.
+void frameLayoutFinish(FrameLayout *layout);
+/// Layout of a whole expression list (a function body or the top level).
+FrameLayout frameLayoutCompute(ParsingContext *context, Node *expressions, std::vector<FrameLocal> *locals = nullptr);
+
+#endif /* COMPILER_FRAME_LAYOUT_H */
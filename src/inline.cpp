@@ -0,0 +1,641 @@
+#include "inline.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "environment.h"
+#include "node_walk.h"
+#include "record_layout.h"
+#include "timing.h"
+
+struct InlineState {
+    ParsingContext *context;
+    const InlineOptions *options;
+    InlineStats *stats;
+    Node *program;
+    /// Inline depth of calls that were copied out of inlined bodies.
+    std::unordered_map<Node *, size_t> depth;
+    /// Calls already counted and left in place.
+    std::unordered_set<Node *> kept;
+    std::unordered_set<std::string> inlined_callees;
+    /// Every variable name in the program, so that temporaries get new ones.
+    std::unordered_set<std::string> names;
+    size_t temporaries;
+};
+
+/// The function calls are inlined into, or the top level if `function` is NULL.
+struct InlineSite {
+    Node *function;
+    const char *function_name;
+    /// Parameters and locals of `function`, which hide globals of the same name.
+    std::unordered_set<std::string> locals;
+    /// Declarations of temporaries, put at the start of the body once it is done.
+    std::vector<Node *> declarations;
+};
+
+static WalkAction inlineCountVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)node;
+    (void)parent;
+    (void)depth;
+    *static_cast<size_t *>(data) += 1;
+    return WalkAction::CONTINUE;
+}
+
+static size_t inlineCountNodes(Node *node) {
+    size_t count = 0;
+    nodeWalk(node, {inlineCountVisit, nullptr, &count});
+    return count;
+}
+
+struct InlineCallSearch {
+    /// NULL finds a call to any function.
+    const char *name;
+    bool found;
+};
+
+static WalkAction inlineFindCallVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    InlineCallSearch *search = static_cast<InlineCallSearch *>(data);
+    if (node->type == NodeType::FUNCTION_CALL && (!search->name || strcmp(node->children->value.symbol, search->name) == 0)) {
+        search->found = true;
+        return WalkAction::STOP;
+    }
+    return WalkAction::CONTINUE;
+}
+
+static bool inlineHasCall(Node *node) {
+    InlineCallSearch search = {nullptr, false};
+    nodeWalk(node, {inlineFindCallVisit, nullptr, &search});
+    return search.found;
+}
+
+static Node *inlineCopy(Node *node) {
+    Node *copy = nodeAllocate();
+    nodeCopy(node, copy);
+    return copy;
+}
+
+/// Whether the symbol `node` names a variable rather than a callee, an operator or a type.
+static bool inlineIsVariable(Node *node, Node *parent) {
+    if (!parent)
+        return true;
+    switch (parent->type) {
+        default:
+            return true;
+        case NodeType::FUNCTION_CALL:
+        case NodeType::BINARY_OPERATOR:
+            return node != parent->children;
+        case NodeType::VARIABLE_DECLARATION:
+            return node != parent->children->next_child->next_child;
+    }
+}
+
+/// The variable a symbol names: `p` for the field access `p.x`.
+static std::string inlineBaseName(const char *symbol) {
+    const char *dot = strchr(symbol, '.');
+    return dot ? std::string(symbol, static_cast<size_t>(dot - symbol)) : std::string(symbol);
+}
+
+static bool inlineIsValue(const Node *node) {
+    return node->type == NodeType::INTEGER || node->type == NodeType::SYMBOL
+        || node->type == NodeType::BINARY_OPERATOR || node->type == NodeType::FUNCTION_CALL;
+}
+
+/// Whether every integer type holds the literal, so it may be stored in any variable.
+static bool inlineFitsAnyType(const Node *literal) {
+    return !literal->integer_above_signed && literal->value.integer >= 0 && literal->value.integer <= 127;
+}
+
+/// The literal a parameter of the type holds when passed `literal`: calls truncate like registers do.
+static Node *inlineTruncate(const Node *type_info, const Node *literal) {
+    unsigned long long value = static_cast<unsigned long long>(literal->value.integer);
+    long long bits = typeSize(type_info) * 8;
+    if (bits < 64)
+        value &= (1ull << bits) - 1;
+    bool negative = (value >> (bits - 1)) & 1;
+    Node *truncated = nodeInteger(static_cast<long long>(value));
+    if (bits < 64 && negative && typeIsSigned(type_info))
+        truncated->value.integer = static_cast<long long>(value) - (1ll << bits);
+    truncated->integer_above_signed = bits >= 64 && negative && !typeIsSigned(type_info);
+    return truncated;
+}
+
+static WalkAction inlineNamesVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    if (node->isSymbol() && inlineIsVariable(node, parent))
+        static_cast<std::unordered_set<std::string> *>(data)->insert(inlineBaseName(node->value.symbol));
+    return WalkAction::CONTINUE;
+}
+
+/// How a callee body uses its variables.
+struct InlineUses {
+    std::unordered_set<std::string> names;
+    std::unordered_set<std::string> assigned;
+    /// Variables stored as they are, as the whole value of a declaration or an assignment.
+    std::unordered_set<std::string> stored;
+    /// A nested function definition.
+    bool unsupported;
+};
+
+static WalkAction inlineUsesVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    InlineUses *uses = static_cast<InlineUses *>(data);
+    switch (node->type) {
+        default:
+            return WalkAction::CONTINUE;
+        case NodeType::FUNCTION:
+            uses->unsupported = true;
+            return WalkAction::STOP;
+        case NodeType::VARIABLE_REASSIGNMENT:
+            uses->assigned.insert(inlineBaseName(node->children->value.symbol));
+            if (node->children->next_child->isSymbol())
+                uses->stored.insert(inlineBaseName(node->children->next_child->value.symbol));
+            return WalkAction::CONTINUE;
+        case NodeType::VARIABLE_DECLARATION:
+            if (node->children->next_child->isSymbol())
+                uses->stored.insert(inlineBaseName(node->children->next_child->value.symbol));
+            return WalkAction::CONTINUE;
+        case NodeType::SYMBOL:
+            if (inlineIsVariable(node, parent))
+                uses->names.insert(inlineBaseName(node->value.symbol));
+            return WalkAction::CONTINUE;
+    }
+}
+
+/// What each parameter and local of the callee stands for at the call site: a literal or a symbol.
+typedef std::unordered_map<std::string, Node *> InlineBindings;
+
+static WalkAction inlineBindVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    if (!node->isSymbol() || !inlineIsVariable(node, parent))
+        return WalkAction::CONTINUE;
+    InlineBindings *bindings = static_cast<InlineBindings *>(data);
+    auto found = bindings->find(inlineBaseName(node->value.symbol));
+    if (found == bindings->end())
+        return WalkAction::CONTINUE;
+    Node *value = found->second;
+    if (value->isInteger()) {
+        // Only parameters are bound to literals, and those are never records.
+        symbolFree(node->value.symbol);
+        node->type = NodeType::INTEGER;
+        node->integer_above_signed = value->integer_above_signed;
+        node->value.integer = value->value.integer;
+        return WalkAction::CONTINUE;
+    }
+    const char *field = strchr(node->value.symbol, '.');
+    std::string name = std::string(value->value.symbol) + (field ? field : "");
+    char *symbol = symbolAllocate(name.size());
+    std::strcpy(symbol, name.c_str());
+    symbolFree(node->value.symbol);
+    node->value.symbol = symbol;
+    return WalkAction::CONTINUE;
+}
+
+static void inlineBindingsDelete(InlineBindings &bindings) {
+    for (auto &binding : bindings)
+        deleteNode(binding.second);
+    bindings.clear();
+}
+
+static std::string inlineTemporaryName(InlineState *state) {
+    std::string name;
+    do {
+        name = "__in_" + std::to_string(state->temporaries++);
+    } while (state->names.count(name));
+    state->names.insert(name);
+    return name;
+}
+
+/// Declare a temporary: a local of the site's function, or a global at the top level.
+static void inlineDeclare(InlineState *state, InlineSite *site, const std::string &name, const char *type_name) {
+    Node *declaration = nodeAllocate();
+    declaration->type = NodeType::VARIABLE_DECLARATION;
+    nodeAddChild(declaration, nodeSymbol(name.c_str()));
+    nodeAddChild(declaration, nodeAllocate());
+    nodeAddChild(declaration, nodeSymbol(type_name));
+    if (site->function) {
+        site->declarations.push_back(declaration);
+        return;
+    }
+    environmentSet(state->context->variables, nodeSymbol(name.c_str()), nodeSymbol(type_name));
+    nodeAddChild(state->program, declaration);
+}
+
+static Node *inlineAssignment(const std::string &name, Node *value) {
+    Node *assignment = nodeAllocate();
+    assignment->type = NodeType::VARIABLE_REASSIGNMENT;
+    nodeAddChild(assignment, nodeSymbol(name.c_str()));
+    nodeAddChild(assignment, value);
+    return assignment;
+}
+
+/// Turn a copied local declaration into an assignment of its temporary; locals start at zero.
+static void inlineDeclarationToAssignment(Node *declaration) {
+    Node *name = declaration->children;
+    Node *value = name->next_child;
+    deleteNode(value->next_child);
+    value->next_child = nullptr;
+    if (value->isNone()) {
+        deleteNode(value);
+        value = nodeInteger(0);
+    }
+    name->next_child = value;
+    declaration->type = NodeType::VARIABLE_REASSIGNMENT;
+}
+
+struct InlineDepthMark {
+    InlineState *state;
+    size_t depth;
+};
+
+static WalkAction inlineMarkDepthVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    InlineDepthMark *mark = static_cast<InlineDepthMark *>(data);
+    if (node->type == NodeType::FUNCTION_CALL)
+        mark->state->depth[node] = mark->depth;
+    return WalkAction::CONTINUE;
+}
+
+/// Make `node` the expression `with` in place, so whatever links to it sees the new expression.
+static void inlineReplace(Node *node, Node *with) {
+    for (Node *child = node->children; child;) {
+        Node *next = child->next_child;
+        deleteNode(child);
+        child = next;
+    }
+    Node *next = node->next_child;
+    *node = *with;
+    node->next_child = next;
+    nodeFree(with);
+}
+
+static bool inlineTypeIsSupported(InlineState *state, Node *type_symbol, Node *type_info) {
+    return parseGetType(state->context, type_symbol, type_info).type == ErrorType::NONE && !typeIsRecord(type_info);
+}
+
+/**
+ * Inline `call`, if it can and should be. Each parameter is bound to its
+ * argument, directly if it is a literal or a variable the body does not
+ * change, else through a temporary assigned the argument; locals become
+ * temporaries too. `hoisted` gets the statements that run before the one
+ * holding the call and, if the call's value is used, the call is replaced
+ * by the callee's last expression.
+ */
+static bool inlineCall(InlineState *state, InlineSite *site, Node *call, Node *parent, bool value_used,
+                       std::vector<Node *> &hoisted) {
+    InlineStats *stats = state->stats;
+    stats->call_sites += 1;
+    state->kept.insert(call);
+
+    Binding *callee = environmentFind(state->context->functions, call->children);
+    if (!callee) {
+        stats->unknown_callee += 1;
+        return false;
+    }
+    const char *name = callee->id->value.symbol;
+    Node *function = callee->value;
+    Node *body = function->children->next_child->next_child;
+
+    auto found_depth = state->depth.find(call);
+    size_t depth = found_depth == state->depth.end() ? 0 : found_depth->second;
+    if (depth >= state->options->max_depth) {
+        stats->too_deep += 1;
+        return false;
+    }
+
+    InlineCallSearch search = {name, false};
+    nodeWalk(body, {inlineFindCallVisit, nullptr, &search});
+    if (search.found || (site->function_name && strcmp(site->function_name, name) == 0)) {
+        stats->recursive += 1;
+        return false;
+    }
+
+    InlineUses uses;
+    uses.unsupported = false;
+    nodeWalk(body, {inlineUsesVisit, nullptr, &uses});
+    std::vector<Node *> parameters;
+    std::vector<Node *> arguments;
+    std::vector<Node *> locals;
+    for (Node *parameter = function->children->children; parameter; parameter = parameter->next_child)
+        parameters.push_back(parameter);
+    for (Node *argument = call->children->next_child->children; argument; argument = argument->next_child)
+        arguments.push_back(argument);
+    Node *last = nullptr;
+    for (Node *expression = body->children; expression; expression = expression->next_child) {
+        if (expression->type == NodeType::VARIABLE_DECLARATION)
+            locals.push_back(expression);
+        last = expression;
+    }
+
+    bool unsupported = uses.unsupported || parameters.size() != arguments.size()
+        || (value_used && (!last || !inlineIsValue(last)));
+    std::vector<Node> parameter_types(parameters.size());
+    std::unordered_set<std::string> own;
+    for (size_t i = 0; i < parameters.size() && !unsupported; i++) {
+        own.insert(parameters[i]->children->value.symbol);
+        unsupported = !inlineTypeIsSupported(state, parameters[i]->children->next_child, &parameter_types[i]);
+    }
+    for (size_t i = 0; i < locals.size() && !unsupported; i++) {
+        Node type_info;
+        own.insert(locals[i]->children->value.symbol);
+        unsupported = !inlineTypeIsSupported(state, locals[i]->children->next_child->next_child, &type_info);
+    }
+    // A global the callee reads must not be hidden by a variable of the caller.
+    for (const std::string &used : uses.names)
+        if (!own.count(used) && site->locals.count(used))
+            unsupported = true;
+    if (unsupported) {
+        stats->unsupported += 1;
+        return false;
+    }
+
+    if (profileIsCold(state->options->profile, name)) {
+        stats->cold += 1;
+        return false;
+    }
+
+    InlineBindings bindings;
+    std::vector<std::pair<std::string, const char *>> temporaries;
+    std::vector<std::string> parameter_temporaries(parameters.size());
+    // Truncated literal arguments of parameters bound to temporaries.
+    std::vector<Node *> temporary_values(parameters.size(), nullptr);
+    size_t cost = 0;
+    for (size_t i = 0; i < parameters.size(); i++) {
+        const char *parameter = parameters[i]->children->value.symbol;
+        Node *argument = arguments[i];
+        bool changed = uses.assigned.count(parameter) != 0;
+        Node *literal = argument->isInteger() ? inlineTruncate(&parameter_types[i], argument) : nullptr;
+        if (!changed && literal && (!uses.stored.count(parameter) || inlineFitsAnyType(literal))) {
+            bindings[parameter] = literal;
+        } else if (!changed && argument->isSymbol() && typeSize(&parameter_types[i]) == 8) {
+            // Narrower parameters truncate their argument, so those get a temporary.
+            bindings[parameter] = nodeSymbol(argument->value.symbol);
+        } else {
+            parameter_temporaries[i] = inlineTemporaryName(state);
+            temporary_values[i] = literal;
+            bindings[parameter] = nodeSymbol(parameter_temporaries[i].c_str());
+            temporaries.push_back({parameter_temporaries[i], parameters[i]->children->next_child->value.symbol});
+            cost += 2 + inlineCountNodes(argument);
+        }
+    }
+    for (Node *local : locals) {
+        std::string temporary = inlineTemporaryName(state);
+        bindings[local->children->value.symbol] = nodeSymbol(temporary.c_str());
+        temporaries.push_back({temporary, local->children->next_child->next_child->value.symbol});
+    }
+
+    std::vector<Node *> statements;
+    Node *result = nullptr;
+    for (Node *expression = body->children; expression; expression = expression->next_child) {
+        if (expression == last && value_used) {
+            result = inlineCopy(expression);
+            nodeWalk(result, {inlineBindVisit, nullptr, &bindings});
+            break;
+        }
+        // Values nobody reads only matter for the calls in them.
+        if (inlineIsValue(expression) && !inlineHasCall(expression))
+            continue;
+        Node *copy = inlineCopy(expression);
+        nodeWalk(copy, {inlineBindVisit, nullptr, &bindings});
+        if (copy->type == NodeType::VARIABLE_DECLARATION)
+            inlineDeclarationToAssignment(copy);
+        statements.push_back(copy);
+    }
+    inlineBindingsDelete(bindings);
+
+    // Stored literals must fit their variable, while a returned value is
+    // truncated silently, so a large literal result goes through a temporary.
+    if (result && result->isInteger() && !inlineFitsAnyType(result) && parent
+        && (parent->type == NodeType::VARIABLE_DECLARATION || parent->type == NodeType::VARIABLE_REASSIGNMENT)
+        && call == parent->children->next_child) {
+        std::string temporary = inlineTemporaryName(state);
+        temporaries.push_back({temporary, result->integer_above_signed ? "u64" : "integer"});
+        statements.push_back(inlineAssignment(temporary, result));
+        result = nodeSymbol(temporary.c_str());
+    }
+
+    for (Node *statement : statements)
+        cost += inlineCountNodes(statement);
+    if (result)
+        cost += inlineCountNodes(result);
+    size_t max_cost = profileIsHot(state->options->profile, name) ? state->options->hot_body_nodes
+                                                                   : state->options->max_body_nodes;
+    if (cost > max_cost) {
+        for (Node *statement : statements)
+            deleteNode(statement);
+        if (result)
+            deleteNode(result);
+        for (Node *value : temporary_values)
+            if (value)
+                deleteNode(value);
+        stats->too_large += 1;
+        return false;
+    }
+
+    for (auto &temporary : temporaries)
+        inlineDeclare(state, site, temporary.first, temporary.second);
+    // Arguments bound to temporaries move into their assignments; the others were copied.
+    call->children->next_child->children = nullptr;
+    for (size_t i = 0; i < arguments.size(); i++) {
+        arguments[i]->next_child = nullptr;
+        if (parameter_temporaries[i].empty() || temporary_values[i])
+            deleteNode(arguments[i]);
+        if (!parameter_temporaries[i].empty())
+            hoisted.push_back(inlineAssignment(parameter_temporaries[i],
+                                               temporary_values[i] ? temporary_values[i] : arguments[i]));
+    }
+    InlineDepthMark mark = {state, depth + 1};
+    for (Node *statement : statements) {
+        nodeWalk(statement, {inlineMarkDepthVisit, nullptr, &mark});
+        hoisted.push_back(statement);
+    }
+    state->kept.erase(call);
+    state->depth.erase(call);
+    if (result) {
+        inlineReplace(call, result);
+        nodeWalk(call, {inlineMarkDepthVisit, nullptr, &mark});
+    }
+
+    stats->inlined += 1;
+    state->inlined_callees.insert(name);
+    return true;
+}
+
+struct InlineCallFind {
+    InlineState *state;
+    Node *call;
+    Node *parent;
+};
+
+static WalkAction inlineFindCandidateVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    InlineCallFind *find = static_cast<InlineCallFind *>(data);
+    if (node->type == NodeType::FUNCTION || node->type == NodeType::WHILE)
+        return WalkAction::SKIP_CHILDREN;
+    if (node->type == NodeType::FUNCTION_CALL && !find->state->kept.count(node)) {
+        find->call = node;
+        find->parent = parent;
+        return WalkAction::STOP;
+    }
+    return WalkAction::CONTINUE;
+}
+
+/// Calls in a loop condition run every iteration, so there is nowhere to put their body.
+static WalkAction inlineConditionVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    InlineState *state = static_cast<InlineState *>(data);
+    if (node->type == NodeType::FUNCTION_CALL && state->kept.insert(node).second) {
+        state->stats->call_sites += 1;
+        state->stats->unsupported += 1;
+    }
+    return WalkAction::CONTINUE;
+}
+
+/// Inline the calls in a statement list; `returns_value` if its last statement is a function's result.
+static void inlineList(InlineState *state, InlineSite *site, Node **link, bool returns_value) {
+    while (*link) {
+        Node *statement = *link;
+        if (statement->type == NodeType::FUNCTION) {
+            link = &statement->next_child;
+            continue;
+        }
+        if (statement->type == NodeType::WHILE) {
+            nodeWalk(statement->children, {inlineConditionVisit, nullptr, state});
+            Node *loop_body = statement->children->next_child;
+            inlineList(state, site, &loop_body->children, false);
+            if (loop_body->next_child)
+                inlineList(state, site, &loop_body->next_child->children, false);
+            link = &statement->next_child;
+            continue;
+        }
+
+        InlineCallFind find = {state, nullptr, nullptr};
+        nodeWalk(statement, {inlineFindCandidateVisit, nullptr, &find});
+        if (!find.call) {
+            link = &statement->next_child;
+            continue;
+        }
+        bool value_used = find.call != statement || (returns_value && !statement->next_child);
+        std::vector<Node *> hoisted;
+        if (!inlineCall(state, site, find.call, find.parent, value_used, hoisted))
+            continue;
+
+        Node *rest = statement;
+        if (!value_used) {
+            rest = statement->next_child;
+            statement->next_child = nullptr;
+            deleteNode(statement);
+        }
+        // Look at the first inlined statement next, so calls in it are inlined in turn.
+        for (size_t i = hoisted.size(); i-- > 0;) {
+            hoisted[i]->next_child = rest;
+            rest = hoisted[i];
+        }
+        *link = rest;
+    }
+}
+
+struct InlineReachable {
+    std::unordered_set<std::string> called;
+    std::vector<std::string> worklist;
+};
+
+static WalkAction inlineReachableVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    InlineReachable *reachable = static_cast<InlineReachable *>(data);
+    if (node->type == NodeType::FUNCTION_CALL && reachable->called.insert(node->children->value.symbol).second)
+        reachable->worklist.push_back(node->children->value.symbol);
+    return WalkAction::CONTINUE;
+}
+
+static void inlineRemoveUnused(InlineState *state, Node *program) {
+    InlineReachable reachable;
+    for (Node *expression = program->children; expression; expression = expression->next_child)
+        if (expression->type != NodeType::FUNCTION)
+            nodeWalk(expression, {inlineReachableVisit, nullptr, &reachable});
+    while (!reachable.worklist.empty()) {
+        Node *id = nodeSymbol(reachable.worklist.back().c_str());
+        reachable.worklist.pop_back();
+        Binding *function = environmentFind(state->context->functions, id);
+        deleteNode(id);
+        if (function)
+            nodeWalk(function->value->children->next_child->next_child, {inlineReachableVisit, nullptr, &reachable});
+    }
+
+    for (const std::string &name : state->inlined_callees) {
+        if (reachable.called.count(name))
+            continue;
+        Node *id = nodeSymbol(name.c_str());
+        Binding *binding = environmentFind(state->context->functions, id);
+        if (binding) {
+            // The environment owns the name; the definition belongs to the program.
+            Node *bound_id = binding->id;
+            environmentRemove(state->context->functions, id);
+            deleteNode(bound_id);
+            state->stats->functions_removed += 1;
+        }
+        deleteNode(id);
+    }
+}
+
+Error inlineProgram(ParsingContext *context, Node *program, const InlineOptions &options, InlineStats *stats) {
+    TimingScope timing("inline");
+    Error err = ok;
+    if (!context || !program || program->type != NodeType::PROGRAM || !stats) {
+        err.prepareError(ErrorType::ARGUMENTS, "inlineProgram() requires a context, a program and stats!");
+        return err;
+    }
+    *stats = InlineStats();
+    InlineState state;
+    state.context = context;
+    state.options = &options;
+    state.stats = stats;
+    state.program = program;
+    state.temporaries = 0;
+    nodeWalk(program, {inlineNamesVisit, nullptr, &state.names});
+
+    for (Binding *function = context->functions->bind; function; function = function->next) {
+        Node *body = function->value->children->next_child->next_child;
+        InlineSite site;
+        site.function = function->value;
+        site.function_name = function->id->value.symbol;
+        for (Node *parameter = function->value->children->children; parameter; parameter = parameter->next_child)
+            site.locals.insert(parameter->children->value.symbol);
+        for (Node *expression = body->children; expression; expression = expression->next_child)
+            if (expression->type == NodeType::VARIABLE_DECLARATION)
+                site.locals.insert(expression->children->value.symbol);
+        inlineList(&state, &site, &body->children, true);
+        for (size_t i = site.declarations.size(); i-- > 0;) {
+            site.declarations[i]->next_child = body->children;
+            body->children = site.declarations[i];
+        }
+    }
+    InlineSite top_level;
+    top_level.function = nullptr;
+    top_level.function_name = nullptr;
+    inlineList(&state, &top_level, &program->children, false);
+
+    if (options.remove_unused)
+        inlineRemoveUnused(&state, program);
+    return ok;
+}
+
+void printInlineStats(const InlineStats &stats, std::ostream &out) {
+    out << "Inliner: " << stats.call_sites << " call sites, "
+        << stats.inlined << " inlined, "
+        << stats.too_large << " too large, "
+        << stats.too_deep << " too deep, "
+        << stats.recursive << " recursive, "
+        << stats.unknown_callee << " unknown callee, "
+        << stats.cold << " cold, "
+        << stats.unsupported << " unsupported; "
+        << stats.functions_removed << " functions removed\n";
+}
@@ -0,0 +1,60 @@
+#ifndef COMPILER_INLINE_H
+#define COMPILER_INLINE_H
+
+#include <cstddef>
+#include <ostream>
+
+#include "error.h"
+#include "parser.h"
+#include "profile.h"
+
+struct InlineOptions {
+    /// Largest callee, in AST nodes of the code left after inlining, that is substituted.
+    size_t max_body_nodes;
+    /// How many times code that came from inlining may itself be inlined into.
+    size_t max_depth;
+    /// Drop functions whose every call was inlined.
+    bool remove_unused;
+    /// With a profile, hot callees may be up to `hot_body_nodes` large and
+    /// callees the profiled run never called are left alone; may be NULL.
+    const Profile *profile;
+    size_t hot_body_nodes;
+
+    InlineOptions():
+        max_body_nodes(16),
+        max_depth(4),
+        remove_unused(true),
+        profile(nullptr),
+        hot_body_nodes(64)
+    {}
+};
+
+struct InlineStats {
+    size_t call_sites;
+    size_t inlined;
+    size_t too_large;
+    size_t too_deep;
+    size_t recursive;
+    size_t unknown_callee;
+    /// Never called in the profiled run.
+    size_t cold;
+    /// The callee has a record variable or a nested function, reads a global a
+    /// variable of the caller hides, or has no value where one is used; or the
+    /// call is in a loop condition.
+    size_t unsupported;
+    size_t functions_removed;
+};
+
+/**
+ * Substitute small function bodies for calls anywhere in the top-level
+ * expressions, function bodies and loop bodies. Each parameter is bound to
+ * its argument: literals and variables the body does not assign are used
+ * directly, other arguments are assigned to a temporary first, and the
+ * callee's locals become temporaries too, so bodies may read and assign
+ * their parameters and run loops. The call's value is the body's last
+ * expression.
+ */
+Error inlineProgram(ParsingContext *context, Node *program, const InlineOptions &options, InlineStats *stats);
+void printInlineStats(const InlineStats &stats, std::ostream &out);
+
+#endif /* COMPILER_INLINE_H */
@@ -0,0 +1,182 @@
+#include "lex_parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "memory_stats.h"
+
+/// Below this, a chunk costs more in thread startup than it saves.
+constexpr size_t LEX_PARALLEL_MIN_CHUNK = 1 << 20;
+/// Tokens per segment once a chunk outgrows its first one; a full segment is never copied to grow it.
+constexpr size_t LEX_SEGMENT_TOKENS = 1 << 16;
+
+static thread_local TokenStream *lex_token_stream = nullptr;
+
+/// Tokens of one chunk, in segments, and where each segment starts in the source.
+struct LexChunk {
+    std::vector<std::vector<StreamToken>> segments;
+    std::vector<char *> begins;
+};
+
+/// Lex [begin, end), where `end` directly follows a newline or is the end of the source.
+static Error lexChunk(char *begin, char *end, LexChunk *chunk) {
+    Error err = ok;
+    Token token;
+    token.begin = begin;
+    token.end = begin;
+    token.next = nullptr;
+    chunk->segments.emplace_back();
+    chunk->begins.push_back(begin);
+    std::vector<StreamToken> *tokens = &chunk->segments.back();
+    // Generated sources average a little over four bytes per token.
+    tokens->reserve((end - begin) / 4 + 1);
+    for (;;) {
+        err = lex(token.end, &token);
+        if (err.type != ErrorType::NONE)
+            return err;
+        // Whitespace before the next token may run into the following chunk.
+        if (token.begin >= end || token.begin == token.end)
+            return ok;
+        if (tokens->size() == tokens->capacity()) {
+            chunk->segments.emplace_back();
+            chunk->begins.push_back(token.begin);
+            tokens = &chunk->segments.back();
+            tokens->reserve(LEX_SEGMENT_TOKENS);
+        }
+        tokens->push_back({token.begin, token.end});
+    }
+}
+
+Error lexParallel(char *source, size_t length, size_t thread_count, TokenStream *stream) {
+    Error err = ok;
+    if (!source || !stream) {
+        err.prepareError(ErrorType::ARGUMENTS, "lexParallel(): source and stream must not be NULL");
+        return err;
+    }
+    tokenStreamClear(stream);
+    stream->source = source;
+    stream->length = length;
+
+    if (!thread_count)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::max<size_t>(1, std::min(thread_count, length / LEX_PARALLEL_MIN_CHUNK));
+
+    // Cut just after the first newline at or past each even split point.
+    std::vector<char *> bounds;
+    bounds.push_back(source);
+    for (size_t i = 1; i < thread_count; i++) {
+        char *split = std::max(source + length * i / thread_count, bounds.back());
+        char *newline = static_cast<char *>(std::memchr(split, '\n', source + length - split));
+        if (!newline)
+            break;
+        if (newline + 1 > bounds.back())
+            bounds.push_back(newline + 1);
+    }
+    bounds.push_back(source + length);
+    size_t chunk_count = bounds.size() - 1;
+
+    std::vector<LexChunk> chunks(chunk_count);
+    std::vector<Error> errors(chunk_count);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chunk_count; i++)
+        threads.emplace_back([&, i]() { errors[i] = lexChunk(bounds[i], bounds[i + 1], &chunks[i]); });
+    errors[0] = lexChunk(bounds[0], bounds[1], &chunks[0]);
+    for (std::thread &thread : threads)
+        thread.join();
+    for (const Error &chunk_error : errors)
+        if (chunk_error.type != ErrorType::NONE)
+            return chunk_error;
+    // The segments are read in place: copying them into one array would need room for every token twice.
+    size_t capacity = 0;
+    for (LexChunk &chunk : chunks) {
+        for (size_t i = 0; i < chunk.segments.size(); i++) {
+            capacity += chunk.segments[i].capacity();
+            stream->segments.emplace_back();
+            stream->segments.back().swap(chunk.segments[i]);
+            stream->segment_begins.push_back(chunk.begins[i]);
+        }
+    }
+    memoryAllocated(MemoryCategory::SOURCE, capacity * sizeof(StreamToken));
+    stream->tokens.swap(stream->segments[0]);
+    if (stream->segments.size() == 1) {
+        std::vector<std::vector<StreamToken>>().swap(stream->segments);
+        std::vector<char *>().swap(stream->segment_begins);
+    }
+    return ok;
+}
+
+void tokenStreamClear(TokenStream *stream) {
+    size_t capacity = stream->tokens.capacity();
+    for (const std::vector<StreamToken> &segment : stream->segments)
+        capacity += segment.capacity();
+    if (capacity)
+        memoryFreed(MemoryCategory::SOURCE, capacity * sizeof(StreamToken));
+    std::vector<StreamToken>().swap(stream->tokens);
+    std::vector<std::vector<StreamToken>>().swap(stream->segments);
+    std::vector<char *>().swap(stream->segment_begins);
+    stream->segment = 0;
+    stream->cursor = 0;
+}
+
+/// Make the segment `index` the one in `tokens`.
+static void tokenStreamSwitch(TokenStream *stream, size_t index) {
+    stream->tokens.swap(stream->segments[stream->segment]);
+    stream->tokens.swap(stream->segments[index]);
+    stream->segment = index;
+    stream->cursor = 0;
+}
+
+void lexUseTokenStream(TokenStream *stream) {
+    lex_token_stream = stream;
+}
+
+TokenStream *lexActiveTokenStream() {
+    return lex_token_stream;
+}
+
+/// Whether the token at `index` (or the end, at tokens.size()) is the first at or after `position`.
+static bool tokenStreamFirstAt(const std::vector<StreamToken> &tokens, size_t index, char *position) {
+    return index <= tokens.size()
+        && (index == tokens.size() || tokens[index].begin >= position)
+        && (index == 0 || tokens[index - 1].begin < position);
+}
+
+void tokenStreamNext(TokenStream *stream, char *position, Token *token) {
+    const std::vector<char *> &begins = stream->segment_begins;
+    size_t segment = stream->segment;
+    // The parser reads on in the same segment, or steps back into the previous one.
+    if (!begins.empty()
+        && (position < begins[segment] || (segment + 1 < begins.size() && position >= begins[segment + 1]))) {
+        segment = std::upper_bound(begins.begin(), begins.end(), position) - begins.begin();
+        tokenStreamSwitch(stream, segment ? segment - 1 : 0);
+    }
+    std::vector<StreamToken> &tokens = stream->tokens;
+    // The parser almost always asks for the token after the last one, or for
+    // the same one again when an expected token did not match.
+    size_t index = stream->cursor + 1;
+    if (!tokenStreamFirstAt(tokens, index, position)) {
+        index = stream->cursor;
+        if (!tokenStreamFirstAt(tokens, index, position)) {
+            index = std::lower_bound(tokens.begin(), tokens.end(), position,
+                                     [](const StreamToken &it, char *at) { return it.begin < at; }) - tokens.begin();
+        }
+    }
+    while (index == tokens.size() && stream->refill && stream->refill(stream)) {
+        index = std::lower_bound(tokens.begin(), tokens.end(), position,
+                                 [](const StreamToken &it, char *at) { return it.begin < at; }) - tokens.begin();
+    }
+    // Past the last token of its chunk, the next one starts a later segment.
+    while (index == tokens.size() && stream->segment + 1 < stream->segments.size()) {
+        tokenStreamSwitch(stream, stream->segment + 1);
+        index = 0;
+    }
+    stream->cursor = index;
+    if (index == tokens.size()) {
+        token->begin = stream->source + stream->length;
+        token->end = token->begin;
+        return;
+    }
+    token->begin = tokens[index].begin;
+    token->end = tokens[index].end;
+}
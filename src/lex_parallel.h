@@ -0,0 +1,75 @@
+#ifndef COMPILER_LEX_PARALLEL_H
+#define COMPILER_LEX_PARALLEL_H
+
+#include <cstddef>
+#include <vector>
+
+#include "error.h"
+#include "parser.h"
+
+/// A lexed token without Token's list link, to keep large streams small.
+struct StreamToken {
+    char *begin;
+    char *end;
+};
+
+/// Every token of a source buffer, in source order.
+struct TokenStream {
+    char *source;
+    size_t length;
+    /// Tokens of the segment being read.
+    std::vector<StreamToken> tokens;
+    /// Index in `tokens` of the token returned last.
+    size_t cursor;
+    /**
+     * lexParallel() keeps the tokens in fixed segments instead of copying
+     * them into one array as it goes. The segment being read is swapped into
+     * `tokens`, leaving its slot empty; `segment_begins` holds where each
+     * segment starts in the source. Both are empty for a stream of one
+     * segment.
+     */
+    std::vector<std::vector<StreamToken>> segments;
+    std::vector<char *> segment_begins;
+    size_t segment;
+    /**
+     * For a stream filled while it is read: called when the parser asks past
+     * the last token. It may drop the tokens before `cursor` (adjusting it)
+     * and appends the next ones. Returns false once no more tokens will come.
+     * NULL for a stream that already holds every token.
+     */
+    bool (*refill)(TokenStream *stream);
+    void *refill_data;
+
+    TokenStream():
+        source(nullptr),
+        length(0),
+        cursor(0),
+        segment(0),
+        refill(nullptr),
+        refill_data(nullptr)
+    {}
+};
+
+/**
+ * Tokenize `length` bytes of NUL-terminated `source` on up to `thread_count`
+ * threads (0 picks one per hardware thread). Comments end at a newline and
+ * no token spans one, so the source is cut into chunks just after newlines,
+ * and each chunk is lexed on its own into segments of the stream, which
+ * tokenStreamNext() reads in order without copying them together.
+ */
+Error lexParallel(char *source, size_t length, size_t thread_count, TokenStream *stream);
+
+/**
+ * Make lexAdvance() on this thread return tokens from `stream` instead of
+ * lexing, until called again with NULL. The stream's source must be the
+ * buffer being parsed.
+ */
+void lexUseTokenStream(TokenStream *stream);
+/// Release the stream's tokens.
+void tokenStreamClear(TokenStream *stream);
+TokenStream *lexActiveTokenStream();
+
+/// The token lex() would return at `position`; an empty one at the end of the source.
+void tokenStreamNext(TokenStream *stream, char *position, Token *token);
+
+#endif /* COMPILER_LEX_PARALLEL_H */
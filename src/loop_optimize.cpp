@@ -0,0 +1,356 @@
+#include "loop_optimize.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "environment.h"
+#include "node_walk.h"
+#include "timing.h"
+
+/// Variables a piece of code reads and assigns.
+struct LoopUses {
+    std::unordered_set<std::string> reads;
+    std::unordered_map<std::string, size_t> writes;
+    bool has_calls;
+    bool has_functions;
+
+    LoopUses():
+        has_calls(false),
+        has_functions(false)
+    {}
+};
+
+static WalkAction loopUsesVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)depth;
+    LoopUses *uses = static_cast<LoopUses *>(data);
+    switch (node->type) {
+        default:
+            return WalkAction::CONTINUE;
+        case NodeType::FUNCTION:
+            uses->has_functions = true;
+            return WalkAction::SKIP_CHILDREN;
+        case NodeType::FUNCTION_CALL:
+            uses->has_calls = true;
+            return WalkAction::CONTINUE;
+        case NodeType::SYMBOL:
+            break;
+    }
+    // Only some symbols stand for the value of a variable.
+    if (parent && node == parent->children) {
+        switch (parent->type) {
+            default:
+                break;
+            case NodeType::VARIABLE_REASSIGNMENT:
+                uses->writes[node->value.symbol] += 1;
+                return WalkAction::SKIP_CHILDREN;
+            case NodeType::FUNCTION_CALL:
+            case NodeType::BINARY_OPERATOR:
+            case NodeType::VARIABLE_DECLARATION:
+                return WalkAction::SKIP_CHILDREN;
+        }
+    }
+    if (parent && parent->type == NodeType::VARIABLE_DECLARATION && node != parent->children->next_child)
+        return WalkAction::SKIP_CHILDREN;
+    uses->reads.insert(node->value.symbol);
+    return WalkAction::SKIP_CHILDREN;
+}
+
+static void loopUsesAdd(LoopUses *uses, Node *node) {
+    nodeWalk(node, {loopUsesVisit, nullptr, uses});
+}
+
+struct LoopState {
+    /// The root context, where globals and types live.
+    ParsingContext *context;
+    Node *program;
+    const LoopOptions *options;
+    LoopStats *stats;
+    /// Variables some function reads: a call in a loop may observe them.
+    std::unordered_set<std::string> function_reads;
+    /// The function whose body is being optimized, or NULL at the top level.
+    Node *function;
+    size_t temporaries;
+};
+
+/**
+ * Whether `statement` assigns a value that no iteration changes, to a
+ * variable nothing else in the loop assigns and nothing before it in the
+ * body reads. The condition may read it: the first test runs before the
+ * preheader either way.
+ * @param before Uses of the body statements before `statement`.
+ * @param hoisted Variables assigned by statements already hoisted, which are invariant now.
+ */
+static bool loopIsInvariantAssignment(LoopState *state, Node *statement, const LoopUses &uses, const LoopUses &before,
+                                      const std::unordered_set<std::string> &hoisted) {
+    if (statement->type != NodeType::VARIABLE_REASSIGNMENT)
+        return false;
+    const char *name = statement->children->value.symbol;
+    if (uses.writes.at(name) != 1 || before.reads.count(name))
+        return false;
+    if (uses.has_calls && state->function_reads.count(name))
+        return false;
+    LoopUses value;
+    loopUsesAdd(&value, statement->children->next_child);
+    if (value.has_calls || value.has_functions)
+        return false;
+    for (const std::string &read : value.reads)
+        if (uses.writes.count(read) && !hoisted.count(read))
+            return false;
+    return true;
+}
+
+/// Move the direct body statements that compute the same value every iteration to the preheader.
+static void loopHoist(LoopState *state, Node *loop, const LoopUses &uses) {
+    Node *body = loop->children->next_child;
+    Node *preheader = body->next_child;
+    Node **tail = &preheader->children;
+    while (*tail)
+        tail = &(*tail)->next_child;
+    LoopUses before;
+    std::unordered_set<std::string> hoisted;
+    Node **link = &body->children;
+    while (*link) {
+        Node *statement = *link;
+        bool invariant = loopIsInvariantAssignment(state, statement, uses, before, hoisted);
+        loopUsesAdd(&before, statement);
+        if (!invariant) {
+            link = &statement->next_child;
+            continue;
+        }
+        *link = statement->next_child;
+        statement->next_child = nullptr;
+        *tail = statement;
+        tail = &statement->next_child;
+        hoisted.insert(statement->children->value.symbol);
+        state->stats->hoisted += 1;
+    }
+}
+
+/// Type symbol of a variable visible in the code being optimized, or NULL.
+static Node *loopVariableType(LoopState *state, const char *name) {
+    if (state->function) {
+        for (Node *parameter = state->function->children->children; parameter; parameter = parameter->next_child)
+            if (strcmp(parameter->children->value.symbol, name) == 0)
+                return parameter->children->next_child;
+        Node *body = state->function->children->next_child->next_child;
+        for (Node *expression = body->children; expression; expression = expression->next_child)
+            if (expression->type == NodeType::VARIABLE_DECLARATION && strcmp(expression->children->value.symbol, name) == 0)
+                return expression->children->next_child->next_child;
+    }
+    for (Binding *it = state->context->variables->bind; it; it = it->next)
+        if (strcmp(it->id->value.symbol, name) == 0)
+            return it->value;
+    return nullptr;
+}
+
+/**
+ * Whether `statement` is the only update `i := i + c`, `i := c + i` or
+ * `i := i - c` of a 64-bit variable `i`, where products wrap around exactly
+ * like the repeated additions that replace them.
+ */
+static bool loopInductionStep(LoopState *state, Node *statement, const LoopUses &uses, long long *step) {
+    if (statement->type != NodeType::VARIABLE_REASSIGNMENT)
+        return false;
+    const char *name = statement->children->value.symbol;
+    auto writes = uses.writes.find(name);
+    if (writes == uses.writes.end() || writes->second != 1)
+        return false;
+    Node *value = statement->children->next_child;
+    if (value->type != NodeType::BINARY_OPERATOR)
+        return false;
+    char op = value->children->value.symbol[0];
+    Node *left = value->children->next_child;
+    Node *right = left->next_child;
+    auto is_variable = [&](Node *node) {
+        return node->type == NodeType::SYMBOL && strcmp(node->value.symbol, name) == 0;
+    };
+    if (op == '+' && is_variable(left) && right->type == NodeType::INTEGER)
+        *step = right->value.integer;
+    else if (op == '+' && left->type == NodeType::INTEGER && is_variable(right))
+        *step = left->value.integer;
+    else if (op == '-' && is_variable(left) && right->type == NodeType::INTEGER)
+        *step = static_cast<long long>(0ull - static_cast<unsigned long long>(right->value.integer));
+    else
+        return false;
+
+    Node *type_id = loopVariableType(state, name);
+    Node type_info;
+    if (!type_id || parseGetType(state->context, type_id, &type_info).type != ErrorType::NONE)
+        return false;
+    return typeSize(&type_info) == 8;
+}
+
+struct LoopProducts {
+    const char *variable;
+    std::vector<Node *> found;
+};
+
+static WalkAction loopProductsVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    LoopProducts *products = static_cast<LoopProducts *>(data);
+    if (node->type != NodeType::BINARY_OPERATOR || node->children->value.symbol[0] != '*')
+        return WalkAction::CONTINUE;
+    Node *left = node->children->next_child;
+    Node *right = left->next_child;
+    if ((left->type == NodeType::SYMBOL && strcmp(left->value.symbol, products->variable) == 0
+         && right->type == NodeType::INTEGER)
+        || (right->type == NodeType::SYMBOL && strcmp(right->value.symbol, products->variable) == 0
+            && left->type == NodeType::INTEGER)) {
+        products->found.push_back(node);
+        return WalkAction::SKIP_CHILDREN;
+    }
+    return WalkAction::CONTINUE;
+}
+
+static Node *loopOperator(const char *op, Node *left, Node *right) {
+    Node *node = nodeAllocate();
+    node->type = NodeType::BINARY_OPERATOR;
+    nodeAddChild(node, nodeSymbol(op));
+    nodeAddChild(node, left);
+    nodeAddChild(node, right);
+    return node;
+}
+
+static Node *loopAssignment(const char *name, Node *value) {
+    Node *node = nodeAllocate();
+    node->type = NodeType::VARIABLE_REASSIGNMENT;
+    nodeAddChild(node, nodeSymbol(name));
+    nodeAddChild(node, value);
+    return node;
+}
+
+/// Declare a new global integer, at the end of the program so it lands in .bss.
+static std::string loopTemporary(LoopState *state) {
+    std::string name;
+    Node type_id;
+    do {
+        name = "__sr_" + std::to_string(state->temporaries++);
+    } while (environmentGetBySymbol(*state->context->variables, &name[0], &type_id));
+    environmentSet(state->context->variables, nodeSymbol(name.c_str()), nodeSymbol("integer"));
+    Node *declaration = nodeAllocate();
+    declaration->type = NodeType::VARIABLE_DECLARATION;
+    nodeAddChild(declaration, nodeSymbol(name.c_str()));
+    nodeAddChild(declaration, nodeAllocate());
+    nodeAddChild(declaration, nodeSymbol("integer"));
+    nodeAddChild(state->program, declaration);
+    return name;
+}
+
+/**
+ * For each induction variable `i` stepped by `c`, replace the products
+ * `i * k` in the body by a variable `t` that the preheader sets to `i * k`
+ * and that is stepped by `c * k` right after `i` is. Not done in loops that
+ * call functions, which could read `t` before it is stepped.
+ */
+static void loopReduceStrength(LoopState *state, Node *loop, const LoopUses &uses) {
+    if (uses.has_calls)
+        return;
+    Node *body = loop->children->next_child;
+    Node *preheader = body->next_child;
+    for (Node *update = body->children; update; update = update->next_child) {
+        long long step = 0;
+        if (!loopInductionStep(state, update, uses, &step))
+            continue;
+        LoopProducts products;
+        products.variable = update->children->value.symbol;
+        for (Node *statement = body->children; statement; statement = statement->next_child)
+            nodeWalk(statement, {loopProductsVisit, nullptr, &products});
+
+        std::unordered_map<long long, std::string> reduced;
+        for (Node *product : products.found) {
+            Node *left = product->children->next_child;
+            long long factor = left->type == NodeType::INTEGER ? left->value.integer : left->next_child->value.integer;
+            auto found = reduced.find(factor);
+            if (found == reduced.end()) {
+                std::string name = loopTemporary(state);
+                nodeAddChild(preheader, loopAssignment(name.c_str(),
+                    loopOperator("*", nodeSymbol(products.variable), nodeInteger(factor))));
+                long long increment = static_cast<long long>(static_cast<unsigned long long>(step)
+                                                             * static_cast<unsigned long long>(factor));
+                Node *stepper = loopAssignment(name.c_str(),
+                    loopOperator("+", nodeSymbol(name.c_str()), nodeInteger(increment)));
+                stepper->next_child = update->next_child;
+                update->next_child = stepper;
+                found = reduced.emplace(factor, name).first;
+            }
+            // The product becomes a read of the new variable.
+            for (Node *child = product->children; child;) {
+                Node *next = child->next_child;
+                deleteNode(child);
+                child = next;
+            }
+            Node *symbol = nodeSymbol(found->second.c_str());
+            product->type = NodeType::SYMBOL;
+            product->value.symbol = symbol->value.symbol;
+            product->children = nullptr;
+            nodeFree(symbol);
+            state->stats->reduced += 1;
+        }
+    }
+}
+
+static void loopOptimize(LoopState *state, Node *loop) {
+    state->stats->loops += 1;
+    LoopUses uses;
+    loopUsesAdd(&uses, loop);
+    // Definitions are emitted where they appear; moving code around them is not worth it.
+    if (uses.has_functions) {
+        state->stats->skipped += 1;
+        return;
+    }
+    if (state->options->hoist_invariants)
+        loopHoist(state, loop, uses);
+    if (state->options->reduce_strength)
+        loopReduceStrength(state, loop, uses);
+}
+
+/// Optimize the loops of a statement list, each after the loops nested in it.
+static void loopOptimizeList(LoopState *state, Node *statement) {
+    for (; statement; statement = statement->next_child) {
+        if (statement->type != NodeType::WHILE)
+            continue;
+        loopOptimizeList(state, statement->children->next_child->children);
+        loopOptimize(state, statement);
+    }
+}
+
+Error loopOptimizeProgram(ParsingContext *context, Node *program, const LoopOptions &options, LoopStats *stats) {
+    TimingScope timing("optimize loops");
+    Error err = ok;
+    if (!context || !program || program->type != NodeType::PROGRAM || !stats) {
+        err.prepareError(ErrorType::ARGUMENTS, "loopOptimizeProgram() requires a context, a program and stats!");
+        return err;
+    }
+    *stats = LoopStats();
+    LoopState state;
+    state.context = context;
+    state.program = program;
+    state.options = &options;
+    state.stats = stats;
+    state.function = nullptr;
+    state.temporaries = 0;
+
+    LoopUses function_uses;
+    for (Binding *function = context->functions->bind; function; function = function->next)
+        loopUsesAdd(&function_uses, function->value->children->next_child->next_child);
+    state.function_reads = std::move(function_uses.reads);
+
+    for (Binding *function = context->functions->bind; function; function = function->next) {
+        state.function = function->value;
+        loopOptimizeList(&state, function->value->children->next_child->next_child->children);
+    }
+    state.function = nullptr;
+    loopOptimizeList(&state, program->children);
+    return ok;
+}
+
+void printLoopStats(const LoopStats &stats, std::ostream &out) {
+    out << "Loops: " << stats.loops << " loops, "
+        << stats.hoisted << " statements hoisted, "
+        << stats.reduced << " multiplications strength reduced, "
+        << stats.skipped << " skipped\n";
+}
@@ -0,0 +1,38 @@
+#ifndef COMPILER_LOOP_OPTIMIZE_H
+#define COMPILER_LOOP_OPTIMIZE_H
+
+#include <cstddef>
+#include <ostream>
+
+#include "error.h"
+#include "parser.h"
+
+struct LoopOptions {
+    /// Move assignments whose value does not change between iterations into the loop's preheader.
+    bool hoist_invariants;
+    /// Replace `i * k` of an induction variable `i` by a variable stepped along with `i`.
+    bool reduce_strength;
+
+    LoopOptions():
+        hoist_invariants(true),
+        reduce_strength(true)
+    {}
+};
+
+struct LoopStats {
+    size_t loops;
+    size_t hoisted;
+    size_t reduced;
+    /// Loops left alone because they define a function.
+    size_t skipped;
+};
+
+/**
+ * Optimize every `while` loop of the program and of its functions, innermost
+ * first. Hoisted statements run once, after the loop's condition was first
+ * found true; strength reduction adds globals named `__sr_<n>`.
+ */
+Error loopOptimizeProgram(ParsingContext *context, Node *program, const LoopOptions &options, LoopStats *stats);
+void printLoopStats(const LoopStats &stats, std::ostream &out);
+
+#endif /* COMPILER_LOOP_OPTIMIZE_H */
@@ -3,43 +3,438 @@
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <climits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 #include "codegen.h"
+#include "compile_server.h"
+#include "const_eval.h"
+#include "compiler.h"
 #include "error.h"
 #include "file_io.h"
 #include "environment.h"
+#include "inline.h"
+#include "loop_optimize.h"
+#include "lex_parallel.h"
+#include "memory_stats.h"
 #include "parser.h"
+#include "pass_manager.h"
+#include "pipeline.h"
+#include "record_layout.h"
+#include "timing.h"
+#include "toolchain.h"
 
 void displayUsage(char **argv) {
-    std::cout << "Usage: " << argv[0] << " <file_path>";
+    std::cout << "Usage: " << argv[0] << " [options] <file_path>\n"
+              << "Options:\n"
+              << "  --stream          Emit code for each top-level expression as soon as it is\n"
+              << "                    parsed and free it; memory stays bounded, AST is not printed\n"
+              << "  --pipeline        Like --stream, with lexing, parsing and code generation\n"
+              << "                    overlapped on three threads\n"
+              << "  --pipeline-stats  With --pipeline, print how long each stage waited on a queue\n"
+              << "  -o <file>         Build an executable: pipe the code straight into as and ld\n"
+              << "                    (cc for --emit-c) instead of writing code.S\n"
+              << "  --save-temps      With -o, keep the code and object file as <file>.S and <file>.o\n"
+              << "  --emit-c          Write portable C99 to code.c instead of assembly to code.S\n"
+              << "  --lazy-parse      Skip function bodies by brace matching and parse only those\n"
+              << "                    of functions the program calls; unused ones are dropped\n"
+              << "  --dump-layouts    Print the size, alignment and field offsets of every record type\n"
+              << "  -O0, -O1, -O2     Optimization level: -O1 runs const-eval and loops, -O2 also\n"
+              << "                    inline; passes asked for by name run at any level (default -O0)\n"
+              << "  --print-after <pass>  Print the AST after the named pass has run\n"
+              << "  --pass-stats      Print the time and the number of AST nodes changed per pass\n"
+              << "  --const-eval      Evaluate calls to pure functions with literal arguments at\n"
+              << "                    compile time and replace them by their values\n"
+              << "  --const-eval-stats  Print what the constant evaluator did\n"
+              << "  --inline          Inline small functions at their call sites\n"
+              << "  --inline-threshold <n>  Largest function body, in AST nodes, to inline (default 16)\n"
+              << "  --inline-depth <n>      How deep inlined code is inlined into again (default 4)\n"
+              << "  --inline-stats    Print what the inliner did\n"
+              << "  --optimize-loops  Hoist loop-invariant assignments out of loops and replace\n"
+              << "                    multiplications of induction variables by additions\n"
+              << "  --loop-stats      Print what the loop optimizer did\n"
+              << "  --profile-generate <file>  Count calls to every function; the program writes\n"
+              << "                    the counts to <file> when it exits (Linux only)\n"
+              << "  --profile-use <file>  Inline hot callees, skip cold ones, and lay out and\n"
+              << "                    align hot functions using the counts in <file>\n"
+              << "  --time-passes     Print time spent in each compiler phase\n"
+              << "  --trace <file>    Write phase timings as a Chrome trace_event JSON file\n"
+              << "  --memory-report   Print live, peak and leaked bytes per compiler subsystem\n"
+              << "  --lex-threads <n> Tokenize the whole file up front on n threads (0: all cores)\n"
+              << "  --serve <socket>  Run as a compile server on a Unix domain socket\n"
+              << "  --connect <socket>  Send the compile job to a server instead of compiling here\n";
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        displayUsage(argv);
-        return 0;
+void reportTiming(const char *trace_path) {
+    if (memory_accounting_enabled)
+        memoryPrintReport(std::cout);
+    if (!timing_enabled)
+        return;
+    timingPrintSummary(std::cout);
+    if (trace_path) {
+        Error err = timingWriteChromeTrace(trace_path);
+        if (err.type != ErrorType::NONE)
+            printError(err);
     }
+}
 
-    Node *program = nodeAllocate();
-    ParsingContext *context = parseContextDefaultCreate();
-    Error err = parseProgram(argv[1], context, program);
-
-    printNode(program, 0);
-    std::cout << '\n';
+Error streamExpression(Node *expression, void *data) {
+    return codegen_stream_expression(static_cast<CodegenStream *>(data), expression);
+}
 
-    if(err.type != ErrorType::NONE) {
+int compileStreaming(char *source_path, CodegenOutputFormat format) {
+    TimingScope timing("total");
+    ParsingContext *context = parseContextDefaultCreate();
+    CodegenStream stream;
+    Error err = codegen_stream_begin(&stream, format, context);
+    if (err.type == ErrorType::NONE) {
+        TimingScope timing("parseProgramStream");
+        err = parseProgramStream(source_path, context, streamExpression, &stream);
+    }
+    if (err.type == ErrorType::NONE)
+        err = codegen_stream_end(&stream);
+    // parseProgramStream() leaves function definitions to the functions environment.
+    for (Binding *it = context->functions->bind; it; it = it->next)
+        deleteNode(it->value);
+    parseContextReset(context);
+    parseContextDelete(context);
+    if (err.type != ErrorType::NONE) {
         printError(err);
         return 1;
     }
+    return 0;
+}
 
-    err = codegen_program(CodegenOutputFormat::DEFAULT, context, program);
-    if(err.type != ErrorType::NONE) {
+int compilePipelined(char *source_path, CodegenOutputFormat format, bool print_stats) {
+    PipelineStats stats;
+    Error err = ok;
+    {
+        TimingScope timing("total");
+        err = pipelineCompile(source_path, format, &stats);
+    }
+    if (print_stats)
+        printPipelineStats(stats, std::cout);
+    if (err.type != ErrorType::NONE) {
         printError(err);
-        return 2;
+        return 1;
     }
+    return 0;
+}
 
-    deleteNode(program);
+/// Absolute form of `path`, since the server may run in another directory.
+std::string absolutePath(const char *path) {
+#if defined(__unix__) || defined(__APPLE__)
+    if (path[0] == '/')
+        return path;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)))
+        return std::string(cwd) + '/' + path;
+#endif
+    return path;
+}
 
+int compileRemote(const char *socket_path, char *source_path, const CompileOptions &options) {
+    std::string request = "compile";
+    if (options.format == CodegenOutputFormat::C99)
+        request += " --emit-c";
+    if (options.optimization_level)
+        request += " -O" + std::to_string(options.optimization_level);
+    if (options.lazy_parse)
+        request += " --lazy-parse";
+    if (options.evaluate_calls)
+        request += " --const-eval";
+    if (options.inline_functions) {
+        request += " --inline-threshold " + std::to_string(options.inline_options.max_body_nodes);
+        request += " --inline-depth " + std::to_string(options.inline_options.max_depth);
+    }
+    if (options.optimize_loops)
+        request += " --optimize-loops";
+    request += ' ' + absolutePath(source_path) + ' ' + absolutePath(codegen_output_path(options.format));
+    std::string reply;
+    Error err = compileServerRequest(socket_path, request, &reply);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        return 1;
+    }
+    if (reply.compare(0, 2, "ok") != 0) {
+        std::cout << reply << '\n';
+        return 1;
+    }
     return 0;
 }
 
+Error parseProgramParallelLex(char *source_path, size_t lex_threads, ParsingContext *context, Node *program) {
+    char *contents = nullptr;
+    {
+        TimingScope timing("FileContents", source_path);
+        contents = FileContents(source_path);
+    }
+    TokenStream tokens;
+    Error err = ok;
+    {
+        TimingScope timing("lexParallel");
+        err = lexParallel(contents, std::strlen(contents), lex_threads, &tokens);
+    }
+    if (err.type == ErrorType::NONE) {
+        TimingScope timing("parseProgram");
+        lexUseTokenStream(&tokens);
+        err = parseProgramBuffer(contents, context, program);
+        lexUseTokenStream(nullptr);
+    }
+    tokenStreamClear(&tokens);
+    fileContentsFree(contents);
+    return err;
+}
+
+/// Everything main() does but report timing, so that every exit reports it.
+int compileMain(int argc, char **argv, char **trace_path) {
+    char *source_path = nullptr;
+    char *serve_path = nullptr;
+    char *connect_path = nullptr;
+    bool stream = false;
+    bool pipeline = false;
+    bool pipeline_stats = false;
+    bool lex_parallel = false;
+    size_t lex_threads = 0;
+    bool dump_layouts = false;
+    int optimization_level = 0;
+    bool lazy_parse = false;
+    const char *print_after = nullptr;
+    bool pass_stats = false;
+    bool evaluate_calls = false;
+    bool const_eval_stats = false;
+    bool inline_functions = false;
+    bool inline_stats = false;
+    InlineOptions inline_options;
+    bool optimize_loops = false;
+    bool loop_stats = false;
+    CodegenOutputFormat format = CodegenOutputFormat::DEFAULT;
+    CodegenOptions codegen_options;
+    char *profile_path = nullptr;
+    Profile profile;
+    char *output_path = nullptr;
+    ToolchainOptions toolchain_options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = true;
+        } else if (strcmp(argv[i], "--pipeline-stats") == 0) {
+            pipeline = true;
+            pipeline_stats = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-temps") == 0) {
+            toolchain_options.save_temps = true;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            format = CodegenOutputFormat::C99;
+        } else if (strcmp(argv[i], "--dump-layouts") == 0) {
+            dump_layouts = true;
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0) {
+            optimization_level = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--lazy-parse") == 0) {
+            lazy_parse = true;
+        } else if (strncmp(argv[i], "--print-after=", 14) == 0) {
+            print_after = argv[i] + 14;
+        } else if (strcmp(argv[i], "--print-after") == 0 && i + 1 < argc) {
+            print_after = argv[++i];
+        } else if (strcmp(argv[i], "--pass-stats") == 0) {
+            pass_stats = true;
+        } else if (strcmp(argv[i], "--const-eval") == 0) {
+            evaluate_calls = true;
+        } else if (strcmp(argv[i], "--const-eval-stats") == 0) {
+            evaluate_calls = true;
+            const_eval_stats = true;
+        } else if (strcmp(argv[i], "--inline") == 0) {
+            inline_functions = true;
+        } else if (strcmp(argv[i], "--inline-threshold") == 0 && i + 1 < argc) {
+            inline_functions = true;
+            inline_options.max_body_nodes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--inline-depth") == 0 && i + 1 < argc) {
+            inline_functions = true;
+            inline_options.max_depth = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--inline-stats") == 0) {
+            inline_stats = true;
+        } else if (strcmp(argv[i], "--optimize-loops") == 0) {
+            optimize_loops = true;
+        } else if (strcmp(argv[i], "--loop-stats") == 0) {
+            optimize_loops = true;
+            loop_stats = true;
+        } else if (strcmp(argv[i], "--profile-generate") == 0 && i + 1 < argc) {
+            format = CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED;
+            codegen_options.profile_path = argv[++i];
+        } else if (strcmp(argv[i], "--profile-use") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+            inline_functions = true;
+        } else if (strcmp(argv[i], "--memory-report") == 0) {
+            memoryAccountingEnable(true);
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            timingEnable(true);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            *trace_path = argv[++i];
+            timingEnable(true);
+        } else if (strcmp(argv[i], "--lex-threads") == 0 && i + 1 < argc) {
+            lex_parallel = true;
+            lex_threads = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_path = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            std::cout << "Unknown option: " << argv[i] << '\n';
+            displayUsage(argv);
+            return 1;
+        } else {
+            source_path = argv[i];
+        }
+    }
+    if (print_after && !passFind(print_after)) {
+        std::cout << "Unknown pass: " << print_after << "\nPasses:";
+        for (const Pass &pass : passRegistry())
+            std::cout << ' ' << pass.name;
+        std::cout << '\n';
+        return 1;
+    }
+    if (serve_path) {
+        Compiler *compiler = compilerCreate();
+        Error err = compileServerRun(compiler, serve_path);
+        compilerDelete(compiler);
+        if (err.type != ErrorType::NONE) {
+            printError(err);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!source_path) {
+        displayUsage(argv);
+        return 0;
+    }
+
+    if (profile_path) {
+        Error err = profileRead(profile_path, &profile);
+        if (err.type != ErrorType::NONE) {
+            printError(err);
+            return 1;
+        }
+        inline_options.profile = &profile;
+        codegen_options.profile = &profile;
+        if (inline_stats)
+            printProfile(profile, std::cout);
+    }
+
+    if (connect_path && (profile_path || format == CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED)) {
+        std::cout << "Profile options are not supported with --connect\n";
+        return 1;
+    }
+    if (output_path && (connect_path || stream || pipeline)) {
+        std::cout << "-o is not supported with --connect, --stream or --pipeline\n";
+        return 1;
+    }
+    // Each expression is emitted as soon as it is parsed, so nothing sees the whole program.
+    if ((stream || pipeline)
+        && (optimization_level > 0 || print_after || pass_stats || evaluate_calls || inline_functions || inline_stats
+            || optimize_loops || lazy_parse || lex_parallel || dump_layouts)) {
+        std::cout << "-O1, -O2, --print-after, --pass-stats, --const-eval, --inline, --optimize-loops, --lazy-parse, "
+                     "--lex-threads and --dump-layouts are not supported with --stream or --pipeline\n";
+        return 1;
+    }
+    CompileOptions options;
+    options.format = format;
+    options.optimization_level = optimization_level;
+    options.lazy_parse = lazy_parse;
+    options.evaluate_calls = evaluate_calls;
+    options.inline_functions = inline_functions;
+    options.inline_options = inline_options;
+    options.optimize_loops = optimize_loops;
+    if (connect_path)
+        return compileRemote(connect_path, source_path, options);
+
+    if (pipeline)
+        return compilePipelined(source_path, format, pipeline_stats);
+    if (stream)
+        return compileStreaming(source_path, format);
+
+    int status = 0;
+    Node *program = nodeAllocate();
+    Error err = ok;
+    ParsingContext *context = nullptr;
+    {
+        TimingScope timing("total");
+        context = parseContextDefaultCreate();
+        context->defer_bodies = lazy_parse;
+        if (lex_parallel) {
+            err = parseProgramParallelLex(source_path, lex_threads, context, program);
+        } else {
+            TimingScope timing("parseProgram");
+            err = parseProgram(source_path, context, program);
+        }
+
+        {
+            TimingScope timing("printNode");
+            printNode(program, 0);
+            std::cout << '\n';
+        }
+
+        if(err.type != ErrorType::NONE) {
+            printError(err);
+            status = 1;
+        }
+
+        if (status == 0 && dump_layouts)
+            printRecordLayouts(context, std::cout);
+
+        if (status == 0) {
+            std::vector<const Pass *> pipeline;
+            err = passPipelineBuild(options, &pipeline);
+            PassRunOptions run_options;
+            run_options.print_after = print_after;
+            run_options.count_changes = pass_stats;
+            if (const_eval_stats)
+                run_options.report.push_back("const-eval");
+            if (inline_stats)
+                run_options.report.push_back("inline");
+            if (loop_stats)
+                run_options.report.push_back("loops");
+            std::vector<PassStats> stats;
+            if (err.type == ErrorType::NONE)
+                err = passPipelineRun(pipeline, context, program, options, run_options, &stats, std::cout);
+            if(err.type != ErrorType::NONE) {
+                printError(err);
+                status = 1;
+            } else if (pass_stats) {
+                printPassStats(stats, std::cout);
+            }
+        }
+
+        if (status == 0) {
+            if (output_path) {
+                err = toolchainBuildExecutable(format, context, program, output_path, codegen_options,
+                                               toolchain_options);
+            } else {
+                TimingScope timing("codegen_program");
+                err = codegen_program(format, context, program, codegen_options);
+            }
+            if(err.type != ErrorType::NONE) {
+                printError(err);
+                status = 2;
+            }
+        }
+
+        deleteNode(program);
+        parseContextReset(context);
+        parseContextDelete(context);
+    }
+    return status;
+}
+
+int main(int argc, char **argv) {
+    char *trace_path = nullptr;
+    int status = compileMain(argc, argv, &trace_path);
+    reportTiming(trace_path);
+    return status;
+}
+
@@ -0,0 +1,90 @@
+#include "memory_stats.h"
+
+#include <atomic>
+#include <iomanip>
+
+bool memory_accounting_enabled = false;
+
+struct MemoryCounters {
+    std::atomic<size_t> live_bytes;
+    std::atomic<size_t> peak_bytes;
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> frees;
+};
+
+static MemoryCounters memory_counters[static_cast<size_t>(MemoryCategory::MAX)];
+/// Peak of the sum over all categories, which is not the sum of their peaks.
+static std::atomic<size_t> memory_total_live(0);
+static std::atomic<size_t> memory_total_peak(0);
+
+void memoryAccountingEnable(bool enable) {
+    memory_accounting_enabled = enable;
+}
+
+static void memoryRaisePeak(std::atomic<size_t> &peak, size_t value) {
+    size_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
+
+void memoryRecordAllocation(MemoryCategory category, size_t bytes) {
+    MemoryCounters &counters = memory_counters[static_cast<size_t>(category)];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    memoryRaisePeak(counters.peak_bytes, counters.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    memoryRaisePeak(memory_total_peak, memory_total_live.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void memoryRecordFree(MemoryCategory category, size_t bytes) {
+    MemoryCounters &counters = memory_counters[static_cast<size_t>(category)];
+    counters.frees.fetch_add(1, std::memory_order_relaxed);
+    counters.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    memory_total_live.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+MemoryCategoryStats memoryStats(MemoryCategory category) {
+    const MemoryCounters &counters = memory_counters[static_cast<size_t>(category)];
+    return {
+        counters.live_bytes.load(std::memory_order_relaxed),
+        counters.peak_bytes.load(std::memory_order_relaxed),
+        counters.allocations.load(std::memory_order_relaxed),
+        counters.frees.load(std::memory_order_relaxed)
+    };
+}
+
+const char *memoryCategoryName(MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::AST:          return "AST nodes";
+        case MemoryCategory::SYMBOLS:      return "symbols";
+        case MemoryCategory::ENVIRONMENTS: return "environments";
+        case MemoryCategory::CONTEXTS:     return "contexts";
+        case MemoryCategory::CODEGEN:      return "codegen buffers";
+        case MemoryCategory::SOURCE:       return "source";
+        case MemoryCategory::MAX:          break;
+    }
+    return "unknown";
+}
+
+void memoryPrintReport(std::ostream &out) {
+    out << "===-------------------------------------------------------------===\n";
+    out << "                      Compiler memory usage\n";
+    out << "===-------------------------------------------------------------===\n";
+    out << std::left << std::setw(18) << "Subsystem"
+        << std::right << std::setw(14) << "Peak (KiB)"
+        << std::setw(16) << "Leaked (KiB)"
+        << std::setw(14) << "Allocations"
+        << std::setw(12) << "Frees" << '\n';
+    for (size_t i = 0; i < static_cast<size_t>(MemoryCategory::MAX); i++) {
+        MemoryCategory category = static_cast<MemoryCategory>(i);
+        MemoryCategoryStats stats = memoryStats(category);
+        out << std::left << std::setw(18) << memoryCategoryName(category)
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(14) << stats.peak_bytes / 1024.0
+            << std::setw(16) << stats.live_bytes / 1024.0
+            << std::setw(14) << stats.allocations
+            << std::setw(12) << stats.frees << '\n';
+    }
+    out << std::left << std::setw(18) << "total"
+        << std::right << std::setw(14) << memory_total_peak.load(std::memory_order_relaxed) / 1024.0
+        << std::setw(16) << memory_total_live.load(std::memory_order_relaxed) / 1024.0 << '\n';
+    out << "Sizes are requested bytes, without allocator overhead; leaked is what is still live.\n";
+}
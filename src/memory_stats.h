@@ -0,0 +1,48 @@
+#ifndef COMPILER_MEMORY_STATS_H
+#define COMPILER_MEMORY_STATS_H
+
+#include <cstddef>
+#include <ostream>
+
+/// Subsystems that memory is accounted to.
+enum class MemoryCategory {
+    AST = 0,
+    SYMBOLS,
+    ENVIRONMENTS,
+    CONTEXTS,
+    CODEGEN,
+    /// Source text and token streams.
+    SOURCE,
+    MAX
+};
+
+/// Set by `--memory-report`; every probe checks it before recording anything.
+extern bool memory_accounting_enabled;
+
+void memoryAccountingEnable(bool enable);
+void memoryRecordAllocation(MemoryCategory category, size_t bytes);
+void memoryRecordFree(MemoryCategory category, size_t bytes);
+
+inline void memoryAllocated(MemoryCategory category, size_t bytes) {
+    if (memory_accounting_enabled)
+        memoryRecordAllocation(category, bytes);
+}
+
+inline void memoryFreed(MemoryCategory category, size_t bytes) {
+    if (memory_accounting_enabled)
+        memoryRecordFree(category, bytes);
+}
+
+struct MemoryCategoryStats {
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t allocations;
+    size_t frees;
+};
+
+MemoryCategoryStats memoryStats(MemoryCategory category);
+const char *memoryCategoryName(MemoryCategory category);
+/// Live, peak and counts per subsystem; run at exit, live bytes are what leaked.
+void memoryPrintReport(std::ostream &out);
+
+#endif /* COMPILER_MEMORY_STATS_H */
@@ -0,0 +1,146 @@
+#include "node_intern.h"
+
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "node_walk.h"
+#include "parser.h"
+
+struct NodeInternHash {
+    size_t operator()(const Node *node) const {
+        return node->hash;
+    }
+};
+
+/// Children and siblings are already canonical, so comparing pointers is enough.
+struct NodeInternEqual {
+    bool operator()(const Node *a, const Node *b) const {
+        return a->hash == b->hash
+            && a->children == b->children
+            && a->next_child == b->next_child
+            && nodeValueEqual(a, b);
+    }
+};
+
+struct NodeInterner {
+    std::unordered_set<Node *, NodeInternHash, NodeInternEqual> nodes;
+    size_t lookups;
+    size_t hits;
+};
+
+static unsigned int nodeInternMix(unsigned int hash, unsigned long long value) {
+    // FNV-1a over the bytes of value.
+    for (size_t i = 0; i < sizeof(value); i++) {
+        hash ^= static_cast<unsigned char>(value >> (i * 8));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned int nodeInternComputeHash(const Node *node) {
+    unsigned int hash = 2166136261u;
+    hash = nodeInternMix(hash, static_cast<unsigned long long>(node->type));
+    if (node->isSymbol()) {
+        for (const char *it = node->value.symbol; it && *it; it++) {
+            hash ^= static_cast<unsigned char>(*it);
+            hash *= 16777619u;
+        }
+    } else if (node->isInteger()) {
+        hash = nodeInternMix(hash, static_cast<unsigned long long>(node->value.integer));
+    }
+    hash = nodeInternMix(hash, node->children ? node->children->hash : 0);
+    hash = nodeInternMix(hash, node->next_child ? node->next_child->hash : 0);
+    // 0 marks an ordinary node.
+    return hash ? hash : 1;
+}
+
+NodeInterner *nodeInternerCreate() {
+    NodeInterner *interner = new NodeInterner();
+    interner->lookups = 0;
+    interner->hits = 0;
+    return interner;
+}
+
+void nodeInternerDelete(NodeInterner *interner) {
+    if (!interner)
+        return;
+    for (Node *node : interner->nodes) {
+        if (node->isSymbol())
+            symbolFree(node->value.symbol);
+        nodeFree(node);
+    }
+    delete interner;
+}
+
+static Node *nodeInternOne(NodeInterner *interner, const Node *original, Node *children, Node *next_child) {
+    Node candidate = *original;
+    candidate.children = children;
+    candidate.next_child = next_child;
+    candidate.hash = nodeInternComputeHash(&candidate);
+
+    interner->lookups += 1;
+    auto found = interner->nodes.find(&candidate);
+    if (found != interner->nodes.end()) {
+        interner->hits += 1;
+        return *found;
+    }
+
+    Node *node = nodeAllocate();
+    *node = candidate;
+    if (original->isSymbol() && original->value.symbol) {
+        size_t length = strlen(original->value.symbol);
+        node->value.symbol = symbolAllocate(length);
+        std::memcpy(node->value.symbol, original->value.symbol, length + 1);
+    }
+    interner->nodes.insert(node);
+    return node;
+}
+
+struct NodeInternState {
+    NodeInterner *interner;
+    /// Canonical child list of every finished node whose parent is not finished yet.
+    std::vector<std::pair<Node *, Node *>> finished;
+};
+
+static WalkAction nodeInternVisit(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    NodeInternState *state = static_cast<NodeInternState *>(data);
+    size_t child_count = 0;
+    for (Node *child = node->children; child; child = child->next_child)
+        child_count += 1;
+
+    // Post-order: the last `child_count` finished entries are this node's
+    // children, in order. Intern them back to front so each sibling list
+    // suffix is canonical before the node in front of it.
+    Node *list = nullptr;
+    for (size_t i = 0; i < child_count; i++) {
+        std::pair<Node *, Node *> child = state->finished.back();
+        state->finished.pop_back();
+        list = nodeInternOne(state->interner, child.first, child.second, list);
+    }
+    state->finished.push_back({node, list});
+    return WalkAction::CONTINUE;
+}
+
+Node *nodeIntern(NodeInterner *interner, Node *node) {
+    if (!interner || !node)
+        return node;
+    // Already canonical below this node; only its siblings need dropping.
+    if (node->isInterned())
+        return node->next_child ? nodeInternOne(interner, node, node->children, nullptr) : node;
+    NodeInternState state;
+    state.interner = interner;
+    nodeWalk(node, {nullptr, nodeInternVisit, &state});
+    return nodeInternOne(interner, node, state.finished.back().second, nullptr);
+}
+
+NodeInternerStats nodeInternerStats(NodeInterner *interner) {
+    NodeInternerStats stats;
+    stats.lookups = interner->lookups;
+    stats.hits = interner->hits;
+    stats.unique_nodes = interner->nodes.size();
+    return stats;
+}
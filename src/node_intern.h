@@ -0,0 +1,35 @@
+#ifndef COMPILER_NODE_INTERN_H
+#define COMPILER_NODE_INTERN_H
+
+#include <cstddef>
+
+typedef struct Node Node;
+
+/**
+ * Optional hash-consing node factory. Structurally identical subtrees are
+ * stored once and carry a precomputed structural hash in Node::hash, so two
+ * interned subtrees are equal exactly when their child lists are the same
+ * pointer, and copying one is free.
+ *
+ * Children are linked through Node::next_child, so a node's identity here
+ * includes the siblings that follow it: what is shared is every identical
+ * child-list suffix (e.g. the argument lists of two `foo(20, 34)` calls).
+ * Interned nodes belong to the interner: deleteNode() leaves them alone and
+ * they must never be modified.
+ */
+struct NodeInterner;
+
+struct NodeInternerStats {
+    size_t lookups;
+    size_t hits;
+    size_t unique_nodes;
+};
+
+NodeInterner *nodeInternerCreate();
+/// Frees every node the interner handed out.
+void nodeInternerDelete(NodeInterner *interner);
+/// Canonical copy of `node` and its subtree (not its siblings); `node` is left untouched.
+Node *nodeIntern(NodeInterner *interner, Node *node);
+NodeInternerStats nodeInternerStats(NodeInterner *interner);
+
+#endif /* COMPILER_NODE_INTERN_H */
@@ -0,0 +1,72 @@
+#include "node_walk.h"
+
+#include <utility>
+#include <vector>
+
+#include "parser.h"
+
+struct NodeWalkFrame {
+    Node *node;
+    /// Next child to descend into; read before any of its callbacks run.
+    Node *child;
+};
+
+static WalkAction nodeWalkVisit(NodeVisitFn visit, Node *node, Node *parent, size_t depth, void *data) {
+    if (!visit)
+        return WalkAction::CONTINUE;
+    return visit(node, parent, depth, data);
+}
+
+/// Stacks of finished walks, kept so that the many short walks over single
+/// expressions do not each allocate. Visitors may start nested walks, so a
+/// walk takes a stack of its own rather than sharing one.
+static thread_local std::vector<std::vector<NodeWalkFrame>> node_walk_spare_stacks;
+
+struct NodeWalkStack {
+    std::vector<NodeWalkFrame> frames;
+
+    NodeWalkStack() {
+        if (!node_walk_spare_stacks.empty()) {
+            frames.swap(node_walk_spare_stacks.back());
+            node_walk_spare_stacks.pop_back();
+        }
+    }
+
+    ~NodeWalkStack() {
+        frames.clear();
+        node_walk_spare_stacks.push_back(std::move(frames));
+    }
+};
+
+bool nodeWalk(Node *root, NodeVisitor visitor) {
+    if (!root)
+        return true;
+    NodeWalkStack walk_stack;
+    std::vector<NodeWalkFrame> &stack = walk_stack.frames;
+
+    WalkAction action = nodeWalkVisit(visitor.pre, root, nullptr, 0, visitor.data);
+    if (action == WalkAction::STOP)
+        return false;
+    stack.push_back({root, action == WalkAction::SKIP_CHILDREN ? nullptr : root->children});
+
+    while (!stack.empty()) {
+        NodeWalkFrame &top = stack.back();
+        if (top.child) {
+            Node *parent = top.node;
+            Node *node = top.child;
+            top.child = node->next_child;
+            size_t depth = stack.size();
+            action = nodeWalkVisit(visitor.pre, node, parent, depth, visitor.data);
+            if (action == WalkAction::STOP)
+                return false;
+            stack.push_back({node, action == WalkAction::SKIP_CHILDREN ? nullptr : node->children});
+            continue;
+        }
+        Node *node = top.node;
+        stack.pop_back();
+        Node *parent = stack.empty() ? nullptr : stack.back().node;
+        if (nodeWalkVisit(visitor.post, node, parent, stack.size(), visitor.data) == WalkAction::STOP)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef COMPILER_NODE_WALK_H
+#define COMPILER_NODE_WALK_H
+
+#include <cstddef>
+
+typedef struct Node Node;
+
+enum class WalkAction {
+    CONTINUE = 0,
+    /// Returned from `pre`: do not visit the children, `post` still runs.
+    SKIP_CHILDREN,
+    /// Abandon the walk; no further callbacks run.
+    STOP,
+};
+
+/// `depth` is 0 for the root of the walk; `parent` is NULL for the root.
+typedef WalkAction (*NodeVisitFn)(Node *node, Node *parent, size_t depth, void *data);
+
+struct NodeVisitor {
+    NodeVisitFn pre;
+    NodeVisitFn post;
+    void *data;
+};
+
+/**
+ * Walk `root` and its descendants (not its siblings) depth-first with an
+ * explicit stack, so arbitrarily deep trees are fine.
+ * `post` may free the node it is given: the walk never touches a node after
+ * its post callback.
+ * @retval false A callback returned WalkAction::STOP.
+ */
+bool nodeWalk(Node *root, NodeVisitor visitor);
+
+#endif /* COMPILER_NODE_WALK_H */
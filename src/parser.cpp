@@ -3,12 +3,23 @@
 #include "error.h"
 #include "environment.h"
 #include "file_io.h"
+#include "lex_parallel.h"
+#include "memory_stats.h"
+#include "node_walk.h"
+#include "record_layout.h"
+#include "timing.h"
 #include <iostream>
 #include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <string>
 #include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 #include <cstddef>
+#include <utility>
+#include <vector>
 
 // ---------------- LEXER BEGINNING -----------------
 
@@ -39,11 +50,14 @@ Error lex(char* source, Token *token) {
     if (*(token->end) == '\0')
         return err;
     while(commentAtBeginning(*token)){
-        token->begin = std::strpbrk(token->begin, "\n");
-        if (!token->begin) {
+        char *newline = std::strpbrk(token->begin, "\n");
+        if (!newline) {
+            // Comment runs until the end of the source.
+            token->begin += std::strlen(token->begin);
             token->end = token->begin;
             return err;
         }
+        token->begin = newline;
         token->begin += std::strspn(token->begin, whitespace);
         token->end = token->begin;
     }
@@ -80,9 +94,32 @@ void printToken(Token &tok){
 Node *nodeAllocate(){
     Node *node = new Node();
     assert(node && "Could not allocate memory for new AST node.");
+    memoryAllocated(MemoryCategory::AST, sizeof(Node));
     return node;
 }
 
+void nodeFree(Node *node){
+    if(!node)
+        return;
+    memoryFreed(MemoryCategory::AST, sizeof(Node));
+    delete node;
+}
+
+char *symbolAllocate(size_t length){
+    char *symbol = new char[length + 1];
+    assert(symbol && "Could not allocate memory for symbol string.");
+    memoryAllocated(MemoryCategory::SYMBOLS, length + 1);
+    return symbol;
+}
+
+void symbolFree(char *symbol){
+    if(!symbol)
+        return;
+    if(memory_accounting_enabled)
+        memoryRecordFree(MemoryCategory::SYMBOLS, strlen(symbol) + 1);
+    delete[] symbol;
+}
+
 void nodeAddChild(Node *parent, Node *new_child){
     if(!parent || !new_child)
         return;
@@ -96,56 +133,74 @@ void nodeAddChild(Node *parent, Node *new_child){
         parent->children = new_child;
 }
 
-bool nodeCompare(Node *a, Node *b){
-    if(!a || !b){
-        if(!a && !b)
-            return true;
-        return false;
-    }
-    assert(static_cast<int>(NodeType::MAX) == 10 && "nodeCompare() must handle all node types.");
+bool nodeValueEqual(const Node *a, const Node *b){
+    assert(static_cast<int>(NodeType::MAX) == 12 && "nodeValueEqual() must handle all node types.");
     if(a->type != b->type)
         return false;
     switch(a->type){
-        case NodeType::NONE:
-            if(b->isNone())
-                return true;
-            break;
         case NodeType::INTEGER:
-            if(a->value.integer == b->value.integer)
-                return true;
-            break;
+            return a->value.integer == b->value.integer && a->integer_above_signed == b->integer_above_signed;
         case NodeType::SYMBOL:
             if (a->value.symbol && b->value.symbol)
-                if (strcmp(a->value.symbol, b->value.symbol) == false)
-                    return true;
-            else if (!a->value.symbol && !b->value.symbol)
-                return true;
-            break;
+                return strcmp(a->value.symbol, b->value.symbol) == 0;
+            return !a->value.symbol && !b->value.symbol;
+        // These carry no value of their own; only their children differ.
+        case NodeType::NONE:
         case NodeType::BINARY_OPERATOR:
-            std::cout << "TODO: nodeCompare() BINARY OPERATOR\n";
-            break;
         case NodeType::FUNCTION:
-            std::cout << "TODO: nodeCompare() FUNCTION\n";
-            break;
         case NodeType::FUNCTION_CALL:
-            std::cout << "TODO: nodeCompare() FUNCTION CALL\n";
-            break;  
         case NodeType::VARIABLE_REASSIGNMENT:
-            std::cout << "TODO: nodeCompare() VARIABLE REASSIGNMENT\n";
-            break;
         case NodeType::VARIABLE_DECLARATION:
-            std::cout << "TODO: nodeCompare() VARIABLE DECLARATION\n";
-            break;
         case NodeType::VARIABLE_DECLARATION_INITIALIZED:
-            std::cout << "TODO: nodeCompare() VARIABLE DECLARATION INITIALIZED\n";
-            break;
         case NodeType::PROGRAM:
-            std::cout << "TODO: Compare two programs.\n";
+        case NodeType::WHILE:
+        case NodeType::RECORD:
+            return true;
+        default:
             break;
-        }
+    }
     return false;
 }
 
+bool nodeCompare(Node *a, Node *b){
+    if(!a || !b){
+        if(!a && !b)
+            return true;
+        return false;
+    }
+    if(a == b)
+        return true;
+    // Interned hashes cover the siblings too, which are not compared here,
+    // so they only tell `a` and `b` apart when both have the same siblings.
+    if(a->hash && b->hash && a->next_child == b->next_child && a->hash != b->hash)
+        return false;
+    if(!nodeValueEqual(a, b))
+        return false;
+    // Child lists are compared pairwise with an explicit stack, so depth is unbounded.
+    std::vector<std::pair<Node *, Node *>> lists;
+    lists.push_back({a->children, b->children});
+    while(!lists.empty()){
+        Node *x = lists.back().first;
+        Node *y = lists.back().second;
+        lists.pop_back();
+        while(x || y){
+            // The same list, e.g. shared by hash-consed nodes.
+            if(x == y)
+                break;
+            if(!x || !y)
+                return false;
+            if(x->hash && y->hash && x->hash != y->hash)
+                return false;
+            if(!nodeValueEqual(x, y))
+                return false;
+            lists.push_back({x->children, y->children});
+            x = x->next_child;
+            y = y->next_child;
+        }
+    }
+    return true;
+}
+
 Node *nodeNone(){
     Node *none = nodeAllocate();
     none->type = NodeType::NONE;
@@ -163,15 +218,14 @@ Node *nodeSymbol(const char *symbol_string){
     Node *symbol = nodeAllocate();
     symbol->type = NodeType::SYMBOL;
     size_t symbol_length = strlen(symbol_string);
-    symbol->value.symbol = new char[symbol_length + 1];
+    symbol->value.symbol = symbolAllocate(symbol_length);
     std::strcpy(symbol->value.symbol, symbol_string);
     return symbol;
 }
 
 Node *nodeSymbolFromBuffer(char *buffer, size_t length) {
     assert(buffer && "Can not create AST symbol node from NULL buffer.");
-    char *symbol_string = new char[length + 1];
-    assert(symbol_string && "Could not allocate memory for symbol string.");
+    char *symbol_string = symbolAllocate(length);
     std::memcpy(symbol_string, buffer, length);
     symbol_string[length] = '\0';
     Node *symbol = nodeAllocate();
@@ -180,7 +234,7 @@ Node *nodeSymbolFromBuffer(char *buffer, size_t length) {
     return symbol;
 }
 
-Error nodeAddType(Environment *types, NodeType type, Node *type_symbol, long long byte_size) {
+Error nodeAddType(Environment *types, NodeType type, Node *type_symbol, long long byte_size, bool is_signed) {
     assert(types && "Can not add type to NULL types environment");
     assert(type_symbol && "Can not add NULL type symbol to types environment");
     assert(byte_size >= 0 && "Can not define new type with zero or negative byte size");
@@ -189,6 +243,11 @@ Error nodeAddType(Environment *types, NodeType type, Node *type_symbol, long lon
     size_node->type = NodeType::INTEGER;
     size_node->value.integer = byte_size;
 
+    Node *signed_node = nodeAllocate();
+    signed_node->type = NodeType::INTEGER;
+    signed_node->value.integer = is_signed;
+    size_node->next_child = signed_node;
+
     Node *type_node = nodeAllocate();
     type_node->type = type;
     type_node->children = size_node;
@@ -202,13 +261,17 @@ Error nodeAddType(Environment *types, NodeType type, Node *type_symbol, long lon
     return err;
 }
 
-void printNode(Node *node, size_t indent_level){
-    if(!node)
-        return;
+struct PrintNodeState {
+    size_t indent_level;
+};
+
+WalkAction printNodeVisit(Node *node, Node *parent, size_t depth, void *data){
+    (void)parent;
+    size_t indent_level = static_cast<PrintNodeState *>(data)->indent_level + depth * 4;
     for(size_t i = 0; i < indent_level; i++){
         std::cout << ' ';
     }
-    assert(static_cast<int>(NodeType::MAX) == 10 && "printNode() must handle all node types.");
+    assert(static_cast<int>(NodeType::MAX) == 12 && "printNode() must handle all node types.");
     switch(node->type){
         default:
             std::cout << "UNKNOWN";
@@ -217,7 +280,10 @@ void printNode(Node *node, size_t indent_level){
             std::cout << "NONE";
             break;
         case NodeType::INTEGER:
-            std::cout << "INT:" << node->value.integer;
+            if (node->integer_above_signed)
+                std::cout << "INT:" << static_cast<unsigned long long>(node->value.integer);
+            else
+                std::cout << "INT:" << node->value.integer;
             break;
         case NodeType::SYMBOL:
             std::cout << "SYM";
@@ -245,81 +311,234 @@ void printNode(Node *node, size_t indent_level){
         case NodeType::FUNCTION_CALL:
             std::cout << "FUNCTION CALL";
             break;
+        case NodeType::WHILE:
+            std::cout << "WHILE";
+            break;
+        case NodeType::RECORD:
+            std::cout << "RECORD";
+            break;
     }
     std::cout << '\n';
-    Node *child = node->children;
-    while(child){
-        printNode(child, indent_level + 4);
-        child = child->next_child;
-    }
+    return WalkAction::CONTINUE;
+}
+
+void printNode(Node *node, size_t indent_level){
+    PrintNodeState state = {indent_level};
+    nodeWalk(node, {printNodeVisit, nullptr, &state});
+}
+
+WalkAction deleteNodeSkipInterned(Node *node, Node *parent, size_t depth, void *data){
+    (void)parent;
+    (void)depth;
+    (void)data;
+    // Hash-consed nodes are shared and owned by their NodeInterner.
+    return node->isInterned() ? WalkAction::SKIP_CHILDREN : WalkAction::CONTINUE;
+}
+
+WalkAction deleteNodeVisit(Node *node, Node *parent, size_t depth, void *data){
+    (void)parent;
+    (void)depth;
+    (void)data;
+    if(node->isInterned())
+        return WalkAction::CONTINUE;
+    if(node->isSymbol() && node->value.symbol)
+        symbolFree(node->value.symbol);
+    nodeFree(node);
+    return WalkAction::CONTINUE;
 }
 
 void deleteNode(Node *root){
-    if(!root)
-        return;
-    Node *child = root->children;
-    Node *next_child = nullptr;
-    while(child){
-        next_child = child->next_child;
-        deleteNode(child);
-        child = next_child;
-    }
-    if(root->isSymbol() && root->value.symbol)
-        delete root->value.symbol;
-    delete root;
+    nodeWalk(root, {deleteNodeSkipInterned, deleteNodeVisit, nullptr});
 }
 
-void nodeCopy(Node *a, Node *b) {
-    if(!a || !b)
-        return;
-    b->type = a->type;
-    switch(a->type){
+struct NodeCopyState {
+    Node *root_copy;
+    /// Copy of the node at each depth of the walk, and its last copied child.
+    std::vector<Node *> copies;
+    std::vector<Node *> last_child;
+};
+
+WalkAction nodeCopyVisit(Node *node, Node *parent, size_t depth, void *data){
+    (void)parent;
+    NodeCopyState *state = static_cast<NodeCopyState *>(data);
+    state->copies.resize(depth);
+    state->last_child.resize(depth);
+
+    // Hash-consed lists are immutable and shared, so the copy links to them
+    // instead of duplicating them. The rest of the list is interned too.
+    if(depth && node->isInterned()){
+        Node *&last = state->last_child[depth - 1];
+        if(!last)
+            state->copies[depth - 1]->children = node;
+        else if(!last->isInterned())
+            last->next_child = node;
+        last = node;
+        state->copies.push_back(nullptr);
+        state->last_child.push_back(nullptr);
+        return WalkAction::SKIP_CHILDREN;
+    }
+
+    Node *copy = state->root_copy;
+    if(depth){
+        copy = nodeAllocate();
+        Node *&last = state->last_child[depth - 1];
+        if(last)
+            last->next_child = copy;
+        else
+            state->copies[depth - 1]->children = copy;
+        last = copy;
+    }
+
+    copy->type = node->type;
+    copy->integer_above_signed = node->integer_above_signed;
+    switch(node->type){
     default:
-        b->value = a->value;
+        copy->value = node->value;
         break;
     case NodeType::SYMBOL:
-        size_t length = strlen(a->value.symbol);
-        b->value.symbol = new char[length + 1];
-        std::strcpy(b->value.symbol, a->value.symbol);
-        assert(b->value.symbol && "nodeCopy(): Could not allocate memory for new symbol");
+        size_t length = strlen(node->value.symbol);
+        copy->value.symbol = symbolAllocate(length);
+        std::strcpy(copy->value.symbol, node->value.symbol);
+        assert(copy->value.symbol && "nodeCopy(): Could not allocate memory for new symbol");
         break;
     }
-    Node *child = a->children;
-    Node *child_it = nullptr;
-    while(child){
-        Node *new_child = nodeAllocate();
-        if(child_it){
-            child_it->next_child = new_child;
-            child_it = child_it->next_child;
-        }else{
-            b->children = new_child;
-            child_it = new_child;
-        }
-        nodeCopy(child, child_it);
-        child = child->next_child;
+    if(node->isInterned()){
+        copy->children = node->children;
+        return WalkAction::SKIP_CHILDREN;
     }
+    state->copies.push_back(copy);
+    state->last_child.push_back(nullptr);
+    return WalkAction::CONTINUE;
+}
+
+void nodeCopy(Node *a, Node *b) {
+    if(!a || !b)
+        return;
+    NodeCopyState state;
+    state.root_copy = b;
+    nodeWalk(a, {nodeCopyVisit, nullptr, &state});
 }
 
 ParsingContext *parseContextCreate(ParsingContext *parent){
     ParsingContext *ctx = new ParsingContext();
     assert(ctx && "Could not allocate for parsing context.");
+    memoryAllocated(MemoryCategory::CONTEXTS, sizeof(ParsingContext));
     ctx->parent = parent;
     ctx->operation = nullptr;
     ctx->result = nullptr;
+    ctx->expression = nullptr;
+    ctx->defer_bodies = false;
     ctx->types = environmentCreate(nullptr);
     ctx->variables = environmentCreate(nullptr);
     ctx->functions = environmentCreate(nullptr);
+    if(parent){
+        ctx->scopes = parent->scopes;
+    } else {
+        ctx->scopes = new ScopeStack();
+        memoryAllocated(MemoryCategory::CONTEXTS, sizeof(ScopeStack));
+        ctx->scopes->depth = 0;
+    }
     return ctx;
 }
 
+void parseContextDelete(ParsingContext *context){
+    if(!context)
+        return;
+    // Type bindings own their symbol and type node (see nodeAddType()).
+    for(Binding *it = context->types->bind; it; it = it->next){
+        deleteNode(it->id);
+        deleteNode(it->value);
+    }
+    environmentDelete(context->types);
+    environmentDelete(context->variables);
+    environmentDelete(context->functions);
+    deleteNode(context->operation);
+    if(!context->parent && context->scopes){
+        for(ParsingContext *frame : context->scopes->frames)
+            parseContextDelete(frame);
+        memoryFreed(MemoryCategory::CONTEXTS, sizeof(ScopeStack));
+        delete context->scopes;
+    }
+    memoryFreed(MemoryCategory::CONTEXTS, sizeof(ParsingContext));
+    delete context;
+}
+
+void parseContextReset(ParsingContext *context){
+    // Both the name and the type symbol of a variable binding are copies.
+    for(Binding *it = context->variables->bind; it; it = it->next){
+        deleteNode(it->id);
+        deleteNode(it->value);
+    }
+    for(Binding *it = context->functions->bind; it; it = it->next)
+        deleteNode(it->id);
+    environmentClear(context->variables);
+    environmentClear(context->functions);
+    recordTypesClear(context);
+    context->deferred_bodies.clear();
+    scopeRelease(context->scopes, 0);
+    context->result = nullptr;
+}
+
+size_t scopeMark(ScopeStack *stack){
+    return stack->depth;
+}
+
+ParsingContext *scopePush(ScopeStack *stack, ParsingContext *parent, const char *operation){
+    ParsingContext *ctx = nullptr;
+    if(stack->depth < stack->frames.size()){
+        ctx = stack->frames[stack->depth];
+    } else {
+        // Frames are never roots, so they must not own a stack; parent is set below.
+        ctx = parseContextCreate(parent);
+        stack->frames.push_back(ctx);
+    }
+    stack->depth += 1;
+    ctx->parent = parent;
+    ctx->result = nullptr;
+    ctx->expression = nullptr;
+    ctx->operators.clear();
+    ctx->scopes = stack;
+    if(!ctx->operation || strcmp(ctx->operation->value.symbol, operation) != 0){
+        deleteNode(ctx->operation);
+        ctx->operation = nodeSymbol(operation);
+    }
+    return ctx;
+}
+
+void scopeRelease(ScopeStack *stack, size_t mark){
+    while(stack->depth > mark){
+        stack->depth -= 1;
+        ParsingContext *ctx = stack->frames[stack->depth];
+        environmentClear(ctx->types);
+        environmentClear(ctx->variables);
+        environmentClear(ctx->functions);
+        ctx->result = nullptr;
+    }
+}
+
+struct BuiltinType {
+    const char *name;
+    long long byte_size;
+    bool is_signed;
+};
+
+static const BuiltinType builtin_types[] = {
+    {"integer", sizeof(long long), true},
+    {"i8", 1, true}, {"i16", 2, true}, {"i32", 4, true}, {"i64", 8, true},
+    {"u8", 1, false}, {"u16", 2, false}, {"u32", 4, false}, {"u64", 8, false},
+};
+
 ParsingContext *parseContextDefaultCreate() {
   ParsingContext *ctx = parseContextCreate(nullptr);
-  Error err = nodeAddType(ctx->types, 
+  for (const BuiltinType &builtin : builtin_types) {
+    Error err = nodeAddType(ctx->types,
                             NodeType::INTEGER,
-                            nodeSymbol("integer"),
-                            sizeof(long long));
-  if(err.type != ErrorType::NONE)
-    std::cout << "ERROR: Failed to set built-in integer type in types environment.\n";
+                            nodeSymbol(builtin.name),
+                            builtin.byte_size,
+                            builtin.is_signed);
+    if(err.type != ErrorType::NONE)
+      std::cout << "ERROR: Failed to set built-in " << builtin.name << " type in types environment.\n";
+  }
   return ctx;
 }
 
@@ -329,7 +548,12 @@ Error lexAdvance(Token *token, size_t *token_length, char **end) {
         err.createError(ErrorType::ARGUMENTS, "lexAdvance(): pointer arguments must not be NULL!");
         return err;
     }
-    err = lex(token->end, token);
+    TimingScope timing("lex", nullptr, false);
+    TokenStream *stream = lexActiveTokenStream();
+    if (stream)
+        tokenStreamNext(stream, token->end, token);
+    else
+        err = lex(token->end, token);
     *end = token->end;
     if(err.type != ErrorType::NONE)
         return err;
@@ -368,6 +592,35 @@ ExpectReturnValue lexExpect(const std::string &expected, Token *current, size_t
     return out;
 }
 
+long long typeSize(const Node *type_info) {
+    return type_info->children->value.integer;
+}
+
+long long typeAlignment(const Node *type_info) {
+    if (typeIsRecord(type_info))
+        return type_info->children->next_child->next_child->value.integer;
+    long long size = typeSize(type_info);
+    return size > 0 ? size : 1;
+}
+
+bool typeIsSigned(const Node *type_info) {
+    return type_info->children->next_child && type_info->children->next_child->value.integer;
+}
+
+bool typeContains(const Node *type_info, const Node *literal) {
+    long long value = literal->value.integer;
+    // Only an unsigned 64-bit type has room for what is wrapped to negative here.
+    if (literal->integer_above_signed)
+        return typeSize(type_info) >= 8 && !typeIsSigned(type_info);
+    long long size = typeSize(type_info);
+    if (size >= 8)
+        return typeIsSigned(type_info) || value >= 0;
+    long long bits = size * 8;
+    if (typeIsSigned(type_info))
+        return value >= -(1ll << (bits - 1)) && value < (1ll << (bits - 1));
+    return value >= 0 && value < (1ll << bits);
+}
+
 Error parseGetType(ParsingContext *context, Node *id, Node *result) {
     Error err = ok;
     while(context){
@@ -390,44 +643,336 @@ Error ExpectReturnValue::expect(ExpectReturnValue &expected, const std::string &
     return {ErrorType::NONE, "Continue"};
 }
 
-bool parseInteger(Token *token, Node *node){
-    if(!token || !node)
-        return false;
+Error parseInteger(Token *token, Node *node, bool *found){
+    Error err = ok;
+    if(!token || !node || !found){
+        err.prepareError(ErrorType::ARGUMENTS, "parseInteger() must not be passed NULL pointers!");
+        return err;
+    }
+    *found = false;
+    bool negative = token->begin != token->end && *token->begin == '-';
+    const char *digits = token->begin + (negative ? 1 : 0);
+    if(digits == token->end || *digits < '0' || *digits > '9')
+        return ok;
     char *end = nullptr;
-    /// Remove the condition for 0, if that becomes redundant  
-    if(token->end - token->begin == 1 && *(token->begin) == '0'){
-        node->type = NodeType::INTEGER;
-        node->value.integer = 0;
-    } else if((node->value.integer = std::strtoll(token->begin, &end, 10)) != 0){
-        if(end != token->end)
-            return false;
-        node->type = NodeType::INTEGER;
-    } else
-        return false;
-    return true;
+    long long value = 0;
+    bool above_signed = false;
+    errno = 0;
+    if(negative){
+        value = std::strtoll(token->begin, &end, 10);
+    } else {
+        unsigned long long magnitude = std::strtoull(token->begin, &end, 10);
+        value = static_cast<long long>(magnitude);
+        above_signed = magnitude > static_cast<unsigned long long>(LLONG_MAX);
+    }
+    // Not a number after all, like `2nd`.
+    if(end != token->end)
+        return ok;
+    if(errno == ERANGE){
+        err.prepareError(ErrorType::TYPE, "Integer literal does not fit in 64 bits: "
+                         + std::string(token->begin, token->end - token->begin));
+        return err;
+    }
+    node->type = NodeType::INTEGER;
+    node->value.integer = value;
+    node->integer_above_signed = above_signed;
+    *found = true;
+    return ok;
 }
 
-Error parseExpr(ParsingContext *context, char* source, char **end, Node *result) {
+/// Leaves the scopes parseExpr() enters for function bodies and call
+/// arguments; nothing refers to them once the expression is parsed.
+struct ScopeGuard {
+    ScopeStack *stack;
+    size_t mark;
+
+    ~ScopeGuard() {
+        scopeRelease(stack, mark);
+    }
+};
+
+/// Variables visible from `context`, including globals from inside function bodies.
+static Binding *parseFindVariable(ParsingContext *context, Node *symbol) {
+    for (; context; context = context->parent)
+        if (Binding *binding = environmentFind(context->variables, symbol))
+            return binding;
+    return nullptr;
+}
+
+/// Variables `context` may reassign: those of the enclosing function, or globals outside of functions.
+static Binding *parseFindAssignable(ParsingContext *context, Node *symbol) {
+    for (; context; context = context->parent) {
+        if (Binding *binding = environmentFind(context->variables, symbol))
+            return binding;
+        if (context->operation && strcmp(context->operation->value.symbol, "func") == 0)
+            return nullptr;
+    }
+    return nullptr;
+}
+
+/**
+ * Look up a use of `symbol`, which names a variable or, like `p.x`, a field
+ * of a record variable. Records are only used through their fields.
+ * @param assignable Find the variable like parseFindAssignable() does.
+ * @param found Set if the variable exists.
+ */
+static Error parseFindAccess(ParsingContext *context, Node *symbol, bool assignable, bool *found) {
+    Error err = ok;
+    const char *dot = strchr(symbol->value.symbol, '.');
+    Node *base = symbol;
+    if (dot)
+        base = nodeSymbolFromBuffer(symbol->value.symbol, static_cast<size_t>(dot - symbol->value.symbol));
+    Binding *binding = assignable ? parseFindAssignable(context, base) : parseFindVariable(context, base);
+    if (dot)
+        deleteNode(base);
+    *found = binding != nullptr;
+    if (!binding)
+        return ok;
+    Node type_info;
+    if (parseGetType(context, binding->value, &type_info).type != ErrorType::NONE)
+        return ok;
+    if (dot) {
+        long long offset = 0;
+        err = recordFieldPath(context, &type_info, dot + 1, &offset, &type_info);
+        if (err.type != ErrorType::NONE)
+            return err;
+    }
+    if (typeIsRecord(&type_info)) {
+        std::cout << "Record: " << symbol->value.symbol << '\n';
+        err.prepareError(ErrorType::TYPE, "Records can only be used through their fields, like `p.x`");
+    }
+    return err;
+}
+
+/// `record Name [packed|ordered] { field : type, ... }`, after the keyword; braces stand apart like in functions.
+static Error parseRecord(ParsingContext *context, Token *current_token, size_t *token_length, char **end) {
+    Error err = ok;
+    if (context->parent) {
+        err.prepareError(ErrorType::SYNTAX, "Record types can only be declared at the top level");
+        return err;
+    }
+    err = lexAdvance(current_token, token_length, end);
+    if (err.type != ErrorType::NONE)
+        return err;
+    if (*token_length == 0) {
+        err.prepareError(ErrorType::SYNTAX, "Expected a name for the record type");
+        return err;
+    }
+    Node *name = nodeSymbolFromBuffer(current_token->begin, *token_length);
+    Node *fields = nodeNone();
+    RecordLayoutKind kind = RecordLayoutKind::REORDERED;
+    ExpectReturnValue expected = lexExpect("{", current_token, token_length, end);
+    if (expected.err.type == ErrorType::NONE && !expected.found && !expected.done) {
+        err = lexAdvance(current_token, token_length, end);
+        if (err.type == ErrorType::NONE && tokenStringEqual(std::string("packed"), current_token))
+            kind = RecordLayoutKind::PACKED;
+        else if (err.type == ErrorType::NONE && tokenStringEqual(std::string("ordered"), current_token))
+            kind = RecordLayoutKind::ORDERED;
+        else if (err.type == ErrorType::NONE)
+            err.prepareError(ErrorType::SYNTAX, "Expected \"packed\", \"ordered\" or an opening brace after the record name");
+        if (err.type == ErrorType::NONE)
+            expected = lexExpect("{", current_token, token_length, end);
+    }
+    if (err.type == ErrorType::NONE && expected.err.type != ErrorType::NONE)
+        err = expected.err;
+    else if (err.type == ErrorType::NONE && !expected.found)
+        err.prepareError(ErrorType::SYNTAX, "Record type requires a body: \"{ x : integer, y : integer }\"");
+
+    while (err.type == ErrorType::NONE) {
+        expected = lexExpect("}", current_token, token_length, end);
+        if ((err = expected.err).type != ErrorType::NONE || expected.found)
+            break;
+        if (expected.done) {
+            err.prepareError(ErrorType::SYNTAX, "Expected closing brace for record type");
+            break;
+        }
+        if ((err = lexAdvance(current_token, token_length, end)).type != ErrorType::NONE)
+            break;
+        Node *field_name = nodeSymbolFromBuffer(current_token->begin, *token_length);
+        Node *field = nodeNone();
+        nodeAddChild(field, field_name);
+        nodeAddChild(fields, field);
+        if (strchr(field_name->value.symbol, '.')) {
+            err.prepareError(ErrorType::SYNTAX, std::string("Field names can not contain '.': ") + field_name->value.symbol);
+            break;
+        }
+        expected = lexExpect(":", current_token, token_length, end);
+        if ((err = expected.err).type != ErrorType::NONE)
+            break;
+        if (!expected.found) {
+            err.prepareError(ErrorType::SYNTAX, "Record field requires a type annotation");
+            break;
+        }
+        if ((err = lexAdvance(current_token, token_length, end)).type != ErrorType::NONE)
+            break;
+        nodeAddChild(field, nodeSymbolFromBuffer(current_token->begin, *token_length));
+        // Fields may be separated by commas.
+        expected = lexExpect(",", current_token, token_length, end);
+        err = expected.err;
+    }
+    if (err.type == ErrorType::NONE)
+        err = recordTypeAdd(context, name, fields, kind);
+    if (err.type != ErrorType::NONE) {
+        deleteNode(name);
+        deleteNode(fields);
+    }
+    return err;
+}
+
+/// Binding strength of a binary operator token, or 0 if the token is not one.
+static int parseOperatorPrecedence(const char *op, size_t length) {
+    if (length != 1)
+        return 0;
+    switch (*op) {
+        case '<': return 1;
+        case '+':
+        case '-': return 2;
+        case '*': return 3;
+        default:  return 0;
+    }
+}
+
+/**
+ * Called after an operand: if a binary operator follows, the operand (or the
+ * open operator it completes, when that binds at least as tightly) becomes
+ * the left operand of a new operator node, rewritten in place so that its
+ * parent keeps pointing at it. `*working_result` is then the right operand.
+ * Operators are left-associative and must be separated by whitespace.
+ */
+static Error parseBinaryOperator(ParsingContext *context, Node *operand, Token *current_token, size_t *token_length,
+                                 char **end, Node **working_result, bool *found) {
+    *found = false;
+    Token next = *current_token;
+    size_t next_length = 0;
+    char *next_end = *end;
+    Error err = lexAdvance(&next, &next_length, &next_end);
+    if (err.type != ErrorType::NONE)
+        return err;
+    int precedence = parseOperatorPrecedence(next.begin, next_length);
+    if (!precedence)
+        return ok;
+    *current_token = next;
+    *token_length = next_length;
+    *end = next_end;
+
+    Node *target = operand;
+    std::vector<Node *> &open = context->operators;
+    while (!open.empty()) {
+        Node *symbol = open.back()->children;
+        if (parseOperatorPrecedence(symbol->value.symbol, strlen(symbol->value.symbol)) < precedence)
+            break;
+        target = open.back();
+        open.pop_back();
+    }
+    Node *left = nodeAllocate();
+    left->type = target->type;
+    left->value = target->value;
+    left->integer_above_signed = target->integer_above_signed;
+    left->children = target->children;
+    target->type = NodeType::BINARY_OPERATOR;
+    target->value.integer = 0;
+    target->integer_above_signed = false;
+    target->children = nullptr;
+    nodeAddChild(target, nodeSymbolFromBuffer(next.begin, next_length));
+    nodeAddChild(target, left);
+    Node *right = nodeAllocate();
+    nodeAddChild(target, right);
+    open.push_back(target);
+
+    *working_result = right;
+    *found = true;
+    return ok;
+}
+
+/**
+ * End of the function body whose opening brace ends just before `source`:
+ * just past its closing brace, or NULL if it has none. Braces count like
+ * the parser sees them, as tokens of their own outside of comments.
+ */
+static char *parseSkipBody(char *source) {
+    size_t depth = 1;
+    bool token_start = true;
+    for (char *it = source; *it; it++) {
+        if (token_start && strchr(comment_delimiters, *it)) {
+            it = strchr(it, '\n');
+            if (!it)
+                return nullptr;
+            continue;
+        }
+        if (token_start && (*it == '{' || *it == '}') && strchr(delimiters, it[1])) {
+            if (*it == '{')
+                depth++;
+            else if (--depth == 0)
+                return it + 1;
+        }
+        token_start = strchr(delimiters, *it) != nullptr;
+    }
+    return nullptr;
+}
+
+/// Enter the scope of `function`'s body with its parameters bound; returns the body's first expression.
+static Node *parseFunctionBodyBegin(ParsingContext **context, Node *function) {
+    *context = scopePush((*context)->scopes, *context, "func");
+
+    Node *param_it = function->children->children;
+    while(param_it){
+        environmentSet((*context)->variables,
+                        param_it->children,
+                        param_it->children->next_child);
+        param_it = param_it->next_child;
+    }
+
+    Node *function_body = nodeAllocate();
+    Node *function_first_expression = nodeAllocate();
+    nodeAddChild(function_body, function_first_expression);
+    nodeAddChild(function, function_body);
+    (*context)->result = function_first_expression;
+    return function_first_expression;
+}
+
+/// Parse from just after `current_token` into `working_result`, in `context`, until the scope parseExpr() started in is closed.
+static Error parseExprFrom(ParsingContext *context, Token current_token, char **end, Node *working_result) {
     ExpectReturnValue expected;
     size_t token_length = 0;
-    Token current_token;
-    current_token.begin = source;
-    current_token.end   = source;
     Error err = ok;
 
-    Node *working_result = result;
-
     while ((err = lexAdvance(&current_token, &token_length, end)).type == ErrorType::NONE) {
         // std::cout << "lexed: ";
         // printToken(current_token);
         // std::cout << '\n';
         if(token_length == 0)
             return ok;
-        if(parseInteger(&current_token, working_result)){
+        bool is_operand = true;
+        bool is_integer = false;
+        err = parseInteger(&current_token, working_result, &is_integer);
+        if (err.type != ErrorType::NONE) { return err; }
+        if(is_integer){
             // return ok;
         } else {
             Node *symbol = nodeSymbolFromBuffer(current_token.begin, token_length);
-            if(strcmp("func", symbol->value.symbol) == 0){
+            if(strcmp("while", symbol->value.symbol) == 0){
+                deleteNode(symbol);
+                working_result->type = NodeType::WHILE;
+                Node *condition = nodeAllocate();
+                nodeAddChild(working_result, condition);
+                nodeAddChild(working_result, nodeNone());
+                nodeAddChild(working_result, nodeNone());
+
+                Node *loop = working_result;
+                context = scopePush(context->scopes, context, "while");
+                context->expression = loop;
+                context->result = condition;
+                working_result = condition;
+                continue;
+            } else if(strcmp("record", symbol->value.symbol) == 0){
+                deleteNode(symbol);
+                err = parseRecord(context, &current_token, &token_length, end);
+                if (err.type != ErrorType::NONE) { return err; }
+                // The type is all there is to it; the statement itself does nothing.
+                working_result->type = NodeType::NONE;
+                is_operand = false;
+            } else if(strcmp("func", symbol->value.symbol) == 0){
+                deleteNode(symbol);
                 working_result->type = NodeType::FUNCTION;
                 lexAdvance(&current_token, &token_length, end);
                 Node *function_name = nodeSymbolFromBuffer(current_token.begin, token_length);
@@ -465,6 +1010,13 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
 
                     lexAdvance(&current_token, &token_length, end);
                     Node *parameter_type = nodeSymbolFromBuffer(current_token.begin, token_length);
+                    Node parameter_info;
+                    if (parseGetType(context, parameter_type, &parameter_info).type == ErrorType::NONE
+                        && typeIsRecord(&parameter_info)) {
+                        std::cout << "Parameter: " << parameter_name->value.symbol << '\n';
+                        err.prepareError(ErrorType::TYPE, "Records can not be passed by value; pass their fields");
+                        return err;
+                    }
 
                     Node *parameter = nodeAllocate();
                     nodeAddChild(parameter, parameter_name);
@@ -494,6 +1046,13 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
 
                 lexAdvance(&current_token, &token_length, end);
                 Node *function_return_type = nodeSymbolFromBuffer(current_token.begin, token_length);
+                Node return_info;
+                if (parseGetType(context, function_return_type, &return_info).type == ErrorType::NONE
+                    && typeIsRecord(&return_info)) {
+                    std::cout << "Function Name: " << function_name->value.symbol << '\n';
+                    err.prepareError(ErrorType::TYPE, "Records can not be returned by value");
+                    return err;
+                }
                 nodeAddChild(working_result, function_return_type);
 
                 environmentSet(context->functions, function_name, working_result);
@@ -505,35 +1064,34 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
                     return err;
                 }
 
-                context = parseContextCreate(context);
-                context->operation = nodeSymbol("func");
-
-                Node *param_it = working_result->children->children;
-                environmentSet(context->variables,
-                                param_it->children,
-                                param_it->children->next_child);
-
-                Node *function_body = nodeAllocate();
-                Node *function_first_expression = nodeAllocate();
-                nodeAddChild(function_body, function_first_expression);
-                nodeAddChild(working_result, function_body);
-                working_result = function_first_expression;
-                context->result = working_result;
-                continue;
+                // A body without a closing brace is parsed right away, to report it like without deferring.
+                char *body_end = context->defer_bodies && !context->parent ? parseSkipBody(current_token.end) : nullptr;
+                if (!body_end) {
+                    working_result = parseFunctionBodyBegin(&context, working_result);
+                    continue;
+                }
+                context->deferred_bodies.push_back({working_result, current_token.end,
+                                                    context->variables->bind, context->types->bind});
+                current_token.begin = body_end - 1;
+                current_token.end = body_end;
+                *end = body_end;
+                is_operand = false;
             } else {
+                // A symbol may be the last token, so running out of input is not an error here.
                 err = expected.expect(expected, ":", current_token, token_length, end);
-                if (err.msg != "Continue") { return err; }
+                if (err.type != ErrorType::NONE) { return err; }
                 if (expected.found) {
                     err = expected.expect(expected, "=", current_token, token_length, end);
                     if (err.msg != "Continue") { return err; }
                     if (expected.found) {
-                        Node *variable_binding = nodeAllocate();
-                        if (!environmentGet(*context->variables, symbol, variable_binding)) {
+                        bool assignable = false;
+                        err = parseFindAccess(context, symbol, true, &assignable);
+                        if (err.type != ErrorType::NONE) { return err; }
+                        if (!assignable) {
                             std::cout << "ID of undeclared variable: " << symbol->value.symbol << '\n';
                             err.prepareError(ErrorType::GENERIC, "Reassignment of a variable that has not been declared!");
                             return err;
                         }
-                        delete variable_binding;
 
                         working_result->type = NodeType::VARIABLE_REASSIGNMENT;
                         nodeAddChild(working_result, symbol);
@@ -544,6 +1102,18 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
                         continue;
                     }
 
+                    if (context->operation && strcmp(context->operation->value.symbol, "whilebody") == 0) {
+                        std::cout << "Variable: " << symbol->value.symbol << '\n';
+                        err.prepareError(ErrorType::SYNTAX, "Variables can not be declared inside a loop body");
+                        return err;
+                    }
+
+                    if (strchr(symbol->value.symbol, '.')) {
+                        std::cout << "Variable: " << symbol->value.symbol << '\n';
+                        err.prepareError(ErrorType::SYNTAX, "Variable names can not contain '.'");
+                        return err;
+                    }
+
                     err = lexAdvance(&current_token, &token_length, end);
                     if (err.type != ErrorType::NONE) { return err; }
                     if (token_length == 0) { break; }
@@ -555,7 +1125,8 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
                         std::cout << "\nINVALID TYPE: " << type_symbol->value.symbol << '\n';
                         return err;
                     }
-                    delete type_value;
+                    bool is_record = typeIsRecord(type_value);
+                    nodeFree(type_value);
 
                     Node *variable_binding = nodeAllocate();
                     if (environmentGet(*context->variables, symbol, variable_binding)) {
@@ -563,18 +1134,32 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
                         err.prepareError(ErrorType::GENERIC, "Redefinition of variable!");
                         return err;
                     }
-                    delete variable_binding;
+                    nodeFree(variable_binding);
 
                     working_result->type = NodeType::VARIABLE_DECLARATION;
 
                     Node *value_expression = nodeNone();
 
+                    Node *type_for_node = nodeAllocate();
+                    nodeCopy(type_symbol, type_for_node);
+
                     nodeAddChild(working_result, symbol);
                     nodeAddChild(working_result, value_expression);
-
-                    Node *symbol_for_env = nodeAllocate();
-                    nodeCopy(symbol, symbol_for_env);
-                    int status = environmentSet(context->variables, symbol_for_env, type_symbol);
+                    nodeAddChild(working_result, type_for_node);
+
+                    // Globals are bound to copies, which parseContextReset() frees; scope
+                    // frames are reused without freeing anything, so locals are bound to
+                    // the declaration itself, like parameters are.
+                    Node *symbol_for_env = symbol;
+                    Node *type_for_env = type_for_node;
+                    if (!context->parent) {
+                        symbol_for_env = nodeAllocate();
+                        nodeCopy(symbol, symbol_for_env);
+                        type_for_env = type_symbol;
+                    } else {
+                        deleteNode(type_symbol);
+                    }
+                    int status = environmentSet(context->variables, symbol_for_env, type_for_env);
                     if (status != 1) {
                         std::cout << "Variable: " << symbol_for_env->value.symbol << ", status: " << status << '\n';
                         err.prepareError(ErrorType::GENERIC, "Failed to define variable!");
@@ -583,15 +1168,21 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
 
                     err = expected.expect(expected, "=", current_token, token_length, end);
                     if (err.msg != "Continue") { return err; }
+                    if (expected.found && is_record) {
+                        std::cout << "Variable: " << symbol->value.symbol << '\n';
+                        err.prepareError(ErrorType::TYPE, "Records start out zeroed and can not be initialized; assign their fields");
+                        return err;
+                    }
                     if (expected.found) {
                         working_result = value_expression;
                         continue;
                     }
-
-                    return ok;
+                    // Complete without an initializer; the enclosing body may go on.
+                    is_operand = false;
+                    symbol = nullptr;
                 } else {
                     err = expected.expect(expected, "(", current_token, token_length, end);
-                    if (err.msg != "Continue") { return err; }
+                    if (err.type != ErrorType::NONE) { return err; }
                     if (expected.found) {
                         working_result->type = NodeType::FUNCTION_CALL;
                         nodeAddChild(working_result, symbol);
@@ -599,85 +1190,301 @@ Error parseExpr(ParsingContext *context, char* source, char **end, Node *result)
                         Node *first_argument = nodeAllocate();
                         nodeAddChild(argument_list, first_argument);
                         nodeAddChild(working_result, argument_list);
-                        working_result = first_argument;
 
-                        context = parseContextCreate(context);
-                        context->operation = nodeSymbol("funcall");
+                        Node *call = working_result;
+                        working_result = first_argument;
+                        context = scopePush(context->scopes, context, "funcall");
+                        context->expression = call;
                         context->result = working_result;
 
                         continue;
 
                     } else {
-                        // TODO: Check if it's a variable access (defined variable)
+                        bool found = false;
+                        err = parseFindAccess(context, symbol, false, &found);
+                        if (err.type != ErrorType::NONE) { return err; }
+                        if (found) {
+                            // Variable or field access; the node takes over the symbol's string.
+                            working_result->type = NodeType::SYMBOL;
+                            working_result->value.symbol = symbol->value.symbol;
+                            nodeFree(symbol);
+                            symbol = nullptr;
+                        }
                     }
                 }
 
-                std::cout << "Unrecognized token: ";
-                printToken(current_token);
-                std::cout << '\n';
+                if (symbol) {
+                    std::cout << "Unrecognized token: ";
+                    printToken(current_token);
+                    std::cout << '\n';
 
-                err.prepareError(ErrorType::SYNTAX, "Unrecognized token reached during parsing");
-                return err;
+                    err.prepareError(ErrorType::SYNTAX, "Unrecognized token reached during parsing");
+                    return err;
+                }
             }
         }
-        if (!context->parent) { break; }
-        Node *operation = context->operation;
-        if (operation->type != NodeType::SYMBOL) {
-            err.prepareError(ErrorType::TYPE, "Parsing context operation must be symbol. Likely internal error :(");
-            return err;
+        // An integer or a variable was parsed; it may be the left operand of an operator.
+        if (is_operand) {
+            bool operator_found = false;
+            err = parseBinaryOperator(context, working_result, &current_token, &token_length, end, &working_result, &operator_found);
+            if (err.type != ErrorType::NONE) { return err; }
+            if (operator_found) { continue; }
         }
-        if (strcmp(operation->value.symbol, "func") == 0) {
-            err = expected.expect(expected, "}", current_token, token_length, end);
-            if (err.msg != "Continue") { return err; }
-            if (expected.done || expected.found) { break; }
-
-            context->result->next_child = nodeAllocate();
-            working_result = context->result->next_child;
-            context->result = working_result;
-            continue;
-        }
-        if (strcmp(operation->value.symbol, "funcall") == 0){
-            err = expected.expect(expected, ")", current_token, token_length, end);
-            if (err.msg != "Continue") { return err; }
-            if (expected.done || expected.found) { break; }
-            err = expected.expect(expected, ",", current_token, token_length, end);
-            if (err.msg != "Continue") { return err; }
-            if (expected.done || !expected.found) {
-                printToken(current_token);
-                err.prepareError(ErrorType::SYNTAX, "Parameter list expected closing parenthesis or comma for another parameter");
+        // Close every scope whose closing token follows, innermost first, so
+        // calls and function bodies nest to any depth.
+        bool next_expression = false;
+        while (context->parent && !next_expression) {
+            Node *operation = context->operation;
+            if (operation->type != NodeType::SYMBOL) {
+                err.prepareError(ErrorType::TYPE, "Parsing context operation must be symbol. Likely internal error :(");
                 return err;
             }
+            if (strcmp(operation->value.symbol, "func") == 0 || strcmp(operation->value.symbol, "whilebody") == 0) {
+                err = expected.expect(expected, "}", current_token, token_length, end);
+                if (err.msg != "Continue") { return err; }
+                if (expected.done) { return ok; }
+                if (!expected.found) {
+                    context->result->next_child = nodeAllocate();
+                    working_result = context->result->next_child;
+                    context->result = working_result;
+                    context->operators.clear();
+                    next_expression = true;
+                    break;
+                }
+            } else if (strcmp(operation->value.symbol, "while") == 0) {
+                err = expected.expect(expected, "{", current_token, token_length, end);
+                if (err.msg != "Continue") { return err; }
+                if (expected.done || !expected.found) {
+                    err.prepareError(ErrorType::SYNTAX, "Expected opening brace for loop body after while condition");
+                    return err;
+                }
+                // The condition is done; the body is parsed in a scope of its own.
+                Node *loop = context->expression;
+                ParsingContext *parent = context->parent;
+                scopeRelease(context->scopes, scopeMark(context->scopes) - 1);
+                context = scopePush(parent->scopes, parent, "whilebody");
+                context->expression = loop;
+                Node *first_expression = nodeAllocate();
+                nodeAddChild(loop->children->next_child, first_expression);
+                working_result = first_expression;
+                context->result = working_result;
+                next_expression = true;
+                break;
+            } else if (strcmp(operation->value.symbol, "funcall") == 0) {
+                err = expected.expect(expected, ")", current_token, token_length, end);
+                if (err.msg != "Continue") { return err; }
+                if (expected.done) { return ok; }
+                if (!expected.found) {
+                    err = expected.expect(expected, ",", current_token, token_length, end);
+                    if (err.msg != "Continue") { return err; }
+                    if (expected.done || !expected.found) {
+                        printToken(current_token);
+                        err.prepareError(ErrorType::SYNTAX, "Parameter list expected closing parenthesis or comma for another parameter");
+                        return err;
+                    }
+
+                    context->result->next_child = nodeAllocate();
+                    working_result = context->result->next_child;
+                    context->result = working_result;
+                    context->operators.clear();
+                    next_expression = true;
+                    break;
+                }
+            }
+            ParsingContext *parent = context->parent;
+            Node *call = strcmp(operation->value.symbol, "funcall") == 0 ? context->expression : nullptr;
+            scopeRelease(context->scopes, scopeMark(context->scopes) - 1);
+            context = parent;
+            // A call's result may be the left operand of an operator.
+            if (call) {
+                err = parseBinaryOperator(context, call, &current_token, &token_length, end, &working_result, &next_expression);
+                if (err.type != ErrorType::NONE) { return err; }
+            }
+        }
+        if (!next_expression) { break; }
+    }
+    return err;
+}
+
+Error parseExpr(ParsingContext *context, char* source, char **end, Node *result) {
+    ScopeGuard scope_guard = {context->scopes, scopeMark(context->scopes)};
+    context->operators.clear();
+    Token current_token;
+    current_token.begin = source;
+    current_token.end   = source;
+    return parseExprFrom(context, current_token, end, result);
+}
+
+static WalkAction parseCollectCallee(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    if (node->type == NodeType::FUNCTION_CALL && node->children && node->children->isSymbol())
+        static_cast<std::vector<const char *> *>(data)->push_back(node->children->value.symbol);
+    return WalkAction::CONTINUE;
+}
+
+struct ParseDroppedFunctions {
+    std::unordered_set<Node *> functions;
+    /// Names of the removed bindings, freed once the environment no longer refers to them.
+    std::vector<Node *> ids;
+};
+
+static bool parseFunctionDropped(Binding *binding, void *data) {
+    ParseDroppedFunctions *dropped = static_cast<ParseDroppedFunctions *>(data);
+    if (!dropped->functions.count(binding->value))
+        return false;
+    dropped->ids.push_back(binding->id);
+    return true;
+}
 
-            context->result->next_child = nodeAllocate();
-            working_result = context->result->next_child;
-            context->result = working_result;
+/// Parse a deferred body with the globals and types its definition could see.
+static Error parseDeferredBody(ParsingContext *context, const ParseDeferredBody &deferred) {
+    ScopeGuard scope_guard = {context->scopes, scopeMark(context->scopes)};
+    Binding *variables = context->variables->bind;
+    Binding *types = context->types->bind;
+    // Bindings are prepended, so the lists from the definition on are what it saw.
+    context->variables->bind = deferred.variables;
+    context->types->bind = deferred.types;
+    context->operators.clear();
+    Token current_token;
+    current_token.begin = deferred.source;
+    current_token.end = deferred.source;
+    char *end = deferred.source;
+    ParsingContext *body_context = context;
+    Node *first_expression = parseFunctionBodyBegin(&body_context, deferred.function);
+    Error err = parseExprFrom(body_context, current_token, &end, first_expression);
+    context->variables->bind = variables;
+    context->types->bind = types;
+    return err;
+}
+
+/**
+ * Parse the deferred bodies of the functions the program can call, starting
+ * from its top-level expressions, and drop the definitions of the others.
+ */
+static Error parseDeferredBodies(ParsingContext *context, Node *program) {
+    TimingScope timing("parseDeferredBodies");
+    Error err = ok;
+    std::vector<ParseDeferredBody> &deferred = context->deferred_bodies;
+    std::unordered_map<Node *, size_t> deferred_index;
+    for (size_t i = 0; i < deferred.size(); i++)
+        deferred_index[deferred[i].function] = i;
+    // Only the definition bound last under a name can be called.
+    std::unordered_map<std::string, Binding *> bindings;
+    for (Binding *it = context->functions->bind; it; it = it->next)
+        if (deferred_index.count(it->value))
+            bindings[it->id->value.symbol] = it;
+
+    std::vector<const char *> callees;
+    for (Node *expression = program->children; expression; expression = expression->next_child)
+        if (!deferred_index.count(expression))
+            nodeWalk(expression, {parseCollectCallee, nullptr, &callees});
+    std::vector<bool> parsed(deferred.size(), false);
+    while (!callees.empty()) {
+        auto found = bindings.find(callees.back());
+        callees.pop_back();
+        if (found == bindings.end())
+            continue;
+        size_t index = deferred_index[found->second->value];
+        if (parsed[index])
+            continue;
+        parsed[index] = true;
+        err = parseDeferredBody(context, deferred[index]);
+        if (err.type != ErrorType::NONE)
+            return err;
+        nodeWalk(deferred[index].function->children->next_child->next_child,
+                 {parseCollectCallee, nullptr, &callees});
+    }
 
+    ParseDroppedFunctions dropped;
+    for (size_t i = 0; i < deferred.size(); i++) {
+        if (parsed[i])
             continue;
+        Node *function = deferred[i].function;
+        dropped.functions.insert(function);
+        Node *child = function->children;
+        while (child) {
+            Node *next = child->next_child;
+            deleteNode(child);
+            child = next;
         }
+        function->children = nullptr;
+        function->type = NodeType::NONE;
     }
-    return err;
+    environmentRemoveIf(context->functions, parseFunctionDropped, &dropped);
+    for (Node *id : dropped.ids)
+        deleteNode(id);
+    deferred.clear();
+    return ok;
 }
 
 Error parseProgram(char *filepath, ParsingContext *context, Node *result) {
     Error err = ok;
-    char *contents = FileContents(filepath);
+    char *contents = nullptr;
+    {
+        TimingScope timing("FileContents", filepath);
+        contents = FileContents(filepath);
+    }
     if(!contents){
         std::cout << "Filepath: " << filepath << '\n';
         err.prepareError(ErrorType::GENERIC, "parseProgram(): Couldn't get file contents");
         return err;
     }
+    err = parseProgramBuffer(contents, context, result);
+    fileContentsFree(contents);
+    return err;
+}
+
+Error parseProgramBuffer(char *source, ParsingContext *context, Node *result) {
+    Error err = ok;
     result->type = NodeType::PROGRAM;
-    char *contents_it = contents;
+    char *contents_it = source;
     for(;;){
         Node *expression = nodeAllocate();
         nodeAddChild(result, expression);
-        err = parseExpr(context, contents_it, &contents_it, expression);
-        if (err.type != ErrorType::NONE) {
-            delete[] contents;
-            return err;
+        {
+            TimingScope timing("parseExpr");
+            err = parseExpr(context, contents_it, &contents_it, expression);
         }
+        if (err.type != ErrorType::NONE)
+            return err;
         if (!(*contents_it)) { break; }
     }
-    delete[] contents;
+    if (!context->deferred_bodies.empty())
+        return parseDeferredBodies(context, result);
     return ok;
-}
\ No newline at end of file
+}
+
+Error parseProgramStream(char *filepath, ParsingContext *context, ParseStreamCallback emit, void *data) {
+    Error err = ok;
+    SourceMapping source;
+    bool mapped = false;
+    {
+        TimingScope timing("FileContents", filepath);
+        mapped = fileMap(filepath, &source);
+    }
+    if(!mapped){
+        std::cout << "Filepath: " << filepath << '\n';
+        err.prepareError(ErrorType::GENERIC, "parseProgramStream(): Couldn't map file contents");
+        return err;
+    }
+    char *contents_it = source.contents;
+    for(;;){
+        Node *expression = nodeAllocate();
+        {
+            TimingScope timing("parseExpr");
+            err = parseExpr(context, contents_it, &contents_it, expression);
+        }
+        if (err.type == ErrorType::NONE)
+            err = emit(expression, data);
+        // Function definitions stay alive: the functions environment points into them.
+        if (expression->type != NodeType::FUNCTION)
+            deleteNode(expression);
+        if (err.type != ErrorType::NONE)
+            break;
+        if (!(*contents_it)) { break; }
+        fileRelease(&source, contents_it);
+    }
+    fileUnmap(&source);
+    return err;
+}
@@ -2,6 +2,7 @@
 #define COMPILER_PARSER_H
 
 #include <cstddef>
+#include <vector>
 #include "error.h"
 
 // typedef struct struct Environment struct Environment;
@@ -22,16 +23,27 @@ enum class NodeType {
     SYMBOL,
     FUNCTION,
     FUNCTION_CALL,
+    /// Children: variable symbol, initial value (NONE if absent), type symbol.
     VARIABLE_DECLARATION,
     VARIABLE_DECLARATION_INITIALIZED,
     VARIABLE_REASSIGNMENT,
+    /// Children: operator symbol, left operand, right operand.
     BINARY_OPERATOR,
     PROGRAM,
+    /// Children: condition, body (NONE holding a list), preheader (NONE holding
+    /// statements run once before the first iteration, if there is one).
+    WHILE,
+    /// Type node of a record type; only found in the types environment (see record_layout.h).
+    RECORD,
     MAX
 };
 
 struct Node {
     NodeType type;
+    /// Structural hash of a hash-consed node (see node_intern.h); 0 for ordinary nodes.
+    unsigned int hash;
+    /// INTEGER literals above INT64_MAX: `integer` holds them wrapped to negative.
+    bool integer_above_signed;
 
     union NodeValue {
         long long integer;
@@ -52,10 +64,22 @@ struct Node {
     bool isSymbol() const {
         return type == NodeType::SYMBOL;
     }
+
+    bool isInterned() const {
+        return hash != 0;
+    }
 };
 
 void nodeAddChild(Node *parent, Node *new_child);
 Node *nodeAllocate();
+/// Free a node from nodeAllocate(), but neither its symbol nor its children.
+void nodeFree(Node *node);
+/// Storage for a symbol of `length` characters and its NUL; free with symbolFree().
+char *symbolAllocate(size_t length);
+void symbolFree(char *symbol);
+/// Compares type and value only, not children.
+bool nodeValueEqual(const Node *a, const Node *b);
+/// Structural equality of two subtrees; the siblings of `a` and `b` are not compared.
 bool nodeCompare(Node *a, Node *b);
 Node *nodeInteger(long long value);
 Node *nodeSymbol(const char *symbol_string);
@@ -76,7 +100,8 @@ struct ExpectReturnValue {
 
 ExpectReturnValue lexExpect(const std::string &expected, Token *current, size_t *current_length, char **end);
 
-bool parseInteger(Token *token, Node *node);
+/// Parse `token` into `node` if it is a decimal integer literal; literals too large for 64 bits are an error.
+Error parseInteger(Token *token, Node *node, bool *found);
 
 struct ParsingStack {
     struct ParsingContext *parent;
@@ -84,6 +109,17 @@ struct ParsingStack {
     Node *result;
 };
 
+/// A top-level function body skipped by brace matching, to be parsed if the program calls the function.
+struct ParseDeferredBody {
+    Node *function;
+    /// Just past the body's opening brace.
+    char *source;
+    /// Heads of the root variables and types environments at the definition,
+    /// so the body sees the globals and records declared before it, as usual.
+    struct Binding *variables;
+    struct Binding *types;
+};
+
 struct ParsingContext {
     struct ParsingContext *parent;
     Node *operation;
@@ -91,14 +127,78 @@ struct ParsingContext {
     struct Environment *types;
     struct Environment *variables;
     struct Environment *functions;
+    /// Shared by a root context and every scope entered below it.
+    struct ScopeStack *scopes;
+    /// The call or loop a "funcall" or "while" scope was opened for.
+    Node *expression;
+    /// Binary operators of the expression being parsed whose right operand is
+    /// still open, outermost first.
+    std::vector<Node *> operators;
+    /// Set on a root context to defer top-level function bodies (see parseProgramBuffer()).
+    bool defer_bodies;
+    std::vector<ParseDeferredBody> deferred_bodies;
+};
+
+/**
+ * Storage for the nested contexts opened while parsing or emitting function
+ * bodies and call arguments. Entering a scope reuses the frame (and its
+ * environments' bindings) at the current depth; leaving pops back to a mark.
+ */
+struct ScopeStack {
+    std::vector<ParsingContext *> frames;
+    size_t depth;
 };
 
+size_t scopeMark(ScopeStack *stack);
+/// Enter a scope below `parent`; `operation` names the scope ("func", "funcall").
+ParsingContext *scopePush(ScopeStack *stack, ParsingContext *parent, const char *operation);
+/// Leave every scope entered since `mark` was taken.
+void scopeRelease(ScopeStack *stack, size_t mark);
+
+/**
+ * Type nodes hold their byte size as first child and, for integer types,
+ * whether they are signed as second. `integer` is a signed 64-bit type;
+ * `i8`..`i64` and `u8`..`u64` are the fixed-width built-ins.
+ */
+Error nodeAddType(struct Environment *types, NodeType type, Node *type_symbol, long long byte_size, bool is_signed = true);
+long long typeSize(const Node *type_info);
+/// Built-in types are aligned to their size; records to their most aligned field, unless packed.
+long long typeAlignment(const Node *type_info);
+bool typeIsSigned(const Node *type_info);
+/// Whether an integer literal is representable in the type.
+bool typeContains(const Node *type_info, const Node *literal);
 Error parseGetType(ParsingContext *context, Node *id, Node *result);
 
+/// A context without a parent owns a new scope stack; others share their parent's.
 ParsingContext *parseContextCreate(ParsingContext *parent);
+/// Frees the context, its environments, its operation and any scope stack it owns, but not its parent.
+void parseContextDelete(ParsingContext *context);
 ParsingContext *parseContextDefaultCreate();
+/**
+ * Forget every variable, function and record type declared in a root
+ * context, keeping its built-in types and scope frames warm for the next
+ * program. Function
+ * definitions belong to the program that declared them and are not freed.
+ */
+void parseContextReset(ParsingContext *context);
 
 Error parseExpr(ParsingContext *context, char* source, char **end, Node* result);
 Error parseProgram(char *filepath, ParsingContext *context, Node *result);
+/**
+ * Parse a NUL-terminated source buffer; the AST copies what it keeps, so
+ * `source` may be freed after. With `context->defer_bodies`, top-level
+ * function bodies are skipped at first and only those of functions the
+ * program can call are parsed, once the rest of it is; the other
+ * definitions become NONE nodes and their errors go unreported.
+ */
+Error parseProgramBuffer(char *source, ParsingContext *context, Node *result);
+
+typedef Error (*ParseStreamCallback)(Node *expression, void *data);
+/**
+ * Parse one top-level expression at a time and hand it to `emit`.
+ * Every expression except function definitions is freed right after `emit`
+ * returns, and consumed source pages are released, so memory stays bounded.
+ */
+Error parseProgramStream(char *filepath, ParsingContext *context, ParseStreamCallback emit, void *data);
 
 #endif /* COMPILER_PARSER_H */
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include "pass_manager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+
+#include "const_eval.h"
+#include "inline.h"
+#include "loop_optimize.h"
+#include "node_walk.h"
+#include "timing.h"
+
+//================================================================ BEG REGISTRY
+
+static Error passConstEval(ParsingContext *context, Node *program, const CompileOptions &options, std::ostream *report) {
+    ConstEvalStats stats;
+    Error err = constEvalProgram(context, program, options.const_eval_options, &stats);
+    if (err.type == ErrorType::NONE && report)
+        printConstEvalStats(stats, *report);
+    return err;
+}
+
+static Error passInline(ParsingContext *context, Node *program, const CompileOptions &options, std::ostream *report) {
+    InlineStats stats;
+    Error err = inlineProgram(context, program, options.inline_options, &stats);
+    if (err.type == ErrorType::NONE && report)
+        printInlineStats(stats, *report);
+    return err;
+}
+
+static Error passLoops(ParsingContext *context, Node *program, const CompileOptions &options, std::ostream *report) {
+    LoopStats stats;
+    Error err = loopOptimizeProgram(context, program, options.loop_options, &stats);
+    if (err.type == ErrorType::NONE && report)
+        printLoopStats(stats, *report);
+    return err;
+}
+
+static std::vector<Pass> &passRegistryMutable() {
+    // Folded calls shrink bodies below the inlining threshold, and inlined code may sit in loops.
+    static std::vector<Pass> registry = {
+        {"const-eval", 1, {}, passConstEval,
+         [](const CompileOptions &options) { return options.evaluate_calls; }},
+        {"inline", 2, {"const-eval"}, passInline,
+         [](const CompileOptions &options) { return options.inline_functions; }},
+        {"loops", 1, {"const-eval", "inline"}, passLoops,
+         [](const CompileOptions &options) { return options.optimize_loops; }},
+    };
+    return registry;
+}
+
+const std::vector<Pass> &passRegistry() {
+    return passRegistryMutable();
+}
+
+const Pass *passFind(const std::string &name) {
+    for (const Pass &pass : passRegistry())
+        if (name == pass.name)
+            return &pass;
+    return nullptr;
+}
+
+Error passRegister(const Pass &pass) {
+    Error err = ok;
+    if (!pass.name || !pass.run) {
+        err.prepareError(ErrorType::ARGUMENTS, "passRegister(): a pass needs a name and a run function");
+        return err;
+    }
+    if (passFind(pass.name)) {
+        err.prepareError(ErrorType::GENERIC, std::string("passRegister(): redefinition of pass ") + pass.name);
+        return err;
+    }
+    passRegistryMutable().push_back(pass);
+    return ok;
+}
+
+Error passPipelineBuild(const CompileOptions &options, std::vector<const Pass *> *pipeline) {
+    Error err = ok;
+    std::vector<const Pass *> selected;
+    for (const Pass &pass : passRegistry())
+        if (options.optimization_level >= pass.level || (pass.requested && pass.requested(options)))
+            selected.push_back(&pass);
+
+    // Each step takes the first pass, in registration order, whose dependencies in the pipeline have run.
+    pipeline->clear();
+    std::vector<bool> placed(selected.size(), false);
+    while (pipeline->size() < selected.size()) {
+        size_t next = selected.size();
+        for (size_t i = 0; i < selected.size() && next == selected.size(); i++) {
+            if (placed[i])
+                continue;
+            bool ready = true;
+            for (const std::string &dependency : selected[i]->after)
+                for (size_t j = 0; j < selected.size(); j++)
+                    if (!placed[j] && dependency == selected[j]->name)
+                        ready = false;
+            if (ready)
+                next = i;
+        }
+        if (next == selected.size()) {
+            err.prepareError(ErrorType::GENERIC, "passPipelineBuild(): the dependencies of the passes form a cycle");
+            return err;
+        }
+        placed[next] = true;
+        pipeline->push_back(selected[next]);
+    }
+    return ok;
+}
+
+//================================================================ END REGISTRY
+
+//================================================================ BEG CHANGE COUNTING
+
+/// A node of a program snapshot, in pre-order: its children follow it, each after the subtree of the one before.
+struct PassSnapshotNode {
+    /// Hash of the node's type and value.
+    size_t label;
+    /// Hash of the node's whole subtree.
+    size_t hash;
+    /// Nodes in the subtree, the node included.
+    size_t size;
+};
+
+static size_t passHashMix(size_t hash, size_t value) {
+    return (hash ^ value) * static_cast<size_t>(1099511628211ull);
+}
+
+static size_t passNodeLabel(const Node *node) {
+    size_t hash = passHashMix(static_cast<size_t>(14695981039346656037ull), static_cast<size_t>(node->type));
+    if (node->type == NodeType::INTEGER)
+        return passHashMix(hash, static_cast<size_t>(node->value.integer));
+    if (node->type == NodeType::SYMBOL && node->value.symbol)
+        for (const char *it = node->value.symbol; *it; it++)
+            hash = passHashMix(hash, static_cast<unsigned char>(*it));
+    return hash;
+}
+
+struct PassSnapshotState {
+    std::vector<PassSnapshotNode> *nodes;
+    std::vector<size_t> open;
+};
+
+static WalkAction passSnapshotPre(Node *node, Node *parent, size_t depth, void *data) {
+    (void)parent;
+    (void)depth;
+    PassSnapshotState *state = static_cast<PassSnapshotState *>(data);
+    state->open.push_back(state->nodes->size());
+    state->nodes->push_back({passNodeLabel(node), 0, 0});
+    return WalkAction::CONTINUE;
+}
+
+static WalkAction passSnapshotPost(Node *node, Node *parent, size_t depth, void *data) {
+    (void)node;
+    (void)parent;
+    (void)depth;
+    PassSnapshotState *state = static_cast<PassSnapshotState *>(data);
+    std::vector<PassSnapshotNode> &nodes = *state->nodes;
+    size_t index = state->open.back();
+    state->open.pop_back();
+    PassSnapshotNode &entry = nodes[index];
+    entry.size = nodes.size() - index;
+    entry.hash = entry.label;
+    for (size_t child = index + 1; child < index + entry.size; child += nodes[child].size)
+        entry.hash = passHashMix(entry.hash, nodes[child].hash);
+    return WalkAction::CONTINUE;
+}
+
+static void passSnapshot(Node *program, std::vector<PassSnapshotNode> *nodes) {
+    nodes->clear();
+    PassSnapshotState state = {nodes, {}};
+    nodeWalk(program, {passSnapshotPre, passSnapshotPost, &state});
+}
+
+static std::vector<size_t> passSnapshotChildren(const std::vector<PassSnapshotNode> &nodes, size_t index) {
+    std::vector<size_t> children;
+    for (size_t child = index + 1; child < index + nodes[index].size; child += nodes[child].size)
+        children.push_back(child);
+    return children;
+}
+
+/**
+ * Nodes added or removed between two snapshots. Equal subtrees are
+ * unchanged; a node whose type and value stay but whose children differ
+ * matches its identical children wherever they moved, pairs the others in
+ * order and compares them in turn.
+ */
+static size_t passSnapshotDiff(const std::vector<PassSnapshotNode> &a, const std::vector<PassSnapshotNode> &b) {
+    size_t changed = 0;
+    std::vector<std::pair<size_t, size_t>> pending;
+    pending.push_back({0, 0});
+    while (!pending.empty()) {
+        size_t i = pending.back().first;
+        size_t j = pending.back().second;
+        pending.pop_back();
+        if (a[i].hash == b[j].hash)
+            continue;
+        if (a[i].label != b[j].label) {
+            changed += a[i].size + b[j].size;
+            continue;
+        }
+        std::unordered_map<size_t, std::vector<size_t>> old_children;
+        std::vector<size_t> old_order = passSnapshotChildren(a, i);
+        for (auto it = old_order.rbegin(); it != old_order.rend(); ++it)
+            old_children[a[*it].hash].push_back(*it);
+        std::vector<size_t> new_unmatched;
+        for (size_t child : passSnapshotChildren(b, j)) {
+            auto found = old_children.find(b[child].hash);
+            if (found == old_children.end() || found->second.empty()) {
+                new_unmatched.push_back(child);
+                continue;
+            }
+            found->second.pop_back();
+        }
+        std::vector<size_t> old_unmatched;
+        for (size_t child : old_order) {
+            std::vector<size_t> &same = old_children[a[child].hash];
+            if (std::find(same.begin(), same.end(), child) != same.end())
+                old_unmatched.push_back(child);
+        }
+        size_t pairs = std::min(old_unmatched.size(), new_unmatched.size());
+        for (size_t k = 0; k < pairs; k++) {
+            if (a[old_unmatched[k]].label == b[new_unmatched[k]].label)
+                pending.push_back({old_unmatched[k], new_unmatched[k]});
+            else
+                changed += a[old_unmatched[k]].size + b[new_unmatched[k]].size;
+        }
+        for (size_t k = pairs; k < old_unmatched.size(); k++)
+            changed += a[old_unmatched[k]].size;
+        for (size_t k = pairs; k < new_unmatched.size(); k++)
+            changed += b[new_unmatched[k]].size;
+    }
+    return changed;
+}
+
+//================================================================ END CHANGE COUNTING
+
+Error passPipelineRun(const std::vector<const Pass *> &pipeline, ParsingContext *context, Node *program,
+                      const CompileOptions &options, const PassRunOptions &run_options, std::vector<PassStats> *stats,
+                      std::ostream &out) {
+    Error err = ok;
+    bool count_changes = stats && run_options.count_changes;
+    std::vector<PassSnapshotNode> before;
+    std::vector<PassSnapshotNode> after;
+    if (count_changes)
+        passSnapshot(program, &before);
+    for (const Pass *pass : pipeline) {
+        bool report = std::find(run_options.report.begin(), run_options.report.end(), pass->name)
+            != run_options.report.end();
+        long long begin = timingNow();
+        err = pass->run(context, program, options, report ? &out : nullptr);
+        long long end = timingNow();
+        if (err.type != ErrorType::NONE)
+            return err;
+        if (stats) {
+            PassStats entry = {pass->name, end - begin, 0, 0, 0};
+            if (count_changes) {
+                passSnapshot(program, &after);
+                entry.nodes_before = before.size();
+                entry.nodes_after = after.size();
+                entry.nodes_changed = passSnapshotDiff(before, after);
+                before.swap(after);
+            }
+            stats->push_back(entry);
+        }
+        if (run_options.print_after && strcmp(run_options.print_after, pass->name) == 0) {
+            // printNode() always writes to std::cout.
+            out << "AST after " << pass->name << ":\n";
+            out.flush();
+            printNode(program, 0);
+            std::cout << '\n';
+        }
+    }
+    return ok;
+}
+
+void printPassStats(const std::vector<PassStats> &stats, std::ostream &out) {
+    out << "Pass          time (ms)  nodes before  nodes after  nodes changed\n";
+    for (const PassStats &entry : stats) {
+        std::ios::fmtflags flags = out.flags();
+        out << std::left << std::setw(12) << entry.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(11) << static_cast<double>(entry.nanoseconds) / 1e6
+            << std::setw(14) << entry.nodes_before
+            << std::setw(13) << entry.nodes_after
+            << std::setw(15) << entry.nodes_changed << '\n';
+        out.flags(flags);
+    }
+}
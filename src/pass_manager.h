@@ -0,0 +1,72 @@
+#ifndef COMPILER_PASS_MANAGER_H
+#define COMPILER_PASS_MANAGER_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "compiler.h"
+#include "error.h"
+#include "parser.h"
+
+/**
+ * Transform the program in place.
+ * @param report Where the pass prints its own statistics, or NULL.
+ */
+typedef Error (*PassRunFn)(ParsingContext *context, Node *program, const CompileOptions &options, std::ostream *report);
+
+struct Pass {
+    /// Used by --print-after and in statistics.
+    const char *name;
+    /// Lowest -O level whose pipeline includes the pass.
+    int level;
+    /// Passes that run before this one whenever both are in a pipeline.
+    std::vector<std::string> after;
+    PassRunFn run;
+    /// Whether the options ask for the pass at any level, e.g. `--inline`; may be NULL.
+    bool (*requested)(const CompileOptions &options);
+};
+
+/**
+ * Add a pass to the registry, which starts out with the built-in passes:
+ * "const-eval" (-O1), "inline" (-O2) and "loops" (-O1), run in that order.
+ */
+Error passRegister(const Pass &pass);
+const std::vector<Pass> &passRegistry();
+/// Registered pass called `name`, or NULL.
+const Pass *passFind(const std::string &name);
+
+/// The passes of `options.optimization_level` and those asked for by name, each after its dependencies.
+Error passPipelineBuild(const CompileOptions &options, std::vector<const Pass *> *pipeline);
+
+struct PassRunOptions {
+    /// Print the program after this pass has run; NULL for none.
+    const char *print_after;
+    /// Measure how many AST nodes each pass changed, which costs a snapshot of the program per pass.
+    bool count_changes;
+    /// Passes that print their own statistics.
+    std::vector<std::string> report;
+
+    PassRunOptions():
+        print_after(nullptr),
+        count_changes(false)
+    {}
+};
+
+struct PassStats {
+    const char *name;
+    long long nanoseconds;
+    size_t nodes_before;
+    size_t nodes_after;
+    /// Nodes added or removed; identical subtrees match wherever they moved to.
+    size_t nodes_changed;
+};
+
+/// Run `pipeline` on the program, appending one entry per pass to `stats` if it is not NULL.
+Error passPipelineRun(const std::vector<const Pass *> &pipeline, ParsingContext *context, Node *program,
+                      const CompileOptions &options, const PassRunOptions &run_options, std::vector<PassStats> *stats,
+                      std::ostream &out);
+void printPassStats(const std::vector<PassStats> &stats, std::ostream &out);
+
+#endif /* COMPILER_PASS_MANAGER_H */
@@ -0,0 +1,310 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "environment.h"
+#include "file_io.h"
+#include "lex_parallel.h"
+#include "memory_stats.h"
+#include "parser.h"
+#include "timing.h"
+
+/// Enough for the lexer to run well ahead of the parser, small enough to stay in cache.
+constexpr size_t PIPELINE_TOKEN_CAPACITY = 1 << 14;
+constexpr size_t PIPELINE_EXPRESSION_CAPACITY = 1 << 10;
+/// Tokens the parser takes from the queue at a time.
+constexpr size_t PIPELINE_TOKEN_BATCH = 256;
+
+enum class PipelineEnvironment {
+    TYPES,
+    VARIABLES,
+    FUNCTIONS,
+};
+
+/// A root binding made by the parser, to be made again in the code generator's context.
+struct PipelineDeclaration {
+    PipelineEnvironment environment;
+    Node *id;
+    Node *value;
+};
+
+/// A parsed top-level expression; one without an expression ends the stream.
+struct PipelineItem {
+    Node *expression;
+    /// Root bindings the expression added or replaced, oldest first.
+    std::vector<PipelineDeclaration> declarations;
+
+    PipelineItem():
+        expression(nullptr)
+    {}
+};
+
+struct PipelineState {
+    SourceMapping source;
+    /// The parser thread's; only it touches the context until it is joined.
+    ParsingContext *context;
+    /// Start of the top-level expression being parsed; no earlier token is asked for again.
+    char *expression_begin;
+    /// Parser side: whether the empty token that ends the stream came through.
+    bool tokens_done;
+    Error lex_error;
+    Error parse_error;
+    SpscQueue<StreamToken> tokens;
+    SpscQueue<PipelineItem> expressions;
+
+    PipelineState():
+        context(nullptr),
+        expression_begin(nullptr),
+        tokens_done(false),
+        tokens(PIPELINE_TOKEN_CAPACITY),
+        expressions(PIPELINE_EXPRESSION_CAPACITY)
+    {}
+};
+
+//================================================================ BEG STAGES
+
+static void pipelineLex(PipelineState *state, char *source, size_t length) {
+    TimingScope timing("pipeline lexer");
+    Token token;
+    token.begin = source;
+    token.end = source;
+    token.next = nullptr;
+    for (;;) {
+        Error err = lex(token.end, &token);
+        if (err.type != ErrorType::NONE) {
+            state->lex_error = err;
+            break;
+        }
+        if (token.begin == token.end)
+            break;
+        // Fails once the parser has given up.
+        if (!state->tokens.push({token.begin, token.end}))
+            return;
+    }
+    state->tokens.push({source + length, source + length});
+}
+
+/// TokenStream::refill for the parser: slide the stream's window past the tokens already parsed.
+static bool pipelineRefillTokens(TokenStream *stream) {
+    PipelineState *state = static_cast<PipelineState *>(stream->refill_data);
+    if (state->tokens_done)
+        return false;
+    std::vector<StreamToken> &tokens = stream->tokens;
+    size_t capacity = tokens.capacity();
+    size_t parsed = std::lower_bound(tokens.begin(), tokens.end(), state->expression_begin,
+                                     [](const StreamToken &it, char *at) { return it.begin < at; }) - tokens.begin();
+    parsed = std::min(parsed, stream->cursor);
+    tokens.erase(tokens.begin(), tokens.begin() + parsed);
+    stream->cursor -= parsed;
+
+    StreamToken batch[PIPELINE_TOKEN_BATCH];
+    size_t count = state->tokens.pop(batch, PIPELINE_TOKEN_BATCH);
+    for (size_t i = 0; i < count; i++) {
+        if (batch[i].begin == batch[i].end) {
+            state->tokens_done = true;
+            break;
+        }
+        tokens.push_back(batch[i]);
+    }
+    if (tokens.capacity() != capacity) {
+        if (capacity)
+            memoryFreed(MemoryCategory::SOURCE, capacity * sizeof(StreamToken));
+        memoryAllocated(MemoryCategory::SOURCE, tokens.capacity() * sizeof(StreamToken));
+    }
+    return true;
+}
+
+/// Append the bindings of `env` made since `old_head` was its first one, oldest first.
+static void pipelineCollectBindings(Environment *env, Binding *old_head, PipelineEnvironment environment,
+                                    std::vector<PipelineDeclaration> *declarations) {
+    size_t first = declarations->size();
+    for (Binding *it = env->bind; it && it != old_head; it = it->next)
+        declarations->push_back({environment, it->id, it->value});
+    std::reverse(declarations->begin() + first, declarations->end());
+}
+
+static void pipelineParse(PipelineState *state) {
+    TimingScope timing("pipeline parser");
+    ParsingContext *context = state->context;
+    TokenStream stream;
+    stream.source = state->source.contents;
+    stream.length = state->source.size;
+    stream.refill = pipelineRefillTokens;
+    stream.refill_data = state;
+    lexUseTokenStream(&stream);
+
+    char *contents_it = state->source.contents;
+    for (;;) {
+        state->expression_begin = contents_it;
+        Binding *types = context->types->bind;
+        Binding *variables = context->variables->bind;
+        Binding *functions = context->functions->bind;
+        PipelineItem item;
+        item.expression = nodeAllocate();
+        Node *expression = item.expression;
+        Error err = ok;
+        {
+            TimingScope timing("parseExpr");
+            err = parseExpr(context, contents_it, &contents_it, expression);
+        }
+        if (err.type != ErrorType::NONE) {
+            state->parse_error = err;
+            // Function definitions stay alive: the functions environment points into them.
+            if (expression->type != NodeType::FUNCTION)
+                deleteNode(expression);
+            break;
+        }
+        pipelineCollectBindings(context->types, types, PipelineEnvironment::TYPES, &item.declarations);
+        pipelineCollectBindings(context->variables, variables, PipelineEnvironment::VARIABLES, &item.declarations);
+        pipelineCollectBindings(context->functions, functions, PipelineEnvironment::FUNCTIONS, &item.declarations);
+        if (expression->type == NodeType::FUNCTION && context->functions->bind == functions) {
+            // A redefinition replaces the value of the existing binding.
+            for (Binding *it = context->functions->bind; it; it = it->next) {
+                if (it->value == expression) {
+                    item.declarations.push_back({PipelineEnvironment::FUNCTIONS, it->id, it->value});
+                    break;
+                }
+            }
+        }
+        bool last = !*contents_it;
+        // Fails once code generation has given up.
+        if (!state->expressions.push(std::move(item))) {
+            if (expression->type != NodeType::FUNCTION)
+                deleteNode(expression);
+            break;
+        }
+        if (last)
+            break;
+        fileRelease(&state->source, contents_it);
+    }
+    state->expressions.push(PipelineItem());
+    state->tokens.close();
+    lexUseTokenStream(nullptr);
+    tokenStreamClear(&stream);
+    environmentFreeListRelease();
+}
+
+static Environment *pipelineEnvironment(ParsingContext *context, PipelineEnvironment environment) {
+    switch (environment) {
+        case PipelineEnvironment::TYPES: return context->types;
+        case PipelineEnvironment::VARIABLES: return context->variables;
+        default: return context->functions;
+    }
+}
+
+/// Code generation on the calling thread, until the end of the stream or the first error.
+static Error pipelineEmit(PipelineState *state, CodegenStream *stream) {
+    TimingScope timing("pipeline codegen");
+    Error err = ok;
+    PipelineItem items[16];
+    for (;;) {
+        size_t count = state->expressions.pop(items, 16);
+        for (size_t i = 0; i < count; i++) {
+            Node *expression = items[i].expression;
+            if (!expression)
+                return ok;
+            for (const PipelineDeclaration &declaration : items[i].declarations)
+                environmentSet(pipelineEnvironment(stream->context, declaration.environment), declaration.id,
+                               declaration.value);
+            err = codegen_stream_expression(stream, expression);
+            if (expression->type != NodeType::FUNCTION)
+                deleteNode(expression);
+            if (err.type != ErrorType::NONE) {
+                for (size_t j = i + 1; j < count; j++)
+                    if (items[j].expression && items[j].expression->type != NodeType::FUNCTION)
+                        deleteNode(items[j].expression);
+                return err;
+            }
+        }
+    }
+}
+
+//================================================================ END STAGES
+
+Error pipelineCompile(char *path, CodegenOutputFormat format, PipelineStats *stats) {
+    Error err = ok;
+    PipelineState state;
+    bool mapped = false;
+    {
+        TimingScope timing("FileContents", path);
+        mapped = fileMap(path, &state.source);
+    }
+    if (!mapped) {
+        std::cout << "Filepath: " << path << '\n';
+        err.prepareError(ErrorType::GENERIC, "pipelineCompile(): Couldn't map file contents");
+        return err;
+    }
+    state.context = parseContextDefaultCreate();
+    // Code generation gets a context of its own, starting with the built-in types.
+    ParsingContext *context = parseContextCreate(nullptr);
+    std::vector<PipelineDeclaration> builtins;
+    pipelineCollectBindings(state.context->types, nullptr, PipelineEnvironment::TYPES, &builtins);
+    for (const PipelineDeclaration &builtin : builtins)
+        environmentSet(context->types, builtin.id, builtin.value);
+
+    CodegenStream stream;
+    err = codegen_stream_begin(&stream, format, context);
+    if (err.type == ErrorType::NONE) {
+        std::thread lexer(pipelineLex, &state, state.source.contents, state.source.size);
+        std::thread parser(pipelineParse, &state);
+        err = pipelineEmit(&state, &stream);
+        // Make the parser stop early if code generation failed.
+        state.expressions.close();
+        parser.join();
+        lexer.join();
+        PipelineItem item;
+        while (state.expressions.tryPop(&item, 1))
+            if (item.expression && item.expression->type != NodeType::FUNCTION)
+                deleteNode(item.expression);
+        // A lexing error is what derailed the parser, if there is one.
+        if (state.lex_error.type != ErrorType::NONE)
+            err = state.lex_error;
+        else if (state.parse_error.type != ErrorType::NONE)
+            err = state.parse_error;
+        if (err.type == ErrorType::NONE)
+            err = codegen_stream_end(&stream);
+    }
+    if (stats) {
+        stats->tokens = state.tokens.stats();
+        stats->expressions = state.expressions.stats();
+    }
+
+    // Every node the code generator's context points to belongs to the parser's.
+    environmentClear(context->types);
+    environmentClear(context->variables);
+    environmentClear(context->functions);
+    parseContextDelete(context);
+    for (Binding *it = state.context->functions->bind; it; it = it->next)
+        deleteNode(it->value);
+    parseContextReset(state.context);
+    parseContextDelete(state.context);
+    // Both contexts are gone, so nothing on this thread will reuse their bindings.
+    environmentFreeListRelease();
+    fileUnmap(&state.source);
+    return err;
+}
+
+void printPipelineStats(const PipelineStats &stats, std::ostream &out) {
+    out << "Pipeline queue  capacity      items  full: stalls  time (ms)  empty: stalls  time (ms)\n";
+    const std::pair<const char *, const SpscQueueStats *> queues[] = {
+        {"tokens", &stats.tokens},
+        {"expressions", &stats.expressions},
+    };
+    for (const auto &queue : queues) {
+        const SpscQueueStats &entry = *queue.second;
+        std::ios::fmtflags flags = out.flags();
+        out << std::left << std::setw(14) << queue.first << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << entry.capacity
+            << std::setw(11) << entry.pushed
+            << std::setw(14) << entry.full_stalls
+            << std::setw(11) << static_cast<double>(entry.full_nanoseconds) / 1e6
+            << std::setw(15) << entry.empty_stalls
+            << std::setw(11) << static_cast<double>(entry.empty_nanoseconds) / 1e6 << '\n';
+        out.flags(flags);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef COMPILER_PIPELINE_H
+#define COMPILER_PIPELINE_H
+
+#include <ostream>
+
+#include "codegen.h"
+#include "error.h"
+#include "spsc_queue.h"
+
+struct PipelineStats {
+    /// Between the lexer and the parser.
+    SpscQueueStats tokens;
+    /// Between the parser and code generation.
+    SpscQueueStats expressions;
+};
+
+/**
+ * Compile the file at `path` like parseProgramStream() feeding
+ * codegen_stream_expression(), with the phases overlapped on three
+ * threads: a lexer thread fills a bounded queue of tokens, a parser thread
+ * turns them into top-level expressions and queues each one with the
+ * globals, functions and types it declared, and the calling thread emits
+ * code for them from its own context, so that no environment or scope
+ * stack is shared.
+ * @param stats Filled with the queue statistics if not NULL, even on error.
+ */
+Error pipelineCompile(char *path, CodegenOutputFormat format, PipelineStats *stats);
+/// How often and how long each side of each queue waited for the other.
+void printPipelineStats(const PipelineStats &stats, std::ostream &out);
+
+#endif /* COMPILER_PIPELINE_H */
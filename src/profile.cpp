@@ -0,0 +1,95 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+/// Share of all recorded calls that the hot functions account for.
+constexpr double PROFILE_HOT_FRACTION = 0.9;
+
+static bool profileReadWord(const std::string &data, size_t *offset, unsigned long long *word) {
+    if (*offset + 8 > data.size())
+        return false;
+    *word = 0;
+    for (size_t i = 0; i < 8; i++)
+        *word |= static_cast<unsigned long long>(static_cast<unsigned char>(data[*offset + i])) << (8 * i);
+    *offset += 8;
+    return true;
+}
+
+Error profileRead(const char *path, Profile *profile) {
+    Error err = ok;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        err.prepareError(ErrorType::GENERIC, std::string("profileRead(): Could not open ") + path);
+        return err;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    profile->calls.clear();
+    profile->hot.clear();
+    profile->total = 0;
+    size_t offset = 8;
+    unsigned long long count = 0;
+    if (data.compare(0, 8, PROFILE_MAGIC) != 0 || !profileReadWord(data, &offset, &count)) {
+        err.prepareError(ErrorType::GENERIC, std::string("profileRead(): Not a profile: ") + path);
+        return err;
+    }
+    for (unsigned long long i = 0; i < count; i++) {
+        unsigned long long calls = 0;
+        unsigned long long length = 0;
+        if (!profileReadWord(data, &offset, &calls) || !profileReadWord(data, &offset, &length)
+            || length > data.size() - offset) {
+            err.prepareError(ErrorType::GENERIC, std::string("profileRead(): Truncated profile: ") + path);
+            return err;
+        }
+        profile->calls[data.substr(offset, length)] += calls;
+        profile->total += calls;
+        offset += (length + 7) / 8 * 8;
+    }
+
+    std::vector<std::pair<unsigned long long, std::string>> by_calls;
+    for (const auto &entry : profile->calls)
+        by_calls.push_back({entry.second, entry.first});
+    std::sort(by_calls.rbegin(), by_calls.rend());
+    unsigned long long covered = 0;
+    for (const auto &entry : by_calls) {
+        if (!entry.first || covered >= PROFILE_HOT_FRACTION * profile->total)
+            break;
+        profile->hot.insert(entry.second);
+        covered += entry.first;
+    }
+    return ok;
+}
+
+unsigned long long profileCalls(const Profile *profile, const char *name) {
+    if (!profile)
+        return 0;
+    auto found = profile->calls.find(name);
+    return found == profile->calls.end() ? 0 : found->second;
+}
+
+bool profileIsHot(const Profile *profile, const char *name) {
+    return profile && profile->hot.count(name);
+}
+
+bool profileIsCold(const Profile *profile, const char *name) {
+    if (!profile)
+        return false;
+    auto found = profile->calls.find(name);
+    return found != profile->calls.end() && found->second == 0;
+}
+
+void printProfile(const Profile &profile, std::ostream &out) {
+    std::vector<std::pair<unsigned long long, std::string>> by_calls;
+    for (const auto &entry : profile.calls)
+        by_calls.push_back({entry.second, entry.first});
+    std::sort(by_calls.rbegin(), by_calls.rend());
+    out << "Profile: " << profile.total << " calls, " << profile.hot.size() << " hot functions\n";
+    for (const auto &entry : by_calls)
+        out << "  " << (profile.hot.count(entry.second) ? "hot  " : "     ")
+            << entry.first << ' ' << entry.second << '\n';
+}
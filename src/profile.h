@@ -0,0 +1,40 @@
+#ifndef COMPILER_PROFILE_H
+#define COMPILER_PROFILE_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "error.h"
+
+/// Where a program built with CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED writes its counts.
+constexpr const char *PROFILE_DEFAULT_PATH = "func.profdata";
+/// First eight bytes of a profile file.
+constexpr const char *PROFILE_MAGIC = "FUNCPROF";
+
+/**
+ * Call counts of the functions of one program, as dumped by its
+ * instrumented build. The file is the instrumented program's counter
+ * block, verbatim (all integers 64-bit little endian):
+ *
+ *   "FUNCPROF", function count,
+ *   then per function: call count, name length, name padded to 8 bytes
+ */
+struct Profile {
+    std::unordered_map<std::string, unsigned long long> calls;
+    unsigned long long total;
+    /// The most called functions that together take PROFILE_HOT_FRACTION of all calls.
+    std::unordered_set<std::string> hot;
+};
+
+Error profileRead(const char *path, Profile *profile);
+/// Calls recorded for `name`; 0 if it was never called or is not in the profile.
+unsigned long long profileCalls(const Profile *profile, const char *name);
+bool profileIsHot(const Profile *profile, const char *name);
+/// In the profile but never called.
+bool profileIsCold(const Profile *profile, const char *name);
+void printProfile(const Profile &profile, std::ostream &out);
+
+#endif /* COMPILER_PROFILE_H */
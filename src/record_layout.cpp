@@ -0,0 +1,227 @@
+#include "record_layout.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "environment.h"
+
+static long long recordAlign(long long value, long long alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static const char *recordLayoutKindName(RecordLayoutKind kind) {
+    switch (kind) {
+        case RecordLayoutKind::ORDERED: return "ordered";
+        case RecordLayoutKind::PACKED: return "packed";
+        default: return "reordered";
+    }
+}
+
+static const Node *recordName(const Node *type_info) {
+    return type_info->children->next_child->next_child->next_child;
+}
+
+static Node *recordFields(const Node *type_info) {
+    return recordName(type_info)->next_child->next_child;
+}
+
+static long long recordFieldOffset(const Node *field) {
+    return field->children->next_child->next_child->value.integer;
+}
+
+bool typeIsRecord(const Node *type_info) {
+    return type_info->type == NodeType::RECORD;
+}
+
+const char *recordTypeName(const Node *type_info) {
+    return recordName(type_info)->value.symbol;
+}
+
+RecordLayoutKind recordTypeLayout(const Node *type_info) {
+    const char *kind = recordName(type_info)->next_child->value.symbol;
+    if (strcmp(kind, "packed") == 0)
+        return RecordLayoutKind::PACKED;
+    if (strcmp(kind, "ordered") == 0)
+        return RecordLayoutKind::ORDERED;
+    return RecordLayoutKind::REORDERED;
+}
+
+std::vector<Node *> recordFieldsByOffset(const Node *type_info) {
+    std::vector<Node *> fields;
+    for (Node *field = recordFields(type_info)->children; field; field = field->next_child)
+        fields.push_back(field);
+    std::stable_sort(fields.begin(), fields.end(), [](const Node *a, const Node *b) {
+        return recordFieldOffset(a) < recordFieldOffset(b);
+    });
+    return fields;
+}
+
+Error recordTypeAdd(ParsingContext *context, Node *name, Node *fields, RecordLayoutKind kind) {
+    Error err = ok;
+    while (context->parent)
+        context = context->parent;
+    if (environmentFind(context->types, name)) {
+        err.prepareError(ErrorType::TYPE, std::string("Redefinition of type ") + name->value.symbol);
+        return err;
+    }
+    if (!fields->children) {
+        err.prepareError(ErrorType::TYPE, std::string("Record type ") + name->value.symbol + " has no fields");
+        return err;
+    }
+
+    struct Member {
+        Node *field;
+        long long size;
+        long long alignment;
+    };
+    std::vector<Member> members;
+    for (Node *field = fields->children; field; field = field->next_child) {
+        for (const Member &member : members) {
+            if (nodeCompare(member.field->children, field->children)) {
+                err.prepareError(ErrorType::TYPE, std::string("Duplicate field ") + field->children->value.symbol
+                                 + " in record " + name->value.symbol);
+                return err;
+            }
+        }
+        Node type_info;
+        if (parseGetType(context, field->children->next_child, &type_info).type != ErrorType::NONE) {
+            err.prepareError(ErrorType::TYPE, std::string("Unknown type of field ") + field->children->value.symbol
+                             + " in record " + name->value.symbol);
+            return err;
+        }
+        long long alignment = kind == RecordLayoutKind::PACKED ? 1 : typeAlignment(&type_info);
+        members.push_back({field, typeSize(&type_info), alignment});
+    }
+    if (kind == RecordLayoutKind::REORDERED) {
+        // Sizes are multiples of alignments, so each field ends aligned for the next.
+        std::stable_sort(members.begin(), members.end(), [](const Member &a, const Member &b) {
+            return a.alignment > b.alignment;
+        });
+    }
+    long long offset = 0;
+    long long alignment = 1;
+    for (const Member &member : members) {
+        offset = recordAlign(offset, member.alignment);
+        nodeAddChild(member.field, nodeInteger(offset));
+        offset += member.size;
+        alignment = std::max(alignment, member.alignment);
+    }
+
+    Node *type_node = nodeAllocate();
+    type_node->type = NodeType::RECORD;
+    nodeAddChild(type_node, nodeInteger(recordAlign(offset, alignment)));
+    nodeAddChild(type_node, nodeInteger(0));
+    nodeAddChild(type_node, nodeInteger(alignment));
+    nodeAddChild(type_node, nodeSymbol(name->value.symbol));
+    nodeAddChild(type_node, nodeSymbol(recordLayoutKindName(kind)));
+    nodeAddChild(type_node, fields);
+    environmentSet(context->types, name, type_node);
+    return ok;
+}
+
+void recordTypesClear(ParsingContext *context) {
+    std::vector<Binding *> records;
+    for (Binding *it = context->types->bind; it; it = it->next)
+        if (typeIsRecord(it->value))
+            records.push_back(it);
+    for (Binding *record : records) {
+        Node *id = record->id;
+        Node *value = record->value;
+        environmentRemove(context->types, id);
+        deleteNode(id);
+        deleteNode(value);
+    }
+}
+
+Error recordFieldPath(ParsingContext *context, const Node *record_info, const char *path, long long *offset,
+                      Node *field_info, Node **field_type_id) {
+    Error err = ok;
+    Node current = *record_info;
+    while (*path) {
+        const char *dot = strchr(path, '.');
+        size_t length = dot ? static_cast<size_t>(dot - path) : strlen(path);
+        std::string name(path, length);
+        if (!typeIsRecord(&current)) {
+            err.prepareError(ErrorType::TYPE, "Field " + name + " of a value that is not a record");
+            return err;
+        }
+        Node *field = recordFields(&current)->children;
+        while (field && strcmp(field->children->value.symbol, name.c_str()) != 0)
+            field = field->next_child;
+        if (!field) {
+            err.prepareError(ErrorType::TYPE, std::string("Record ") + recordTypeName(&current)
+                             + " has no field " + name);
+            return err;
+        }
+        *offset += recordFieldOffset(field);
+        Node *type_id = field->children->next_child;
+        if (parseGetType(context, type_id, &current).type != ErrorType::NONE) {
+            err.prepareError(ErrorType::TYPE, "Unknown type of field " + name);
+            return err;
+        }
+        if (field_type_id)
+            *field_type_id = type_id;
+        path += length;
+        if (dot && !*++path) {
+            err.prepareError(ErrorType::SYNTAX, "Expected a field name after '.'");
+            return err;
+        }
+    }
+    *field_info = current;
+    return ok;
+}
+
+void printRecordLayout(ParsingContext *context, const Node *type_info, std::ostream &out) {
+    std::vector<Node *> fields = recordFieldsByOffset(type_info);
+    long long size = typeSize(type_info);
+    RecordLayoutKind kind = recordTypeLayout(type_info);
+    std::vector<long long> sizes;
+    long long padding = size;
+    for (Node *field : fields) {
+        Node field_info;
+        parseGetType(context, field->children->next_child, &field_info);
+        sizes.push_back(typeSize(&field_info));
+        padding -= sizes.back();
+    }
+    out << "record " << recordTypeName(type_info) << " (" << recordLayoutKindName(kind) << "): size " << size
+        << ", alignment " << typeAlignment(type_info) << ", " << padding << " bytes of padding";
+    if (kind == RecordLayoutKind::REORDERED) {
+        // What the same fields would take in the order they were declared.
+        long long declared = 0;
+        long long alignment = 1;
+        for (Node *field = recordFields(type_info)->children; field; field = field->next_child) {
+            Node field_info;
+            parseGetType(context, field->children->next_child, &field_info);
+            declared = recordAlign(declared, typeAlignment(&field_info)) + typeSize(&field_info);
+            alignment = std::max(alignment, typeAlignment(&field_info));
+        }
+        out << ", " << recordAlign(declared, alignment) << " bytes in declaration order";
+    }
+    out << "\n    offset  size  field\n";
+    long long end = 0;
+    for (size_t i = 0; i <= fields.size(); i++) {
+        long long offset = i < fields.size() ? recordFieldOffset(fields[i]) : size;
+        if (offset > end)
+            out << "    " << std::setw(6) << end << "  " << std::setw(4) << offset - end << "  (padding)\n";
+        if (i == fields.size())
+            break;
+        out << "    " << std::setw(6) << offset << "  " << std::setw(4) << sizes[i] << "  "
+            << fields[i]->children->value.symbol << " : " << fields[i]->children->next_child->value.symbol << '\n';
+        end = offset + sizes[i];
+    }
+}
+
+void printRecordLayouts(ParsingContext *context, std::ostream &out) {
+    while (context->parent)
+        context = context->parent;
+    // Bindings are kept newest first.
+    std::vector<const Node *> records;
+    for (Binding *it = context->types->bind; it; it = it->next)
+        if (typeIsRecord(it->value))
+            records.push_back(it->value);
+    for (auto it = records.rbegin(); it != records.rend(); ++it)
+        printRecordLayout(context, *it, out);
+}
@@ -0,0 +1,56 @@
+#ifndef COMPILER_RECORD_LAYOUT_H
+#define COMPILER_RECORD_LAYOUT_H
+
+#include <ostream>
+#include <vector>
+
+#include "error.h"
+#include "parser.h"
+
+enum class RecordLayoutKind {
+    /// Fields sorted by alignment, largest first, so padding is only ever needed at the end.
+    REORDERED,
+    /// Fields in declaration order, each at its natural alignment.
+    ORDERED,
+    /// Fields in declaration order without any padding; the record is 1-byte aligned.
+    PACKED,
+};
+
+/**
+ * Record type nodes (NodeType::RECORD) hold, like every type node, their
+ * byte size and signedness (0) first, then their alignment, the record's
+ * name, the layout kind as a symbol ("reordered", "ordered", "packed") and a
+ * NONE list of fields in declaration order. Each field is a NONE node
+ * holding the field name, its type symbol and its byte offset.
+ *
+ * A record is only ever used through its fields: `p.x` names field `x` of
+ * variable `p`, at a fixed offset from it, and `p.q.x` reaches into a
+ * nested record. Records are not assigned, passed or returned as a whole.
+ */
+
+/**
+ * Lay out `fields` (a NONE list of NONE nodes holding a field name and a type
+ * symbol) and bind the record type `name` in the root types environment.
+ * On success both nodes belong to the types environment.
+ */
+Error recordTypeAdd(ParsingContext *context, Node *name, Node *fields, RecordLayoutKind kind);
+bool typeIsRecord(const Node *type_info);
+const char *recordTypeName(const Node *type_info);
+RecordLayoutKind recordTypeLayout(const Node *type_info);
+/// The field nodes of a record type, in offset order.
+std::vector<Node *> recordFieldsByOffset(const Node *type_info);
+/// Forget the record types of the program in `context`, keeping the built-in types.
+void recordTypesClear(ParsingContext *context);
+/**
+ * Follow `path` ("x" or "q.x") from a record of type `record_info` to one
+ * of its fields, adding up the offsets into `offset`.
+ * @param field_type_id Where to put the type symbol of the field, if not NULL.
+ */
+Error recordFieldPath(ParsingContext *context, const Node *record_info, const char *path, long long *offset,
+                      Node *field_info, Node **field_type_id = nullptr);
+/// Every field of the record type in offset order, with the padding between them.
+void printRecordLayout(ParsingContext *context, const Node *type_info, std::ostream &out);
+/// Layouts of every record type declared in `context`, in declaration order.
+void printRecordLayouts(ParsingContext *context, std::ostream &out);
+
+#endif /* COMPILER_RECORD_LAYOUT_H */
@@ -0,0 +1,147 @@
+#ifndef COMPILER_SPSC_QUEUE_H
+#define COMPILER_SPSC_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "timing.h"
+
+struct SpscQueueStats {
+    size_t capacity;
+    size_t pushed;
+    /// Times the producer found the queue full, and how long it waited in total.
+    size_t full_stalls;
+    long long full_nanoseconds;
+    /// Times the consumer found the queue empty, and how long it waited in total.
+    size_t empty_stalls;
+    long long empty_nanoseconds;
+};
+
+/**
+ * Bounded ring buffer between exactly one producer thread and one consumer
+ * thread, without locks: each side owns one index and only reads the other
+ * one, and a value is published by the release store of the index after it.
+ * A side that finds the ring full or empty spins for a while, then yields,
+ * and counts the time as a stall.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    /// `capacity` is rounded up to a power of two.
+    explicit SpscQueue(size_t capacity):
+        head_(0),
+        tail_cache_(0),
+        empty_stalls_(0),
+        empty_nanoseconds_(0),
+        tail_(0),
+        head_cache_(0),
+        full_stalls_(0),
+        full_nanoseconds_(0),
+        closed_(false)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    /// Producer side: wait for room, then publish `value`.
+    /// @retval false The consumer closed the queue; `value` was not queued.
+    bool push(T value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == slots_.size()) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == slots_.size()) {
+                long long begin = timingNow();
+                unsigned spins = 0;
+                while (tail - head_cache_ == slots_.size()) {
+                    if (closed_.load(std::memory_order_relaxed))
+                        return false;
+                    backoff(&spins);
+                    head_cache_ = head_.load(std::memory_order_acquire);
+                }
+                full_stalls_ += 1;
+                full_nanoseconds_ += timingNow() - begin;
+            }
+        }
+        if (closed_.load(std::memory_order_relaxed))
+            return false;
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer side: wait for at least one value, then take up to `count` of them.
+    size_t pop(T *out, size_t count) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_cache_ == head) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (tail_cache_ == head) {
+                long long begin = timingNow();
+                unsigned spins = 0;
+                while (tail_cache_ == head) {
+                    backoff(&spins);
+                    tail_cache_ = tail_.load(std::memory_order_acquire);
+                }
+                empty_stalls_ += 1;
+                empty_nanoseconds_ += timingNow() - begin;
+            }
+        }
+        return take(head, out, count);
+    }
+
+    /// Consumer side: take up to `count` values without waiting.
+    size_t tryPop(T *out, size_t count) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_cache_ == head)
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        return take(head, out, count);
+    }
+
+    /// Consumer side: make push() fail from now on, so that the producer stops.
+    void close() {
+        closed_.store(true, std::memory_order_relaxed);
+    }
+
+    /// Only meaningful once neither side uses the queue any more.
+    SpscQueueStats stats() const {
+        return {slots_.size(), tail_.load(std::memory_order_relaxed), full_stalls_, full_nanoseconds_,
+                empty_stalls_, empty_nanoseconds_};
+    }
+
+private:
+    static void backoff(unsigned *spins) {
+        // Spinning only pays off when the other side runs on another core meanwhile.
+        static const bool multicore = std::thread::hardware_concurrency() > 1;
+        if (!multicore || ++*spins > 64)
+            std::this_thread::yield();
+    }
+
+    size_t take(size_t head, T *out, size_t count) {
+        size_t taken = std::min(count, tail_cache_ - head);
+        for (size_t i = 0; i < taken; i++)
+            out[i] = std::move(slots_[(head + i) & mask_]);
+        head_.store(head + taken, std::memory_order_release);
+        return taken;
+    }
+
+    std::vector<T> slots_;
+    size_t mask_;
+    // Each side's index and private state share a cache line the other side rarely reads.
+    alignas(64) std::atomic<size_t> head_;
+    size_t tail_cache_;
+    size_t empty_stalls_;
+    long long empty_nanoseconds_;
+    alignas(64) std::atomic<size_t> tail_;
+    size_t head_cache_;
+    size_t full_stalls_;
+    long long full_nanoseconds_;
+    alignas(64) std::atomic<bool> closed_;
+};
+
+#endif /* COMPILER_SPSC_QUEUE_H */
@@ -0,0 +1,145 @@
+#include "timing.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+bool timing_enabled = false;
+
+struct TimingPhase {
+    const char *name;
+    size_t count;
+    long long total;
+};
+
+struct TimingEvent {
+    const char *phase;
+    std::string detail;
+    long long begin;
+    long long end;
+    int thread;
+};
+
+static std::vector<TimingPhase> timing_phases;
+static std::vector<TimingEvent> timing_events;
+static long long timing_origin = 0;
+/// Guards the phases and events, which the stages of --pipeline record from their own threads.
+static std::mutex timing_mutex;
+static int timing_thread_count = 0;
+/// Trace viewer row of the calling thread, numbered from 1 in order of first use.
+static thread_local int timing_thread = 0;
+
+void timingEnable(bool enable) {
+    timing_enabled = enable;
+    if (enable && !timing_origin)
+        timing_origin = timingNow();
+}
+
+long long timingNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void timingRecord(const char *phase, const char *detail, long long begin, long long end, bool trace) {
+    std::lock_guard<std::mutex> lock(timing_mutex);
+    if (!timing_thread)
+        timing_thread = ++timing_thread_count;
+    TimingPhase *entry = nullptr;
+    // Phase names are string literals, so pointer equality almost always hits.
+    for (TimingPhase &it : timing_phases) {
+        if (it.name == phase || std::strcmp(it.name, phase) == 0) {
+            entry = &it;
+            break;
+        }
+    }
+    if (!entry) {
+        timing_phases.push_back({phase, 0, 0});
+        entry = &timing_phases.back();
+    }
+    entry->count += 1;
+    entry->total += end - begin;
+    if (trace)
+        timing_events.push_back({phase, detail ? detail : "", begin, end, timing_thread});
+}
+
+void timingPrintSummary(std::ostream &out) {
+    long long total = 0;
+    for (const TimingEvent &event : timing_events)
+        if (std::strcmp(event.phase, "total") == 0)
+            total += event.end - event.begin;
+
+    out << "===-------------------------------------------------------------===\n";
+    out << "                      Compiler phase timing\n";
+    out << "===-------------------------------------------------------------===\n";
+    out << std::left << std::setw(28) << "Phase"
+        << std::right << std::setw(10) << "Count"
+        << std::setw(14) << "Time (ms)"
+        << std::setw(10) << "%" << '\n';
+    for (const TimingPhase &phase : timing_phases) {
+        out << std::left << std::setw(28) << phase.name
+            << std::right << std::setw(10) << phase.count
+            << std::setw(14) << std::fixed << std::setprecision(3) << phase.total / 1e6;
+        if (total)
+            out << std::setw(9) << std::setprecision(1) << 100.0 * phase.total / total << '%';
+        out << '\n';
+    }
+    out << "Phases nest (lex runs inside parseExpr), so percentages do not sum to 100.\n";
+}
+
+static void writeJsonString(std::ostream &out, const char *string) {
+    out << '"';
+    for (const char *it = string; *it; it++) {
+        switch (*it) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(*it) < 0x20)
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                        << static_cast<int>(*it) << std::dec << std::setfill(' ');
+                else
+                    out << *it;
+                break;
+        }
+    }
+    out << '"';
+}
+
+Error timingWriteChromeTrace(const char *path) {
+    Error err = ok;
+    std::ofstream trace(path, std::ios::binary);
+    if (!trace.is_open()) {
+        err.prepareError(ErrorType::GENERIC, std::string("timingWriteChromeTrace(): Could not open ") + path);
+        return err;
+    }
+    trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const TimingEvent &event : timing_events) {
+        if (!first)
+            trace << ',';
+        first = false;
+        trace << "\n{\"name\":";
+        writeJsonString(trace, event.phase);
+        // Trace viewers expect microseconds.
+        trace << ",\"cat\":\"compiler\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+              << ",\"ts\":" << std::fixed << std::setprecision(3) << (event.begin - timing_origin) / 1e3
+              << ",\"dur\":" << (event.end - event.begin) / 1e3;
+        if (!event.detail.empty()) {
+            trace << ",\"args\":{\"detail\":";
+            writeJsonString(trace, event.detail.c_str());
+            trace << '}';
+        }
+        trace << '}';
+    }
+    trace << "\n]}\n";
+    if (!trace) {
+        err.prepareError(ErrorType::GENERIC, "timingWriteChromeTrace(): Could not write trace");
+        return err;
+    }
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef COMPILER_TIMING_H
+#define COMPILER_TIMING_H
+
+#include <cstddef>
+#include <ostream>
+
+#include "error.h"
+
+/// Set by `--time-passes`; every probe checks it before touching the clock.
+extern bool timing_enabled;
+
+void timingEnable(bool enable);
+long long timingNow();
+/**
+ * Record one timed interval of a phase.
+ * @param phase Must outlive the timing data (use a string literal).
+ * @param detail Optional, copied; only kept for trace events.
+ * @param trace Whether to keep an individual trace event, or only add
+ *              to the phase totals (for very hot phases such as lexing).
+ */
+void timingRecord(const char *phase, const char *detail, long long begin, long long end, bool trace);
+void timingPrintSummary(std::ostream &out);
+Error timingWriteChromeTrace(const char *path);
+
+/// Times the enclosing block when timing is enabled.
+struct TimingScope {
+    const char *phase;
+    const char *detail;
+    bool trace;
+    bool active;
+    long long begin;
+
+    TimingScope(const char *phase_name, const char *detail_string = nullptr, bool trace_event = true):
+        phase(phase_name),
+        detail(detail_string),
+        trace(trace_event),
+        active(timing_enabled),
+        begin(active ? timingNow() : 0)
+    {}
+
+    ~TimingScope() {
+        if (active)
+            timingRecord(phase, detail, begin, timingNow(), trace);
+    }
+};
+
+#endif /* COMPILER_TIMING_H */
@@ -0,0 +1,218 @@
+#include "toolchain.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/// Buffers generated code and writes it to a pipe, and to a copy of it if one is given.
+class ToolchainPipeBuffer : public std::streambuf {
+public:
+    ToolchainPipeBuffer(int fd, std::ofstream *copy):
+        fd_(fd),
+        copy_(copy),
+        buffer_(1 << 16)
+    {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!flush())
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        return flush() ? 0 : -1;
+    }
+
+private:
+    bool flush() {
+        const char *it = pbase();
+        size_t length = static_cast<size_t>(pptr() - pbase());
+        if (copy_)
+            copy_->write(it, static_cast<std::streamsize>(length));
+        while (length) {
+            ssize_t count = write(fd_, it, length);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            it += count;
+            length -= static_cast<size_t>(count);
+        }
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+        return true;
+    }
+
+    int fd_;
+    std::ofstream *copy_;
+    std::vector<char> buffer_;
+};
+
+/// Start `arguments[0]`, found on PATH, with its stdin read from `stdin_fd` unless that is -1.
+static Error toolchainSpawn(const std::vector<std::string> &arguments, int stdin_fd, pid_t *pid) {
+    Error err = ok;
+    std::vector<char *> argv;
+    for (const std::string &argument : arguments)
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdin_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    int status = posix_spawnp(pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (status != 0)
+        err.prepareError(ErrorType::GENERIC, "toolchain: could not run " + arguments[0] + ": " + std::strerror(status));
+    return err;
+}
+
+static Error toolchainWait(pid_t pid, const std::string &tool) {
+    Error err = ok;
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            err.prepareError(ErrorType::GENERIC, "toolchain: lost track of " + tool);
+            return err;
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        err.prepareError(ErrorType::GENERIC, "toolchain: " + tool + " failed");
+    return err;
+}
+
+/// Linux entry point: _start returns, so the process has to exit by itself.
+static const char *toolchain_entry_linux =
+    ".section .text\n"
+    ".global __func_entry\n"
+    "__func_entry:\n"
+    "call _start\n"
+    "mov $60, %eax\n"
+    "xor %edi, %edi\n"
+    "syscall\n";
+
+/// Generate code into the stdin of `arguments`, copying it to `save_path` if that is not NULL.
+static Error toolchainPipeCode(CodegenOutputFormat format, ParsingContext *context, Node *program,
+                               const CodegenOptions &codegen_options, const std::vector<std::string> &arguments,
+                               const char *save_path) {
+    Error err = ok;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        err.prepareError(ErrorType::GENERIC, "toolchain: could not create a pipe");
+        return err;
+    }
+    // Neither end may leak into the child other than as its stdin, or it never sees end of input.
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    pid_t pid;
+    err = toolchainSpawn(arguments, fds[0], &pid);
+    close(fds[0]);
+    if (err.type != ErrorType::NONE) {
+        close(fds[1]);
+        return err;
+    }
+
+    std::ofstream copy;
+    if (save_path)
+        copy.open(save_path, std::ios::binary);
+    // A tool that exits early must fail the write, not kill the compiler.
+    void (*sigpipe)(int) = std::signal(SIGPIPE, SIG_IGN);
+    {
+        ToolchainPipeBuffer buffer(fds[1], save_path ? &copy : nullptr);
+        std::ostream code(&buffer);
+        err = codegen_program_output(format, context, program, code, codegen_options);
+        if (err.type == ErrorType::NONE && format != CodegenOutputFormat::C99)
+            code << toolchain_entry_linux;
+        code.flush();
+        if (err.type == ErrorType::NONE && !code)
+            err.prepareError(ErrorType::GENERIC, "toolchain: could not write code to " + arguments[0]);
+    }
+    // Half of a program is not worth the tool's complaints.
+    if (err.type != ErrorType::NONE)
+        kill(pid, SIGTERM);
+    close(fds[1]);
+    std::signal(SIGPIPE, sigpipe);
+    // The tool is waited for either way; a codegen error explains its failure better.
+    Error waited = toolchainWait(pid, arguments[0]);
+    if (err.type != ErrorType::NONE)
+        return err;
+    if (waited.type != ErrorType::NONE)
+        return waited;
+    if (save_path && !copy)
+        err.prepareError(ErrorType::GENERIC, std::string("toolchain: could not write ") + save_path);
+    return err;
+}
+
+Error toolchainBuildExecutable(CodegenOutputFormat format, ParsingContext *context, Node *program,
+                               const char *output_path, const CodegenOptions &codegen_options,
+                               const ToolchainOptions &options) {
+    Error err = ok;
+    std::string output = output_path;
+    if (format == CodegenOutputFormat::C99) {
+        TimingScope timing("codegen and compile C");
+        std::string save_path = output + ".c";
+        std::vector<std::string> arguments = {options.c_compiler, "-std=c99", "-O2", "-x", "c", "-o", output, "-"};
+        return toolchainPipeCode(format, context, program, codegen_options, arguments,
+                                 options.save_temps ? save_path.c_str() : nullptr);
+    }
+
+    std::string object = output + ".o";
+    std::string save_path = output + ".S";
+    {
+        TimingScope timing("codegen and assemble");
+        // Without input files the assembler reads stdin.
+        std::vector<std::string> arguments = {options.assembler, "-o", object};
+        err = toolchainPipeCode(format, context, program, codegen_options, arguments,
+                                options.save_temps ? save_path.c_str() : nullptr);
+    }
+    if (err.type == ErrorType::NONE) {
+        TimingScope timing("link");
+        pid_t pid;
+        std::vector<std::string> arguments = {options.linker, "-e", "__func_entry", "-o", output, object};
+        err = toolchainSpawn(arguments, -1, &pid);
+        if (err.type == ErrorType::NONE)
+            err = toolchainWait(pid, options.linker);
+    }
+    if (!options.save_temps)
+        std::remove(object.c_str());
+    return err;
+}
+
+#else
+
+Error toolchainBuildExecutable(CodegenOutputFormat format, ParsingContext *context, Node *program,
+                               const char *output_path, const CodegenOptions &codegen_options,
+                               const ToolchainOptions &options) {
+    (void)format;
+    (void)context;
+    (void)program;
+    (void)output_path;
+    (void)codegen_options;
+    (void)options;
+    Error err = ok;
+    err.prepareError(ErrorType::TODO, "toolchain: building executables needs a POSIX system; assemble code.S by hand");
+    return err;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef COMPILER_TOOLCHAIN_H
+#define COMPILER_TOOLCHAIN_H
+
+#include "codegen.h"
+#include "error.h"
+#include "parser.h"
+
+struct ToolchainOptions {
+    /// Also write the generated code and the object file next to the executable.
+    bool save_temps;
+    const char *assembler;
+    const char *linker;
+    /// Builds C99 output; it reads the code on stdin like the assembler does.
+    const char *c_compiler;
+
+    ToolchainOptions():
+        save_temps(false),
+        assembler("as"),
+        linker("ld"),
+        c_compiler("cc")
+    {}
+};
+
+/**
+ * Build an executable at `output_path` without writing code.S: the code is
+ * generated straight into a pipe to the assembler (or, for C99, the C
+ * compiler), which works on it while codegen is still producing more, and
+ * the object file is then linked. Assembly gets an entry point that calls
+ * _start and exits with status 0 through Linux system calls.
+ * With `save_temps`, the code is also written to `<output_path>.S` (or `.c`)
+ * and the object file is kept as `<output_path>.o`.
+ */
+Error toolchainBuildExecutable(CodegenOutputFormat format, ParsingContext *context, Node *program,
+                               const char *output_path, const CodegenOptions &codegen_options,
+                               const ToolchainOptions &options);
+
+#endif /* COMPILER_TOOLCHAIN_H */
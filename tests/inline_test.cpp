@@ -0,0 +1,313 @@
+// Inliner tests: each program is compiled without and with inlining, run,
+// and must leave the expected value in its globals either way. Programs are
+// linked with an entry point that calls _start and exits with the low byte
+// of a global, so the test needs `as` and `ld` on x86_64 Linux and is
+// skipped without them.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <utility>
+#include <vector>
+
+#include "compiler.h"
+#include "error.h"
+#include "inline.h"
+#include "parser.h"
+#include "profile.h"
+
+/// ctest's SKIP_RETURN_CODE for the test: programs can not be assembled here.
+constexpr int INLINE_TEST_SKIP = 77;
+
+static int failures = 0;
+
+static void inlineTestFail(const std::string &name, const std::string &message) {
+    std::cout << "FAIL " << name << ": " << message << '\n';
+    failures += 1;
+}
+
+/// Build `assembly` with an entry point that exits with the low byte of `variable`; false if `as` or `ld` fail.
+static bool inlineTestLink(const std::string &assembly, const char *variable) {
+    {
+        std::ofstream file("inline_test.S", std::ios::binary);
+        file << assembly
+             << ".section .text\n"
+             << ".global inline_test_entry\n"
+             << "inline_test_entry:\n"
+             << "call _start\n"
+             << "mov " << variable << "(%rip), %rdi\n"
+             << "mov $60, %eax\n"
+             << "syscall\n";
+    }
+    int status = std::system("as inline_test.S -o inline_test.o > /dev/null 2>&1"
+                             " && ld -e inline_test_entry inline_test.o -o inline_test > /dev/null 2>&1");
+    std::remove("inline_test.S");
+    std::remove("inline_test.o");
+    return status == 0;
+}
+
+/// Exit status of the linked program, or -1 if it did not exit.
+static int inlineTestRun() {
+    int status = std::system("./inline_test");
+    std::remove("inline_test");
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static bool inlineTestCompile(const std::string &name, const std::string &source, const CompileOptions &options,
+                              std::string *output) {
+    Compiler *compiler = compilerCreate(0);
+    Error err = compilerCompileBuffer(compiler, source.data(), source.size(), options, output, nullptr);
+    compilerDelete(compiler);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        inlineTestFail(name, "does not compile");
+        return false;
+    }
+    return true;
+}
+
+/// Run the program compiled with `options` and compare the low byte of `variable` with `expected`.
+static void expectValue(const std::string &name, const std::string &source, const CompileOptions &options,
+                        const char *variable, int expected) {
+    std::string output;
+    if (!inlineTestCompile(name, source, options, &output))
+        return;
+    if (!inlineTestLink(output, variable)) {
+        inlineTestFail(name, "does not assemble");
+        return;
+    }
+    int value = inlineTestRun();
+    if (value != (expected & 255))
+        inlineTestFail(name, std::string(variable) + " is " + std::to_string(value) + ", expected "
+                       + std::to_string(expected & 255));
+}
+
+/// Run the inliner alone over `source`.
+static bool inlineTestStats(const std::string &name, const std::string &source, const InlineOptions &options,
+                            InlineStats *stats) {
+    ParsingContext *context = parseContextDefaultCreate();
+    Node *program = nodeAllocate();
+    std::string buffer = source;
+    Error err = parseProgramBuffer(&buffer[0], context, program);
+    if (err.type == ErrorType::NONE)
+        err = inlineProgram(context, program, options, stats);
+    parseContextReset(context);
+    deleteNode(program);
+    parseContextDelete(context);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        inlineTestFail(name, "can not be inlined");
+        return false;
+    }
+    return true;
+}
+
+/// Check every variable without inlining and with it, where every call site must be inlined.
+static void expectInlined(const std::string &name, const std::string &source,
+                          const std::vector<std::pair<const char *, int>> &values) {
+    CompileOptions plain;
+    CompileOptions inlined;
+    inlined.inline_functions = true;
+    inlined.inline_options.max_body_nodes = 128;
+    for (auto &value : values) {
+        expectValue(name, source, plain, value.first, value.second);
+        expectValue(name + " inlined", source, inlined, value.first, value.second);
+    }
+
+    InlineStats stats;
+    if (inlineTestStats(name, source, inlined.inline_options, &stats)
+        && (!stats.call_sites || stats.inlined != stats.call_sites))
+        inlineTestFail(name, std::to_string(stats.inlined) + " of " + std::to_string(stats.call_sites)
+                       + " call sites inlined");
+}
+
+static void testCallPositions() {
+    // The call's value becomes the body's last expression, bound to the argument.
+    expectInlined("call positions",
+                  "func sq(a : integer) : integer {\n"
+                  "  a * a\n"
+                  "}\n"
+                  "v : integer = 7\n"
+                  "r : integer\n"
+                  "t : integer\n"
+                  "r := sq(v)\n"
+                  "sq(v)\n"
+                  "t := 2 * sq(v) - sq(v + 1)\n",
+                  {{"r", 49}, {"t", 34}});
+}
+
+static void testArgumentBinding() {
+    expectInlined("argument binding",
+                  "g : integer = 3\n"
+                  "func bump(a : integer) : integer {\n"
+                  "  a := a + 5\n"
+                  "  a\n"
+                  "}\n"
+                  "func mix(a : integer, b : integer) : integer {\n"
+                  "  t : integer = a + b\n"
+                  "  t := t * g\n"
+                  "  t + 1\n"
+                  "}\n"
+                  "func narrow(x : u8) : integer {\n"
+                  "  x + 1\n"
+                  "}\n"
+                  "func big(x : integer) : integer {\n"
+                  "  1000\n"
+                  "}\n"
+                  "v : integer = 7\n"
+                  "a : integer\n"
+                  "b : integer\n"
+                  "c : integer\n"
+                  "d : integer\n"
+                  "w : u8\n"
+                  "a := bump(v + 1) + v\n"
+                  "b := mix(v, bump(2))\n"
+                  "c := narrow(v * 40) + narrow(300)\n"
+                  "d := bump(v) * mix(1, v)\n"
+                  "w := big(v)\n",
+                  {{"a", 20}, {"b", 43}, {"c", 70}, {"d", 300}, {"w", 1000}});
+}
+
+static void testInlineIntoFunctionsAndLoops() {
+    expectInlined("functions and loops",
+                  "func sq(a : integer) : integer {\n"
+                  "  a * a\n"
+                  "}\n"
+                  "func sum(a : integer, b : integer) : integer {\n"
+                  "  a + b\n"
+                  "}\n"
+                  "func twice(p : integer) : integer {\n"
+                  "  q : integer = sq(p)\n"
+                  "  sum(q, p) + sq(q)\n"
+                  "}\n"
+                  "i : integer = 0\n"
+                  "s : integer\n"
+                  "r : integer\n"
+                  "while i < 4 {\n"
+                  "  s := s + sq(i) + sum(i, 1)\n"
+                  "  i := i + 1\n"
+                  "}\n"
+                  "r := twice(i)\n",
+                  {{"s", 24}, {"r", 276}});
+}
+
+static void testLoopsInCallees() {
+    // The callee's loop reads its parameter, bound to a literal, a variable or a temporary.
+    expectInlined("loops in callees",
+                  "func tri(n : integer) : integer {\n"
+                  "  i : integer = 0\n"
+                  "  s : integer\n"
+                  "  while i < n {\n"
+                  "    s := s + i\n"
+                  "    i := i + 1\n"
+                  "  }\n"
+                  "  s\n"
+                  "}\n"
+                  "func halves(n : integer) : integer {\n"
+                  "  steps : integer\n"
+                  "  while 1 < n {\n"
+                  "    n := n - 2\n"
+                  "    steps := steps + 1\n"
+                  "  }\n"
+                  "  steps + tri(n + 3)\n"
+                  "}\n"
+                  "v : integer = 7\n"
+                  "j : integer = 0\n"
+                  "r : integer\n"
+                  "t : integer\n"
+                  "h : integer\n"
+                  "r := tri(v) + tri(4)\n"
+                  "while j < 3 {\n"
+                  "  t := t + tri(j + 2)\n"
+                  "  j := j + 1\n"
+                  "}\n"
+                  "h := halves(v) * 10 + v\n",
+                  {{"r", 27}, {"t", 10}, {"j", 3}, {"h", 97}});
+}
+
+static void testProfileGuided() {
+    // `hot` is too large for the default threshold but not for a hot callee,
+    // `once` is neither hot nor cold, and `never` runs zero times.
+    const std::string source =
+        "func hot(a : integer, b : integer) : integer {\n"
+        "  t : integer = a * b\n"
+        "  t + a - b\n"
+        "}\n"
+        "func once(a : integer) : integer {\n"
+        "  a + a + a + a + 1\n"
+        "}\n"
+        "func never(a : integer) : integer {\n"
+        "  a * 3 + 1\n"
+        "}\n"
+        "i : integer = 0\n"
+        "s : integer\n"
+        "r : integer\n"
+        "while i < 50 {\n"
+        "  s := s + hot(i, 3)\n"
+        "  i := i + 1\n"
+        "}\n"
+        "while i < 0 {\n"
+        "  r := never(i)\n"
+        "}\n"
+        "r := r + once(i)\n";
+    const char *name = "profile guided";
+    const char *profile_path = "inline_test.profdata";
+
+    CompileOptions instrumented;
+    instrumented.format = CodegenOutputFormat::x86_64_AT_T_ASM_INSTRUMENTED;
+    instrumented.codegen.profile_path = profile_path;
+    std::string output;
+    if (!inlineTestCompile(name, source, instrumented, &output))
+        return;
+    if (!inlineTestLink(output, "s")) {
+        inlineTestFail(name, "instrumented build does not assemble");
+        return;
+    }
+    // The instrumented program exits from _start once it has written the profile.
+    if (inlineTestRun() != 0) {
+        inlineTestFail(name, "instrumented run failed");
+        return;
+    }
+    Profile profile;
+    Error err = profileRead(profile_path, &profile);
+    std::remove(profile_path);
+    if (err.type != ErrorType::NONE) {
+        printError(err);
+        inlineTestFail(name, "no profile");
+        return;
+    }
+
+    CompileOptions optimized;
+    optimized.inline_functions = true;
+    optimized.inline_options.max_body_nodes = 4;
+    optimized.inline_options.profile = &profile;
+    InlineStats stats;
+    if (inlineTestStats(name, source, optimized.inline_options, &stats)
+        && (stats.call_sites != 3 || stats.inlined != 1 || stats.too_large != 1 || stats.cold != 1))
+        inlineTestFail(name, "expected the hot call inlined, the other too large and the cold one kept; got "
+                       + std::to_string(stats.inlined) + " inlined, " + std::to_string(stats.too_large)
+                       + " too large, " + std::to_string(stats.cold) + " cold");
+    expectValue(name, source, optimized, "s", 4750);
+    expectValue(name, source, optimized, "r", 201);
+}
+
+int main() {
+    if (std::system("as --version > /dev/null 2>&1 && ld --version > /dev/null 2>&1") != 0) {
+        std::cout << "Skipped: as and ld are needed to run compiled programs\n";
+        return INLINE_TEST_SKIP;
+    }
+    testCallPositions();
+    testArgumentBinding();
+    testInlineIntoFunctionsAndLoops();
+    testLoopsInCallees();
+    testProfileGuided();
+    if (failures) {
+        std::cout << failures << " failures\n";
+        return 1;
+    }
+    std::cout << "All inliner tests passed\n";
+    return 0;
+}